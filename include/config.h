@@ -19,16 +19,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <sys/un.h>
 #include <sys/ioctl.h>
 #include <math.h>
 #include <stdarg.h>
 #include <sys/wait.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <fxcrypt.h>
 #include <mbedtls/pk.h>
 #include <mbedtls/aes.h>
-#include <libnotify/notify.h>
 
 #define NET_TALK_VERSION "1.01.2"
 #define NETTALK_PERS_STRING "NetTalk_" NET_TALK_VERSION
@@ -36,19 +40,51 @@
 #define BUFSIZE 256
 #define HOSTLEN BUFSIZE
 #define CHANLEN 16
+#define NETTALK_RELAYS_MAX 8
+#define NETTALK_BUSY_BYTE '#'
 #define MSGSIZE 8192
+#define OUTBOX_SIZE 65536
+#define OUTBOX_FLUSH_MAX 4096
 #define NETTALK_CONN_TIMEOUT 4000
 #define NETTALK_SEND_TIMEOUT 4000
 #define NETTALK_RECV_TIMEOUT 4000
 #define NETTALK_WAIT_TIMEOUT 30000
+#define NETTALK_RETRY_DELAY_MIN 5000
+#define NETTALK_RETRY_DELAY_MAX 60000
+#define NETTALK_RECONNECT_JITTER 3000
+#define NETTALK_KEEPALIVE_INTERVAL 500
+#define NETTALK_CONTACTS_MAX 16
+#define NETTALK_HIST_NBUCKETS 14
 #define FORWARD_CHUNK_LEN 16384
 #define CHAT_HISTORY_NMAX 48
+#define NETTALK_SHAPE_RATE 65536
+#define NETTALK_SHAPE_BURST 131072
+#define NETTALK_NOTSENT_LOWAT 4096
+#define NETTALK_DIRECT_NCANDS 4
+#define NETTALK_DIRECT_PAYLOAD 1024
+#define NETTALK_DIRECT_PROBE_INTERVAL 50
+#define NETTALK_DIRECT_RETRY_INTERVAL 1000
+#define NETTALK_DIRECT_PUNCH_TIME 3000
+#define NETTALK_DIRECT_TIMEOUT 1500
+#define NETTALK_RESET_RETRY 1000
+#define NETTALK_STUN_TIMEOUT 300
+#define NETTALK_LAN_GROUP "239.255.78.84"
+#define NETTALK_LAN_PORT 7884
+#define NETTALK_LAN_INTERVAL 250
+#define NETTALK_LAN_TIMEOUT 1000
+#define NETTALK_ADAPT_INTERVAL 100
+#define NETTALK_ADAPT_BACKLOG_HIGH 200
+#define NETTALK_ADAPT_BACKLOG_LOW 40
+#define NETTALK_ADAPT_RTT_RISE 200
+#define NETTALK_ADAPT_DOWN_HOLD 25
+#define NETTALK_ADAPT_UP_HOLD 250
 
 #ifndef UNUSED
 #define UNUSED(x) (void)(x)
 #endif
 
 #define GtkWidget void
+#define NotifyNotification void
 
 #ifdef CONFIG_USE_GTK2
 #define VBOX_NEW gtk_vbox_new(0, 0)
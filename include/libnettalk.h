@@ -0,0 +1,103 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Embeddable Library Interface
+ * ------------------------------------------------------------------ */
+
+#ifndef LIBNETTALK_H
+#define LIBNETTALK_H
+
+#include <stddef.h>
+#include <poll.h>
+
+/**
+ * Maximum number of poll descriptors used by library
+ */
+#define LIBNETTALK_NPOLLFDS 3
+
+/**
+ * Library log event types
+ */
+enum
+{
+    LIBNETTALK_LOG_INFO = 'I',
+    LIBNETTALK_LOG_SUCCESS = 'S',
+    LIBNETTALK_LOG_ERROR = 'E'
+};
+
+/**
+ * Net Talk context, opaque to library users
+ */
+struct nettalk_context_t;
+
+/**
+ * Library event callbacks, any of them may be NULL
+ */
+struct libnettalk_callbacks_t
+{
+    /* Text message received from peer (self = FALSE) or acknowledged by peer (self = TRUE) */
+    void ( *on_text ) ( void *user, int self, const char *message, size_t len );
+    /* Peer session established or lost */
+    void ( *on_status ) ( void *user, int online );
+    /* Log message, event is one of LIBNETTALK_LOG_* */
+    void ( *on_log ) ( void *user, int event, const char *message, size_t len );
+    /* Decoded mono float frames, called from playback thread before device write */
+    void ( *on_audio ) ( void *user, const float *frames, size_t nframes, unsigned int rate );
+};
+
+/**
+ * Allocate new session context for config file
+ */
+extern struct nettalk_context_t *libnettalk_new ( const char *confpath );
+
+/**
+ * Set session event callbacks
+ */
+extern void libnettalk_set_callbacks ( struct nettalk_context_t *context,
+    const struct libnettalk_callbacks_t *callbacks, void *user );
+
+/**
+ * Enable or disable log events
+ */
+extern void libnettalk_set_verbose ( struct nettalk_context_t *context, int enabled );
+
+/**
+ * Enable or disable microphone
+ */
+extern void libnettalk_set_capture ( struct nettalk_context_t *context, int enabled );
+
+/**
+ * Enable or disable speaker
+ */
+extern void libnettalk_set_playback ( struct nettalk_context_t *context, int enabled );
+
+/**
+ * Decrypt config and start session networking task
+ */
+extern int libnettalk_start ( struct nettalk_context_t *context, const char *password );
+
+/**
+ * Get descriptors to wait for before dispatching events
+ */
+extern size_t libnettalk_get_pollfds ( struct nettalk_context_t *context, struct pollfd *fds,
+    size_t nfds );
+
+/**
+ * Dispatch pending events to callbacks, waiting at most timeout milliseconds
+ */
+extern int libnettalk_dispatch ( struct nettalk_context_t *context, int timeout );
+
+/**
+ * Send text message to peer, returns 1 if message was queued until peer is online
+ */
+extern int libnettalk_send_text ( struct nettalk_context_t *context, const char *message );
+
+/**
+ * Drop current session and connect again
+ */
+extern void libnettalk_reconnect ( struct nettalk_context_t *context );
+
+/**
+ * Stop session and free its context
+ */
+extern void libnettalk_free ( struct nettalk_context_t *context );
+
+#endif
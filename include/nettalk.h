@@ -6,6 +6,8 @@
 #define NETTALK_H
 
 #include "config.h"
+#include "libnettalk.h"
+#include "rendezvous.h"
 
 #define AMRNB_CHUNK_MIN         13
 #define AMRNB_CHUNK_MAX         32
@@ -81,6 +83,17 @@ struct nettalk_ack_t
 {
     long long encrypted;
     long long decrypted;
+    long long relayed;
+    long long sampled;
+};
+
+/**
+ * Net Talk relay server
+ */
+struct nettalk_relay_t
+{
+    char hostname[HOSTLEN];
+    unsigned short port;
 };
 
 /**
@@ -88,9 +101,9 @@ struct nettalk_ack_t
  */
 struct nettalk_config_t
 {
-    char hostname[HOSTLEN];
+    size_t nrelays;
+    struct nettalk_relay_t relays[NETTALK_RELAYS_MAX];
     char channel[CHANLEN + 1];
-    unsigned short port;
     mbedtls_pk_context self_rsa_priv_key;
     mbedtls_pk_context self_rsa_pub_key;
     mbedtls_pk_context peer_rsa_pub_key;
@@ -106,6 +119,141 @@ struct nettalk_random_t
     mbedtls_entropy_context entropy;
 };
 
+/**
+ * Net Talk token bucket
+ */
+struct nettalk_bucket_t
+{
+    int throttled;
+    long long rate;
+    long long burst;
+    long long tokens;
+    long long stamp;
+};
+
+/**
+ * Net Talk traffic counters
+ */
+struct nettalk_counters_t
+{
+    unsigned long long tx_bytes;
+    unsigned long long tx_packets;
+    unsigned long long rx_bytes;
+    unsigned long long rx_packets;
+};
+
+/**
+ * Net Talk latency histogram
+ */
+struct nettalk_hist_t
+{
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long buckets[NETTALK_HIST_NBUCKETS];
+};
+
+/**
+ * Net Talk statistics, updated lock-free by worker threads
+ */
+struct nettalk_stats_t
+{
+    unsigned long long connects;
+    unsigned long long pairings;
+    unsigned long long refusals;
+    unsigned long long tx_bytes;
+    unsigned long long tx_packets;
+    unsigned long long rx_bytes;
+    unsigned long long rx_packets;
+    unsigned long long throttled;
+    unsigned long long wakeups;
+    struct nettalk_hist_t pairing_latency;
+    struct nettalk_hist_t loop_busy;
+    struct nettalk_hist_t capture_latency;
+    struct nettalk_hist_t encode_queue_latency;
+    unsigned long long capture_overruns;
+    unsigned long long capture_dropped;
+    unsigned long long capture_queued;
+    unsigned long long capture_cpu_ns;
+    unsigned long long capture_audio_ns;
+    unsigned long long playback_cpu_ns;
+    unsigned long long playback_audio_ns;
+    unsigned long long voice_frames;
+    unsigned long long voice_sent_frames;
+    unsigned long long voice_gated_frames;
+    unsigned long long voice_bytes;
+    unsigned long long voice_encode_ns;
+    unsigned long long voice_mode_changes;
+    unsigned long long comfort_frames;
+};
+
+/**
+ * Net Talk resampler profiles
+ */
+enum
+{
+    NETTALK_RESAMPLER_FIR = 0,
+    NETTALK_RESAMPLER_LOW,
+    NETTALK_RESAMPLER_MEDIUM,
+    NETTALK_RESAMPLER_HIGH,
+    NETTALK_RESAMPLER_VERY_HIGH
+};
+
+/**
+ * Net Talk direct path states
+ */
+enum
+{
+    NETTALK_DIRECT_OFF = 0,
+    NETTALK_DIRECT_PUNCHING,
+    NETTALK_DIRECT_UP
+};
+
+/**
+ * Net Talk direct path candidate address
+ */
+struct nettalk_candidate_t
+{
+    unsigned int addr;
+    unsigned short port;
+};
+
+/**
+ * Net Talk direct peer path over UDP
+ */
+struct nettalk_direct_t
+{
+    int sock;
+    int state;
+    int heard;
+    size_t ncands;
+    struct nettalk_candidate_t cands[NETTALK_DIRECT_NCANDS];
+    struct sockaddr_in peer;
+    unsigned long long tx_seq;
+    unsigned long long rx_seq;
+    int rx_gap;
+    uint8_t tx_key[SHA256_BLOCKLEN];
+    uint8_t rx_key[SHA256_BLOCKLEN];
+    long long started;
+    long long probed;
+    long long received;
+};
+
+/**
+ * Net Talk local network discovery
+ */
+struct nettalk_lan_t
+{
+    int msock;
+    int lsock;
+    int dial;
+    unsigned int peer_addr;
+    unsigned short peer_port;
+    unsigned short port;
+    long long announced;
+    uint8_t nonce[8];
+    uint8_t hash[SHA256_BLOCKLEN];
+};
+
 /**
  * Net Talk session structure
  */
@@ -121,6 +269,12 @@ struct nettalk_session_t
     uint8_t tx_left[FORWARD_CHUNK_LEN];
     size_t rx_nleft;
     uint8_t rx_left[FORWARD_CHUNK_LEN];
+    int relay_hold;
+    struct nettalk_bucket_t shaper;
+    struct nettalk_counters_t counters;
+    struct nettalk_direct_t direct;
+    volatile int backlog;
+    volatile unsigned int rtt;
 };
 
 /**
@@ -132,6 +286,15 @@ struct nettalk_msgbuf_t
     char array[MSGSIZE];
 };
 
+/**
+ * Net Talk outgoing messages queued while peer is offline
+ */
+struct nettalk_outbox_t
+{
+    size_t len;
+    char array[OUTBOX_SIZE];
+};
+
 /**
  * Net Talk GUI
  */
@@ -155,6 +318,20 @@ struct nettalk_gui_t
 struct nettalk_context_t
 {
     int complete;
+    int running;
+    volatile int stopping;
+    volatile int user_reconnect;
+    int reported_online;
+    int headless;
+    int group;
+    int mcu;
+    int alsa_rw;
+    int audio_float;
+    int no_dtx;
+    int codec;
+    unsigned int audio_rate;
+    int resampler;
+    int resampler_double;
     int verbose;
     volatile int online;
     int nmessages;
@@ -164,9 +341,19 @@ struct nettalk_context_t
     int socks5_enabled;
     unsigned int socks5_addr;
     unsigned short socks5_port;
+    int direct_enabled;
+    int lan_enabled;
+    struct nettalk_lan_t lan;
+    unsigned int stun_addr;
+    unsigned short stun_port;
+    size_t relay_index;
+    size_t relay_refusals;
     struct timeval alarm_timestamp;
     NotifyNotification *notif;
     const char *confpath;
+    const char *stats_path;
+    int stats_sock;
+    struct nettalk_stats_t stats;
     struct nettalk_random_t random;
     struct nettalk_session_t session;
     struct nettalk_config_t config;
@@ -179,6 +366,12 @@ struct nettalk_context_t
     struct nettalk_msgbuf_t bufloop;
     struct pipe_t applog;
     struct nettalk_msgbuf_t buflog;
+    struct nettalk_outbox_t outbox;
+    const struct libnettalk_callbacks_t *callbacks;
+    void *user;
+    struct audio_mixer_t *mixer;
+    volatile int mixer_slot;
+    pthread_t nettask_thread;
     struct pipe_t reset_pipe;
     volatile int capture_status;
     volatile struct timeval capture_status_timestamp;
@@ -190,6 +383,7 @@ struct nettalk_context_t
     volatile struct timeval playback_preset_timestamp;
     volatile int reset_encoder_self;
     volatile int reset_encoder_peer;
+    volatile unsigned int peer_codecs;
     time_t msg_timeouts[CHAT_HISTORY_NMAX];
 };
 
@@ -224,6 +418,11 @@ extern int socket_set_blocking ( int sock );
  */
 extern int socket_set_nonblocking ( int sock );
 
+/**
+ * Set socket options for low latency voice traffic
+ */
+extern int socket_set_low_latency ( int sock );
+
 /**
  * Connect socket with timeout
  */
@@ -317,6 +516,16 @@ extern int pipe_new_nonblocking ( struct pipe_t *thepipe );
  */
 extern int gettimeofdayv ( volatile struct timeval *tv );
 
+/**
+ * Send message to peer or queue it until peer is online
+ */
+extern int outbox_send_message ( struct nettalk_context_t *context, const char *message );
+
+/**
+ * Flush messages queued while peer was offline
+ */
+extern void outbox_flush ( struct nettalk_context_t *context );
+
 /**
  * AMR-NB compression state reset chunk
  */
@@ -332,6 +541,11 @@ extern const uint8_t init_chunk[AMRNB_CHUNK_MAX];
  */
 extern const uint8_t noop_chunk[AMRNB_CHUNK_MAX];
 
+/**
+ * Direct path datagram loss chunk, never sent to peer
+ */
+extern const uint8_t loss_chunk[AMRNB_CHUNK_MAX];
+
 /**
  * Text message chunk
  */
@@ -342,6 +556,21 @@ extern const uint8_t text_chunk[AMRNB_CHUNK_MAX];
  */
 extern const uint8_t ack_chunk[AMRNB_CHUNK_MAX];
 
+/**
+ * Decodable codecs announcement chunk
+ */
+extern const uint8_t caps_chunk[AMRNB_CHUNK_MAX];
+
+/**
+ * Parse decodable codecs announcement chunk
+ */
+extern unsigned int caps_chunk_decode ( const uint8_t * chunk );
+
+/**
+ * Build decodable codecs announcement chunk
+ */
+extern void caps_chunk_encode ( unsigned int caps, uint8_t * chunk );
+
 /**
  * Connect with remote peer
  */
@@ -357,16 +586,72 @@ extern int nettalk_handshake ( struct nettalk_context_t *context );
  */
 extern int nettalk_forward_data ( struct nettalk_context_t *context );
 
+/**
+ * Send single chunk over relay while media goes direct
+ */
+extern int nettalk_relay_send_chunk ( struct nettalk_context_t *context, const uint8_t * chunk );
+
+/**
+ * Open local network discovery sockets
+ */
+extern int nettalk_lan_open ( struct nettalk_context_t *context );
+
+/**
+ * Look for peer on local network
+ */
+extern int nettalk_lan_poll ( struct nettalk_context_t *context, int extrafd, int timeout );
+
+/**
+ * Close local network discovery sockets
+ */
+extern void nettalk_lan_close ( struct nettalk_context_t *context );
+
+/**
+ * Exchange direct path candidates with peer
+ */
+extern int nettalk_direct_setup ( struct nettalk_context_t *context );
+
+/**
+ * Get milliseconds left until next direct path event
+ */
+extern int nettalk_direct_timeout ( struct nettalk_context_t *context, long long now );
+
+/**
+ * Handle direct path probes and incoming datagrams
+ */
+extern int nettalk_direct_cycle ( struct nettalk_context_t *context, struct pollfd *pfd,
+    long long now );
+
+/**
+ * Forward application data over direct path
+ */
+extern int nettalk_direct_send ( struct nettalk_context_t *context, int srcfd );
+
+/**
+ * Close direct path
+ */
+extern void nettalk_direct_free ( struct nettalk_context_t *context );
+
 /**
  * Launch Networking Task
  */
 extern int nettask_launch ( struct nettalk_context_t *context );
 
+/**
+ * Stop Networking Task
+ */
+extern void nettask_stop ( struct nettalk_context_t *context );
+
 /**
  * Reconnect the session
  */
 extern void reconnect_session ( struct nettalk_context_t *context );
 
+/**
+ * Reconnect the session on user request, without reconnect jitter
+ */
+extern void user_reconnect_session ( struct nettalk_context_t *context );
+
 /**
  * Check if session reconnect is in progress
  */
@@ -377,6 +662,22 @@ extern int session_would_reconnect ( struct nettalk_context_t *context );
  */
 extern int window_init ( struct nettalk_context_t *context );
 
+/**
+ * Initialize application context
+ */
+extern int nettalk_context_init ( struct nettalk_context_t *context );
+
+/**
+ * Uninitialize application context
+ */
+extern void nettalk_context_free ( struct nettalk_context_t *context );
+
+/**
+ * Run application without user interface
+ */
+extern int headless_init ( struct nettalk_context_t *context, char *const *confpaths,
+    size_t nconfpaths );
+
 /**
  * Voice Capture Task
  */
@@ -398,6 +699,31 @@ extern int socks5_handshake ( struct nettalk_context_t *context, int sock );
 extern int socks5_request_hostname ( struct nettalk_context_t *context, int sock,
     const char *hostname, unsigned short port );
 
+/**
+ * Get monotonic time in microseconds
+ */
+extern long long nettalk_stats_micros ( void );
+
+/**
+ * Add value to statistics counter
+ */
+extern void nettalk_stats_add ( unsigned long long *counter, unsigned long long value );
+
+/**
+ * Set statistics gauge
+ */
+extern void nettalk_stats_set ( unsigned long long *gauge, unsigned long long value );
+
+/**
+ * Record microseconds value in latency histogram
+ */
+extern void nettalk_stats_observe ( struct nettalk_hist_t *hist, unsigned long long micros );
+
+/**
+ * Launch statistics endpoint task
+ */
+extern int nettalk_stats_launch ( struct nettalk_context_t *context );
+
 /**
  * Log info message
  */
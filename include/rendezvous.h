@@ -0,0 +1,16 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Relay Rendezvous Hash Header
+ * ------------------------------------------------------------------ */
+
+#ifndef NETTALK_RENDEZVOUS_H
+#define NETTALK_RENDEZVOUS_H
+
+#include <stdint.h>
+
+/**
+ * Calculate rendezvous hash score of relay for channel
+ */
+extern uint64_t nettalk_relay_score ( const char *channel, const char *hostname,
+    unsigned short port );
+
+#endif
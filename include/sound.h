@@ -13,8 +13,47 @@
 #define AUDIO_RATE_DEFAULT      44100
 #define AMRNB_SAMPLES_MAX       160
 #define ALSA_DEFAULT_DEV        "default"
-#define NETTALK_ENCODE_NCHUNKS  128
+#define AUDIO_CAPTURE_PERIOD    20000
+#define AUDIO_CAPTURE_NPERIODS  4
+#define AUDIO_CAPTURE_QUEUE     8
 #define NETTALK_DECODE_NCHUNKS  2048
+#define AUDIO_MIXER_RATE        8000
+#define AUDIO_MIXER_PERIOD      160
+#define AUDIO_MIXER_PREBUFFER   480
+#define AUDIO_MIXER_RING        8192
+#define AUDIO_MIXER_LATENCY     100000
+#define AUDIO_MIXER_OUTRING     1600
+#define AUDIO_FIR_ORDER         24
+#define AUDIO_FIR_FACTOR_MAX    1000
+#define AMRNB_FRAME_SID         8
+#define AMRNB_FRAME_FILLER      14
+#define AMRNB_FRAME_NO_DATA     15
+#define AUDIO_VAD_ENERGY_MIN    64
+#define AUDIO_VAD_RATIO         8
+#define AUDIO_VAD_HANGOVER      25
+#define AUDIO_VAD_SUBSAMPLE     4
+#define AUDIO_COMFORT_POLL      10
+#define AUDIO_COMFORT_QUEUE     40
+#define AUDIO_CODEC_OPUS        0
+#define AUDIO_CODEC_AMRNB       1
+#define AUDIO_CODEC_COUNT       2
+#define AUDIO_OPUS_FRAME        13
+#define AUDIO_OPUS_DTX_FLAG     0x80
+#define AUDIO_OPUS_PAYLOAD_MAX  125
+#define AUDIO_OPUS_LOSS_PERC    10
+#define AUDIO_FRAME_MAX         ( 2 + AUDIO_OPUS_PAYLOAD_MAX )
+
+/**
+ * Sample conversion instruction set levels
+ */
+enum
+{
+    AUDIO_SIMD_SCALAR = 0,
+    AUDIO_SIMD_SSE2,
+    AUDIO_SIMD_AVX2,
+    AUDIO_SIMD_NEON,
+    AUDIO_SIMD_NLEVELS
+};
 
 /*
  * CMR     MODE        FRAME SIZE( in bytes )
@@ -28,6 +67,53 @@
  *  7      AMR 12.2        32
  */
 
+/**
+ * Polyphase resampler context
+ */
+struct audio_fir_t
+{
+    unsigned int up;
+    unsigned int down;
+    size_t ntaps;
+    size_t len;
+    size_t pos;
+    size_t phase;
+    float *taps;
+    float *line;
+    short *taps16;
+    short *line16;
+};
+
+struct audio_encoder_t;
+struct audio_decoder_t;
+
+/**
+ * Voice codec backend
+ */
+struct audio_codec_t
+{
+    const char *name;
+    int ( *encoder_init ) ( struct nettalk_context_t *, struct audio_encoder_t * );
+    int ( *encoder_reset ) ( struct audio_encoder_t * );
+    ssize_t ( *encode ) ( struct audio_encoder_t *, short *, unsigned char *, int * );
+    void ( *encoder_free ) ( struct audio_encoder_t * );
+    int ( *decoder_init ) ( struct nettalk_context_t *, struct audio_decoder_t * );
+    int ( *decoder_reset ) ( struct audio_decoder_t * );
+    ssize_t ( *decode ) ( struct audio_decoder_t *, const unsigned char *, size_t, short *,
+        size_t * );
+    void ( *decoder_free ) ( struct audio_decoder_t * );
+};
+
+/**
+ * Voice activity gate context
+ */
+struct audio_vad_t
+{
+    unsigned long long floor;
+    unsigned int hangover;
+    unsigned int skipped;
+};
+
 /**
  * Audio encoder context
  */
@@ -38,6 +124,7 @@ struct audio_encoder_t
     unsigned int outrate;
     unsigned int bitrate;
     snd_pcm_format_t format;
+    int s16;
 
     size_t frames_max;
     float *resample_in;
@@ -46,10 +133,32 @@ struct audio_encoder_t
     size_t samples_left;
     short *samples;
     unsigned char *output;
+    int codec;
     void *amrnb;
     void *sid_sync;
+    void *opus;
+    int opus_mode;
+    int opus_fec;
     int amrnb_mode;
+    int amrnb_max;
+    unsigned int rtt_min;
+    unsigned int adapt_hold;
+    unsigned int adapt_clear;
     soxr_t soxr;
+    struct audio_fir_t fir;
+
+    int dtx;
+    int dtx_on;
+    int silent;
+    size_t stream_pos;
+    size_t last_len;
+    int chunked;
+    struct audio_vad_t vad;
+    unsigned long long frames;
+    unsigned long long sent;
+    unsigned long long gated;
+    unsigned long long bytes;
+    unsigned long long encode_ns;
 
     int ( *init_callback ) ( struct nettalk_context_t *, struct audio_encoder_t * );
     int ( *process_callback ) ( struct nettalk_context_t *, struct audio_encoder_t *, const void *,
@@ -71,6 +180,42 @@ struct audio_mic_t
     struct audio_encoder_t *encoder;
 };
 
+/**
+ * Captured period waiting for encoder
+ */
+struct audio_period_t
+{
+    unsigned char *frames;
+    size_t nframes;
+    long long captured;
+    unsigned long long latency;
+};
+
+/**
+ * Captured periods queue with single producer and single consumer, lock-free
+ */
+struct audio_ring_t
+{
+    size_t head;
+    size_t tail;
+    unsigned char *buffer;
+    struct pipe_t notify;
+    struct audio_period_t periods[AUDIO_CAPTURE_QUEUE];
+};
+
+/**
+ * Encoder stage fed by microphone capture thread
+ */
+struct audio_encode_stage_t
+{
+    struct nettalk_context_t *context;
+    struct audio_encoder_t *encoder;
+    struct audio_ring_t ring;
+    unsigned int rate;
+    volatile int running;
+    int err;
+};
+
 /**
  * Audio decoder context
  */
@@ -80,8 +225,12 @@ struct audio_decoder_t
     unsigned int inrate;
     unsigned int outrate;
     snd_pcm_format_t format;
+    int s16;
 
     int reset_needed;
+    long long reset_asked;
+    int dtx;
+    int lost;
     size_t frames_max;
     size_t input_len;
     size_t input_size;
@@ -90,12 +239,17 @@ struct audio_decoder_t
     float *resample_in;
     float *resample_out;
     short *samples;
+    int codec;
     void *amrnb;
+    void *opus;
     soxr_t soxr;
+    struct audio_fir_t fir;
 
     int ( *init_callback ) ( struct nettalk_context_t *, struct audio_decoder_t * );
     int ( *process_callback ) ( struct nettalk_context_t *, struct audio_decoder_t *, void *,
         size_t * );
+    int ( *comfort_callback ) ( struct nettalk_context_t *, struct audio_decoder_t *, void *,
+        size_t * );
     void ( *free_callback ) ( struct audio_decoder_t * );
 };
 
@@ -109,10 +263,49 @@ struct audio_speaker_t
     unsigned int channels;
     unsigned int rate;
     snd_pcm_format_t format;
+    int mmap;
 
     struct audio_decoder_t *decoder;
 };
 
+/**
+ * Group call mixer participant
+ */
+struct audio_mixer_slot_t
+{
+    int active;
+    int primed;
+    size_t head;
+    size_t tail;
+    unsigned long long frames;
+    unsigned long long decode_ns;
+    unsigned long long mix_ns;
+    unsigned long long encode_ns;
+    unsigned long long out_frames;
+    int mixed;
+    size_t out_head;
+    size_t out_tail;
+    float period[AUDIO_MIXER_PERIOD];
+    float ring[AUDIO_MIXER_RING];
+    float outring[AUDIO_MIXER_OUTRING];
+};
+
+/**
+ * Group call mixer context
+ */
+struct audio_mixer_t
+{
+    char dev[BUFSIZE];
+    unsigned int rate;
+    volatile int running;
+    int mcu;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct nettalk_context_t *context;
+    struct audio_mixer_slot_t slots[NETTALK_CONTACTS_MAX];
+};
+
 /**
  * Convert float array to short integer array
  */
@@ -133,6 +326,277 @@ extern void audio_short_to_float_array ( const short *input, float *output, int
  */
 extern void audio_int_to_float_array ( const int *input, float *output, int count );
 
+/**
+ * Shrink sound from multi-channel to mono in place
+ */
+extern void audio_downmix_float_array ( float *samples, size_t channels, int frames );
+
+/**
+ * Expand sound from mono to multi-channel in place
+ */
+extern void audio_upmix_float_array ( float *samples, size_t channels, int frames );
+
+/**
+ * Check if CPU supports instruction set level
+ */
+extern int audio_simd_supported ( int level );
+
+/**
+ * Select conversion kernels by instruction set level
+ */
+extern int audio_simd_select ( int level );
+
+/**
+ * Get instruction set level name
+ */
+extern const char *audio_simd_name ( int level );
+
+/**
+ * Add float array to float array
+ */
+extern void audio_mix_float_array ( const float *input, float *output, int count );
+
+/**
+ * Subtract float array from float array
+ */
+extern void audio_mix_minus_float_array ( const float *total, const float *own, float *output,
+    int count );
+
+/**
+ * Saturate float array to [-1.0, 1.0] range
+ */
+extern void audio_clip_float_array ( float *samples, int count );
+
+/**
+ * Negotiate device rate, preferring AMR-NB rate or its integer multiple
+ */
+extern int audio_pcm_set_rate ( snd_pcm_t * handle, snd_pcm_hw_params_t * hw_params,
+    unsigned int *rate );
+
+/**
+ * Set device sample format, falling back to other formats converters handle
+ */
+extern int audio_pcm_set_format ( snd_pcm_t * handle, snd_pcm_hw_params_t * hw_params,
+    snd_pcm_format_t * format );
+
+/**
+ * Log thread CPU time used per second of audio
+ */
+extern void audio_report_cpu ( struct nettalk_context_t *context, const char *name,
+    unsigned long long cpu_ns, unsigned long long audio_ns );
+
+/**
+ * Create resampler selected by profile
+ */
+extern int audio_resampler_init ( struct nettalk_context_t *context, const char *name,
+    unsigned int inrate, unsigned int outrate, int s16, soxr_t * soxr, struct audio_fir_t *fir );
+
+/**
+ * Initialize polyphase resampler
+ */
+extern int audio_fir_init ( struct audio_fir_t *fir, unsigned int inrate, unsigned int outrate );
+
+/**
+ * Initialize polyphase resampler with additional Q14 taps for short samples
+ */
+extern int audio_fir_init_s16 ( struct audio_fir_t *fir, unsigned int inrate,
+    unsigned int outrate );
+
+/**
+ * Resample with polyphase filter, returns output frames count
+ */
+extern size_t audio_fir_process ( struct audio_fir_t *fir, const float *input, size_t count,
+    float *output );
+
+/**
+ * Resample short samples with Q14 polyphase filter, returns output frames count
+ */
+extern size_t audio_fir_process_s16 ( struct audio_fir_t *fir, const short *input, size_t count,
+    short *output );
+
+/**
+ * Get polyphase resampler delay in input frames
+ */
+extern double audio_fir_delay ( const struct audio_fir_t *fir );
+
+/**
+ * Uninitialize polyphase resampler
+ */
+extern void audio_fir_free ( struct audio_fir_t *fir );
+
+/**
+ * Get voice codec backend
+ */
+extern const struct audio_codec_t *audio_codec_get ( int codec );
+
+/**
+ * Find voice codec by name
+ */
+extern int audio_codec_find ( const char *name );
+
+/**
+ * Get mask of codecs this build decodes
+ */
+extern unsigned int audio_codec_caps ( void );
+
+/**
+ * Pick codec for sending, preferred one if peer decodes it, AMR-NB otherwise
+ */
+extern int audio_codec_pick ( unsigned int peer_caps, int preferred );
+
+/**
+ * Get codec of encoded frame by its header
+ */
+extern int audio_codec_of_frame ( unsigned char header );
+
+/**
+ * Take codecs announced by peer, own encoder is reset when they change
+ */
+extern void audio_codec_peer_caps ( struct nettalk_context_t *context,
+    const unsigned char *chunk );
+
+/**
+ * Initialize AMR-NB encoder backend
+ */
+extern int audio_amrnb_encoder_init ( struct nettalk_context_t *context,
+    struct audio_encoder_t *encoder );
+
+/**
+ * Encode AMR-NB frame, returns output length, zero if nothing is sent
+ */
+extern ssize_t audio_amrnb_encode ( struct audio_encoder_t *encoder, short *samples,
+    unsigned char *output, int *silent );
+
+/**
+ * Reset AMR-NB encoder backend state
+ */
+extern int audio_amrnb_encoder_reset ( struct audio_encoder_t *encoder );
+
+/**
+ * Uninitialize AMR-NB encoder backend
+ */
+extern void audio_amrnb_encoder_free ( struct audio_encoder_t *encoder );
+
+/**
+ * Initialize AMR-NB decoder backend
+ */
+extern int audio_amrnb_decoder_init ( struct nettalk_context_t *context,
+    struct audio_decoder_t *decoder );
+
+/**
+ * Decode AMR-NB frame, returns consumed length, zero if frame is incomplete,
+ * missing frame is concealed when input is NULL
+ */
+extern ssize_t audio_amrnb_decode ( struct audio_decoder_t *decoder, const unsigned char *input,
+    size_t len, short *samples, size_t *nsamples );
+
+/**
+ * Reset AMR-NB decoder backend state
+ */
+extern int audio_amrnb_decoder_reset ( struct audio_decoder_t *decoder );
+
+/**
+ * Uninitialize AMR-NB decoder backend
+ */
+extern void audio_amrnb_decoder_free ( struct audio_decoder_t *decoder );
+
+/**
+ * Initialize Opus encoder backend
+ */
+extern int audio_opus_encoder_init ( struct nettalk_context_t *context,
+    struct audio_encoder_t *encoder );
+
+/**
+ * Encode Opus frame, returns output length, zero if nothing is sent
+ */
+extern ssize_t audio_opus_encode ( struct audio_encoder_t *encoder, short *samples,
+    unsigned char *output, int *silent );
+
+/**
+ * Reset Opus encoder backend state
+ */
+extern int audio_opus_encoder_reset ( struct audio_encoder_t *encoder );
+
+/**
+ * Uninitialize Opus encoder backend
+ */
+extern void audio_opus_encoder_free ( struct audio_encoder_t *encoder );
+
+/**
+ * Initialize Opus decoder backend
+ */
+extern int audio_opus_decoder_init ( struct nettalk_context_t *context,
+    struct audio_decoder_t *decoder );
+
+/**
+ * Decode Opus frame, returns consumed length, zero if frame is incomplete,
+ * missing frame is concealed when input is NULL
+ */
+extern ssize_t audio_opus_decode ( struct audio_decoder_t *decoder, const unsigned char *input,
+    size_t len, short *samples, size_t *nsamples );
+
+/**
+ * Reset Opus decoder backend state
+ */
+extern int audio_opus_decoder_reset ( struct audio_decoder_t *decoder );
+
+/**
+ * Uninitialize Opus decoder backend
+ */
+extern void audio_opus_decoder_free ( struct audio_decoder_t *decoder );
+
+/**
+ * Initialize voice activity gate
+ */
+extern void audio_vad_init ( struct audio_vad_t *vad );
+
+/**
+ * Check if AMR-NB frame should be encoded, silent one is skipped after hangover
+ */
+extern int audio_vad_process ( struct audio_vad_t *vad, const short *samples, int silent );
+
+/**
+ * Get filler length, so that stream ends aligned and last frame is followed by full chunk
+ */
+extern size_t audio_dtx_padding ( size_t stream_len, size_t frame_len );
+
+/**
+ * Launch group call mixer task
+ */
+extern int audio_mixer_launch ( struct nettalk_context_t *context, struct audio_mixer_t *mixer );
+
+/**
+ * Stop group call mixer task
+ */
+extern void audio_mixer_stop ( struct audio_mixer_t *mixer );
+
+/**
+ * Join group call mixer as a participant
+ */
+extern int audio_mixer_join ( struct audio_mixer_t *mixer );
+
+/**
+ * Leave group call mixer
+ */
+extern void audio_mixer_leave ( struct audio_mixer_t *mixer, int slot );
+
+/**
+ * Queue participant decoded frames for mixing
+ */
+extern void audio_mixer_push ( struct audio_mixer_t *mixer, int slot, const float *frames,
+    size_t nframes, unsigned long long decode_ns );
+
+/**
+ * Wait for participant mix-minus frames
+ */
+extern ssize_t audio_mixer_pull ( struct audio_mixer_t *mixer, int slot, float *frames,
+    size_t nframes, unsigned long long encode_ns );
+
+/**
+ * Get thread CPU time in nanoseconds
+ */
+extern unsigned long long audio_thread_nanos ( void );
+
 /**
  * Process audio encoding
  */
@@ -145,6 +609,12 @@ extern int nettalk_audio_encoder_init ( struct nettalk_context_t *context,
 extern int nettalk_encode_audio ( struct nettalk_context_t *context,
     struct audio_encoder_t *encoder, const void *frames, size_t nframes );
 
+/**
+ * Log bandwidth and CPU time saved by discontinuous transmission
+ */
+extern void nettalk_audio_encoder_report ( struct nettalk_context_t *context,
+    struct audio_encoder_t *encoder );
+
 /**
  * Uninitialize audio encoder
  */
@@ -162,6 +632,12 @@ extern int nettalk_audio_decoder_init ( struct nettalk_context_t *context,
 extern int nettalk_decode_audio ( struct nettalk_context_t *context,
     struct audio_decoder_t *decoder, void *frames, size_t *nframes );
 
+/**
+ * Generate comfort noise while peer sends no frames
+ */
+extern int nettalk_decode_comfort_noise ( struct nettalk_context_t *context,
+    struct audio_decoder_t *decoder, void *frames, size_t *nframes );
+
 /**
  * Uninitialize audio decoder
  */
@@ -5,6 +5,205 @@
 #include "nettalk.h"
 #include "sound.h"
 
+/**
+ * Initialize captured periods queue
+ */
+static int audio_ring_init ( struct audio_ring_t *ring, size_t period_bytes )
+{
+    size_t i;
+
+    ring->head = 0;
+    ring->tail = 0;
+
+    if ( !( ring->buffer = ( unsigned char * ) malloc ( AUDIO_CAPTURE_QUEUE * period_bytes ) ) )
+    {
+        return -1;
+    }
+
+    for ( i = 0; i < AUDIO_CAPTURE_QUEUE; i++ )
+    {
+        ring->periods[i].frames = ring->buffer + i * period_bytes;
+    }
+
+    /* Capture thread must never block on wakeup */
+    if ( pipe_new_nonblocking ( &ring->notify ) < 0 )
+    {
+        free_ref ( ( void ** ) &ring->buffer );
+        return -1;
+    }
+
+    if ( socket_set_nonblocking ( ring->notify.u.s.writefd ) < 0 )
+    {
+        pipe_close ( &ring->notify );
+        free_ref ( ( void ** ) &ring->buffer );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get free period at queue head, NULL if queue is full
+ */
+static struct audio_period_t *audio_ring_reserve ( struct audio_ring_t *ring )
+{
+    size_t head;
+
+    head = __atomic_load_n ( &ring->head, __ATOMIC_RELAXED );
+
+    if ( head - __atomic_load_n ( &ring->tail, __ATOMIC_ACQUIRE ) >= AUDIO_CAPTURE_QUEUE )
+    {
+        return NULL;
+    }
+
+    return &ring->periods[head % AUDIO_CAPTURE_QUEUE];
+}
+
+/**
+ * Publish reserved period to consumer, returns queue depth
+ */
+static size_t audio_ring_commit ( struct audio_ring_t *ring )
+{
+    size_t head;
+    unsigned char wakeup = 0;
+
+    head = __atomic_load_n ( &ring->head, __ATOMIC_RELAXED ) + 1;
+    __atomic_store_n ( &ring->head, head, __ATOMIC_RELEASE );
+
+    /* Full pipe already holds pending wakeup */
+    if ( write ( ring->notify.u.s.writefd, &wakeup, sizeof ( wakeup ) ) < 0 )
+    {
+    }
+
+    return head - __atomic_load_n ( &ring->tail, __ATOMIC_RELAXED );
+}
+
+/**
+ * Wait for oldest queued period, NULL on timeout
+ */
+static struct audio_period_t *audio_ring_front ( struct audio_ring_t *ring, int timeout )
+{
+    size_t tail;
+    unsigned char wakeups[64];
+    struct pollfd fds[1];
+
+    tail = __atomic_load_n ( &ring->tail, __ATOMIC_RELAXED );
+
+    if ( __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE ) == tail )
+    {
+        fds[0].fd = ring->notify.u.s.readfd;
+        fds[0].events = POLLIN;
+
+        if ( poll ( fds, 1, timeout ) <= 0 )
+        {
+            return NULL;
+        }
+
+        while ( read ( ring->notify.u.s.readfd, wakeups, sizeof ( wakeups ) ) > 0 )
+        {
+        }
+
+        if ( __atomic_load_n ( &ring->head, __ATOMIC_ACQUIRE ) == tail )
+        {
+            return NULL;
+        }
+    }
+
+    return &ring->periods[tail % AUDIO_CAPTURE_QUEUE];
+}
+
+/**
+ * Release oldest period back to producer, returns queue depth
+ */
+static size_t audio_ring_pop ( struct audio_ring_t *ring )
+{
+    size_t tail;
+
+    tail = __atomic_load_n ( &ring->tail, __ATOMIC_RELAXED ) + 1;
+    __atomic_store_n ( &ring->tail, tail, __ATOMIC_RELEASE );
+
+    return __atomic_load_n ( &ring->head, __ATOMIC_RELAXED ) - tail;
+}
+
+/**
+ * Uninitialize captured periods queue
+ */
+static void audio_ring_free ( struct audio_ring_t *ring )
+{
+    pipe_close ( &ring->notify );
+    free_ref ( ( void ** ) &ring->buffer );
+}
+
+/**
+ * Encoder stage entry point, resamples, encodes and sends captured periods
+ */
+static void *audioenc_entry ( void *arg )
+{
+    long long started;
+    unsigned long long latency;
+    unsigned long long queued;
+    unsigned long long cpu;
+    unsigned long long now;
+    struct audio_period_t *period;
+    struct audio_encode_stage_t *stage = ( struct audio_encode_stage_t * ) arg;
+    struct nettalk_context_t *context = stage->context;
+    struct audio_encoder_t *encoder = stage->encoder;
+
+    cpu = audio_thread_nanos (  );
+
+    while ( stage->running )
+    {
+        if ( !( period = audio_ring_front ( &stage->ring, 100 ) ) )
+        {
+            continue;
+        }
+
+        started = nettalk_stats_micros (  );
+        queued = started - period->captured;
+        nettalk_stats_observe ( &context->stats.encode_queue_latency, queued );
+
+        /* Oldest sample sent now waited in device, queue, resampler and encoder carry-over */
+        latency = period->latency + queued
+            + encoder->samples_left * 1000000ULL / encoder->outrate;
+
+        if ( encoder->soxr )
+        {
+            latency +=
+                ( unsigned long long ) ( soxr_delay ( encoder->soxr ) * 1000000 /
+                encoder->outrate );
+
+        } else if ( encoder->fir.taps )
+        {
+            latency += ( unsigned long long ) ( audio_fir_delay ( &encoder->fir ) * 1000000 /
+                stage->rate );
+        }
+
+        /* Send may block on stalled network, capture thread keeps reading meanwhile */
+        if ( ( stage->err =
+                encoder->process_callback ( context, encoder, period->frames,
+                    period->nframes ) ) < 0 )
+        {
+            break;
+        }
+
+        nettalk_stats_set ( &context->stats.capture_queued, audio_ring_pop ( &stage->ring ) );
+
+        /* Account CPU time of this stage */
+        now = audio_thread_nanos (  );
+        nettalk_stats_add ( &context->stats.capture_cpu_ns, now - cpu );
+        cpu = now;
+
+        /* Record capture-to-send latency */
+        nettalk_stats_observe ( &context->stats.capture_latency,
+            latency + nettalk_stats_micros (  ) - started );
+    }
+
+    /* Capture thread stops as well */
+    stage->running = FALSE;
+
+    return NULL;
+}
+
 /**
  * Begin audio capturing
  */
@@ -13,11 +212,24 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
     int err = 0;
     unsigned int rate;
     size_t buffer_size;
+    unsigned long long cpu;
+    unsigned long long now;
+    unsigned long long cpu_base;
+    unsigned long long audio_base;
+    unsigned long long overruns = 0;
+    unsigned long long dropped = 0;
+    void *frames;
+    pthread_t encode_thread;
+    struct audio_period_t *period;
+    struct audio_encode_stage_t stage;
 
     unsigned char *buffer = NULL;
     snd_pcm_t *capture_handle;
     snd_pcm_hw_params_t *hw_params = NULL;
     snd_pcm_sframes_t read_frames;
+    snd_pcm_sframes_t delay;
+    snd_pcm_uframes_t period_size;
+    snd_pcm_uframes_t ring_size;
 
     /* Get request audio rate */
     rate = mic->rate;
@@ -46,7 +258,7 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
         goto exit;
     }
 
-    /* Set ALSA HW params access to read/write PCM interleaved */
+    /* Queued period outlives device ring slot, so it is read straight into the queue */
     if ( ( err =
             snd_pcm_hw_params_set_access ( capture_handle, hw_params,
                 SND_PCM_ACCESS_RW_INTERLEAVED ) ) < 0 )
@@ -56,16 +268,16 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
         goto exit;
     }
 
-    /* Set ALSA HW params mic format to acquired PCM format */
-    if ( ( err = snd_pcm_hw_params_set_format ( capture_handle, hw_params, mic->format ) ) < 0 )
+    /* Set ALSA HW params mic format to acquired PCM format, or one the device has */
+    if ( ( err = audio_pcm_set_format ( capture_handle, hw_params, &mic->format ) ) < 0 )
     {
         nettalk_error ( context, "mic get mic format failed" );
         nettalk_error ( context, "%s", snd_strerror ( err ) );
         goto exit;
     }
 
-    /* Set ALSA HW params mic exact or nearest rate */
-    if ( ( err = snd_pcm_hw_params_set_rate_near ( capture_handle, hw_params, &rate, 0 ) ) < 0 )
+    /* Set ALSA HW params mic rate, AMR-NB rate multiples avoid costly resampling */
+    if ( ( err = audio_pcm_set_rate ( capture_handle, hw_params, &rate ) ) < 0 )
     {
         nettalk_error ( context, "mic set mic rate failed" );
         nettalk_error ( context, "%s", snd_strerror ( err ) );
@@ -80,6 +292,30 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
         goto exit;
     }
 
+    /* Wake up once per AMR-NB frame instead of device default period */
+    period_size = ( unsigned long long ) rate * AUDIO_CAPTURE_PERIOD / 1000000;
+
+    if ( ( err =
+            snd_pcm_hw_params_set_period_size_near ( capture_handle, hw_params, &period_size,
+                0 ) ) < 0 )
+    {
+        nettalk_error ( context, "mic set period size failed" );
+        nettalk_error ( context, "%s", snd_strerror ( err ) );
+        goto exit;
+    }
+
+    /* Keep a few periods buffered to survive scheduling hiccups */
+    ring_size = period_size * AUDIO_CAPTURE_NPERIODS;
+
+    if ( ( err =
+            snd_pcm_hw_params_set_buffer_size_near ( capture_handle, hw_params,
+                &ring_size ) ) < 0 )
+    {
+        nettalk_error ( context, "mic set buffer size failed" );
+        nettalk_error ( context, "%s", snd_strerror ( err ) );
+        goto exit;
+    }
+
     /* Apply ALSA HW params */
     if ( ( err = snd_pcm_hw_params ( capture_handle, hw_params ) ) < 0 )
     {
@@ -88,6 +324,14 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
         goto exit;
     }
 
+    /* Get period size chosen by device */
+    if ( ( err = snd_pcm_hw_params_get_period_size ( hw_params, &period_size, 0 ) ) < 0 )
+    {
+        nettalk_error ( context, "mic get period size failed" );
+        nettalk_error ( context, "%s", snd_strerror ( err ) );
+        goto exit;
+    }
+
     /* Free ALSA HW params */
     snd_pcm_hw_params_free ( hw_params );
     hw_params = NULL;
@@ -100,8 +344,8 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
         goto exit;
     }
 
-    /* Calculate max frames per encode cycle */
-    mic->encoder->frames_max = NETTALK_ENCODE_NCHUNKS * AMRNB_SAMPLES_MAX;
+    /* Encode each period as soon as it is captured */
+    mic->encoder->frames_max = period_size;
 
     /* Configure encoder */
     mic->encoder->channels = mic->channels;
@@ -119,7 +363,7 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
         mic->encoder->frames_max * snd_pcm_format_width ( mic->format ) / 8 *
         mic->encoder->channels;
 
-    /* Allocate PCM buffer */
+    /* Allocate PCM buffer for periods read while encoder queue is full */
     if ( !( buffer = malloc ( buffer_size ) ) )
     {
         nettalk_errcode ( context, "mic buffer alloc failed", errno );
@@ -127,30 +371,120 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
         goto exit;
     }
 
-    nettalk_info ( context, "microphone enabled" );
+    /* Encoder stage runs in its own thread, so network stall cannot overrun device ring */
+    stage.context = context;
+    stage.encoder = mic->encoder;
+    stage.rate = rate;
+    stage.running = TRUE;
+    stage.err = 0;
 
-    /* Forward PCM data loop */
-    while ( context->capture_status && !session_would_reconnect ( context ) )
+    if ( audio_ring_init ( &stage.ring, buffer_size ) < 0 )
+    {
+        nettalk_errcode ( context, "mic queue alloc failed", errno );
+        err = ENOMEM;
+        goto exit;
+    }
+
+    if ( ( errno = pthread_create ( &encode_thread, NULL, audioenc_entry, &stage ) ) != 0 )
+    {
+        nettalk_errcode ( context, "mic encoder thread start failed", errno );
+        audio_ring_free ( &stage.ring );
+        err = -1;
+        goto exit;
+    }
+
+    nettalk_info ( context,
+        "microphone enabled (period %lu frames at %u Hz, %s, %s path)",
+        ( unsigned long ) period_size, rate,
+        mic->encoder->soxr ? "soxr" : mic->encoder->fir.taps ? "polyphase fir" : "no resampling",
+        mic->encoder->s16 ? "s16" : "float" );
+
+    cpu_base = context->stats.capture_cpu_ns;
+    audio_base = context->stats.capture_audio_ns;
+    cpu = audio_thread_nanos (  );
+
+    /* Capture PCM data loop */
+    while ( stage.running && context->capture_status && !session_would_reconnect ( context ) )
     {
-        /* Gather PCM data */
-        if ( ( int ) ( read_frames =
-                snd_pcm_readi ( capture_handle, buffer, mic->encoder->frames_max ) ) < 0 )
+        /* Period is dropped when encoder stage falls behind */
+        period = audio_ring_reserve ( &stage.ring );
+
+        /* Gather PCM data, period of full queue is read aside and dropped */
+        frames = period ? period->frames : buffer;
+        read_frames = snd_pcm_readi ( capture_handle, frames, mic->encoder->frames_max );
+
+        if ( read_frames < 0 )
         {
-            nettalk_error ( context, "mic pcm read failed" );
-            nettalk_error ( context, "%s", snd_strerror ( err ) );
-            err = -1;
-            break;
+            if ( read_frames == -EPIPE )
+            {
+                overruns++;
+                nettalk_stats_add ( &context->stats.capture_overruns, 1 );
+            }
+
+            /* Short buffer overruns easily, just restart capturing */
+            if ( ( err = snd_pcm_recover ( capture_handle, read_frames, 1 ) ) < 0 )
+            {
+                nettalk_error ( context, "mic pcm read failed" );
+                nettalk_error ( context, "%s", snd_strerror ( err ) );
+                err = -1;
+                break;
+            }
+            continue;
         }
 
-        /* Forward PCM data */
-        if ( ( err =
-                mic->encoder->process_callback ( context, mic->encoder, buffer,
-                    read_frames ) ) < 0 )
+        if ( !read_frames )
         {
-            break;
+            continue;
+        }
+
+        if ( period )
+        {
+            /* Frames still queued in device are newer than this period */
+            if ( snd_pcm_delay ( capture_handle, &delay ) < 0 || delay < 0 )
+            {
+                delay = 0;
+            }
+
+            period->nframes = read_frames;
+            period->captured = nettalk_stats_micros (  );
+            period->latency = ( read_frames + delay ) * 1000000ULL / rate;
+            nettalk_stats_set ( &context->stats.capture_queued,
+                audio_ring_commit ( &stage.ring ) );
+
+        } else
+        {
+            dropped++;
+            nettalk_stats_add ( &context->stats.capture_dropped, 1 );
         }
+
+        /* Account CPU time per second of audio */
+        now = audio_thread_nanos (  );
+        nettalk_stats_add ( &context->stats.capture_cpu_ns, now - cpu );
+        nettalk_stats_add ( &context->stats.capture_audio_ns,
+            read_frames * 1000000000ULL / rate );
+        cpu = now;
     }
 
+    /* Stop encoder stage */
+    stage.running = FALSE;
+    pthread_join ( encode_thread, NULL );
+    audio_ring_free ( &stage.ring );
+
+    if ( stage.err < 0 && err >= 0 )
+    {
+        err = stage.err;
+    }
+
+    if ( overruns || dropped )
+    {
+        nettalk_info ( context, "microphone overran %llu times, %llu periods dropped",
+            overruns, dropped );
+    }
+
+    audio_report_cpu ( context, mic->encoder->s16 ? "microphone s16 path" :
+        "microphone float path", context->stats.capture_cpu_ns - cpu_base,
+        context->stats.capture_audio_ns - audio_base );
+    nettalk_audio_encoder_report ( context, mic->encoder );
     nettalk_info ( context, "microphone disabled" );
 
   exit:
@@ -173,6 +507,67 @@ static int audiorec_start ( struct nettalk_context_t *context, struct audio_mic_
     return err;
 }
 
+/**
+ * Begin encoding conference mix for this participant
+ */
+static int audiomcu_start ( struct nettalk_context_t *context, struct audio_encoder_t *encoder )
+{
+    int err = 0;
+    int slot;
+    ssize_t len;
+    unsigned long long ns = 0;
+    float buffer[AUDIO_MIXER_PERIOD];
+
+    /* Mixer output is already mono at AMR-NB rate */
+    encoder->frames_max = AUDIO_MIXER_PERIOD;
+    encoder->channels = AUDIO_LAYOUT_MONO;
+    encoder->inrate = AUDIO_MIXER_RATE;
+    encoder->format = SND_PCM_FORMAT_FLOAT_LE;
+
+    /* Initialize encoder */
+    if ( ( err = encoder->init_callback ( context, encoder ) ) < 0 )
+    {
+        return err;
+    }
+
+    nettalk_info ( context, "conference mix enabled" );
+
+    /* Each session encodes its own mix, spreading the work across cores */
+    while ( context->capture_status && !session_would_reconnect ( context ) )
+    {
+        len = 0;
+
+        if ( ( slot = context->mixer_slot ) < 0 )
+        {
+            usleep ( 100000 );
+
+        } else if ( ( len =
+                audio_mixer_pull ( context->mixer, slot, buffer, AUDIO_MIXER_PERIOD,
+                    ns ) ) < 0 )
+        {
+            len = 0;
+        }
+
+        /* Still pass empty mix for queued text messages */
+        ns = audio_thread_nanos (  );
+
+        if ( ( err = encoder->process_callback ( context, encoder, buffer, len ) ) < 0 )
+        {
+            break;
+        }
+
+        ns = audio_thread_nanos (  ) - ns;
+    }
+
+    nettalk_audio_encoder_report ( context, encoder );
+    nettalk_info ( context, "conference mix disabled" );
+
+    /* Uninitialize audio encoder */
+    encoder->free_callback ( encoder );
+
+    return err;
+}
+
 /**
  * Forward text messages only
  */
@@ -180,6 +575,7 @@ static void capture_fallback ( struct nettalk_context_t *context )
 {
     ssize_t len;
     unsigned char buffer[AMRNB_CHUNK_MAX];
+    unsigned char caps[AMRNB_CHUNK_MAX];
 
     /* Prepare message chunk buffer */
     memcpy ( buffer, text_chunk, sizeof ( buffer ) );
@@ -198,6 +594,19 @@ static void capture_fallback ( struct nettalk_context_t *context )
             context->reset_encoder_peer = 0;
         }
 
+        /* Peer still needs decodable codecs, though no voice is sent */
+        if ( context->reset_encoder_self )
+        {
+            caps_chunk_encode ( audio_codec_caps (  ), caps );
+
+            if ( send_complete_with_reset ( context, context->bridge.u.s.local, caps,
+                    sizeof ( caps ), NETTALK_SEND_TIMEOUT ) < 0 )
+            {
+                break;
+            }
+            context->reset_encoder_self = 0;
+        }
+
         if ( ( len =
                 read_with_reset ( context, context->msgout.u.s.readfd, buffer + 24,
                     sizeof ( buffer ) - 24, 100 ) ) > 0 )
@@ -232,15 +641,29 @@ static void voicerec_cycle ( struct nettalk_context_t *context )
     }
 
     encoder.bitrate = 12200;
+    encoder.dtx = !context->no_dtx;
     encoder.init_callback = nettalk_audio_encoder_init;
     encoder.process_callback = nettalk_encode_audio;
     encoder.free_callback = nettalk_audio_encoder_free;
 
+    /* Conference host sends mix of others instead of microphone */
+    if ( context->mixer && context->mixer->mcu )
+    {
+        if ( audiomcu_start ( context, &encoder ) < 0 && !session_would_reconnect ( context ) )
+        {
+            nettalk_info ( context, "conference mix not available" );
+            context->capture_status = FALSE;
+            gettimeofdayv ( &context->capture_status_timestamp );
+            capture_fallback ( context );
+        }
+        return;
+    }
+
     strncpy ( mic.dev, ALSA_DEFAULT_DEV, sizeof ( mic.dev ) );
     mic.dev[sizeof ( mic.dev ) - 1] = '\0';
     mic.channels = AUDIO_LAYOUT_MONO;
-    mic.rate = AUDIO_RATE_DEFAULT;
-    mic.format = SND_PCM_FORMAT_FLOAT_LE;
+    mic.rate = context->audio_rate;
+    mic.format = context->audio_float ? SND_PCM_FORMAT_FLOAT_LE : SND_PCM_FORMAT_S16_LE;
     mic.encoder = &encoder;
 
     if ( audiorec_start ( context, &mic ) < 0 )
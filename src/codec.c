@@ -0,0 +1,100 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Voice Codec Registry
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+/**
+ * Voice codec backends by codec id
+ */
+static const struct audio_codec_t codecs[AUDIO_CODEC_COUNT] = {
+    {"opus", audio_opus_encoder_init, audio_opus_encoder_reset, audio_opus_encode,
+        audio_opus_encoder_free, audio_opus_decoder_init, audio_opus_decoder_reset,
+        audio_opus_decode, audio_opus_decoder_free},
+    {"amr", audio_amrnb_encoder_init, audio_amrnb_encoder_reset, audio_amrnb_encode,
+        audio_amrnb_encoder_free, audio_amrnb_decoder_init, audio_amrnb_decoder_reset,
+        audio_amrnb_decode, audio_amrnb_decoder_free}
+};
+
+/**
+ * Get voice codec backend
+ */
+const struct audio_codec_t *audio_codec_get ( int codec )
+{
+    if ( codec < 0 || codec >= AUDIO_CODEC_COUNT )
+    {
+        return NULL;
+    }
+
+    return &codecs[codec];
+}
+
+/**
+ * Find voice codec by name
+ */
+int audio_codec_find ( const char *name )
+{
+    int i;
+
+    for ( i = 0; i < AUDIO_CODEC_COUNT; i++ )
+    {
+        if ( !strcmp ( codecs[i].name, name ) )
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Get mask of codecs this build decodes
+ */
+unsigned int audio_codec_caps ( void )
+{
+    return ( 1u << AUDIO_CODEC_COUNT ) - 1;
+}
+
+/**
+ * Pick codec for sending, preferred one if peer decodes it, AMR-NB otherwise
+ */
+int audio_codec_pick ( unsigned int peer_caps, int preferred )
+{
+    /* Peer that announced nothing is older version, it decodes AMR-NB only */
+    if ( peer_caps & audio_codec_caps (  ) & ( 1u << preferred ) )
+    {
+        return preferred;
+    }
+
+    return AUDIO_CODEC_AMRNB;
+}
+
+/**
+ * Get codec of encoded frame by its header
+ */
+int audio_codec_of_frame ( unsigned char header )
+{
+    if ( ( ( header >> 3 ) & 0x0f ) == AUDIO_OPUS_FRAME )
+    {
+        return AUDIO_CODEC_OPUS;
+    }
+
+    return AUDIO_CODEC_AMRNB;
+}
+
+/**
+ * Take codecs announced by peer, own encoder is reset when they change
+ */
+void audio_codec_peer_caps ( struct nettalk_context_t *context, const unsigned char *chunk )
+{
+    unsigned int caps;
+
+    if ( ( caps = caps_chunk_decode ( chunk ) ) == context->peer_codecs )
+    {
+        return;
+    }
+
+    context->peer_codecs = caps;
+    context->reset_encoder_self = TRUE;
+}
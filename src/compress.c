@@ -8,28 +8,56 @@
 #include <soxr.h>
 #include <gsmamr_enc.h>
 
+/**
+ * AMR-NB frame sizes with IETF header by mode
+ */
+static const unsigned char amrnb_frame_size[] = { 13, 14, 16, 18, 20, 21, 27, 32 };
+
+/**
+ * AMR-NB bitrates by mode
+ */
+static const unsigned int amrnb_bitrate[] = { 4750, 5150, 5900, 6700, 7400, 7950, 10200, 12200 };
+
 /**
  * Initialize audio encoder
  */
 int nettalk_audio_encoder_init ( struct nettalk_context_t *context,
     struct audio_encoder_t *encoder )
 {
-    int status;
-    soxr_error_t soxr_error;
-    soxr_quality_spec_t q_spec;
-
     /* Begin Initialization */
     encoder->resample_in = NULL;
     encoder->resample_out = NULL;
     encoder->samples = NULL;
     encoder->output = NULL;
     encoder->amrnb = NULL;
+    encoder->sid_sync = NULL;
+    encoder->opus = NULL;
+    encoder->opus_mode = -1;
+    encoder->opus_fec = -1;
     encoder->soxr = NULL;
+    encoder->fir.taps = NULL;
+    encoder->fir.line = NULL;
+    encoder->fir.taps16 = NULL;
+    encoder->fir.line16 = NULL;
     encoder->samples_left = 0;
-
-    /* AMR-NB rate is 8kHz */
+    encoder->silent = FALSE;
+    encoder->stream_pos = 0;
+    encoder->last_len = 0;
+    encoder->chunked = FALSE;
+    encoder->frames = 0;
+    encoder->sent = 0;
+    encoder->gated = 0;
+    encoder->bytes = 0;
+    encoder->encode_ns = 0;
+    audio_vad_init ( &encoder->vad );
+
+    /* AMR-NB rate is 8kHz, Opus is run at the same rate and frame size */
     encoder->outrate = 8000;
 
+    /* Mono short samples go to AMR-NB without float round trip */
+    encoder->s16 = encoder->format == SND_PCM_FORMAT_S16_LE
+        && encoder->channels == AUDIO_LAYOUT_MONO;
+
     /* Adjust AMR-NB mode */
     switch ( encoder->bitrate )
     {
@@ -61,13 +89,24 @@ int nettalk_audio_encoder_init ( struct nettalk_context_t *context,
         encoder->amrnb_mode = AMR_795;
     }
 
-    /* Prepare buffers allocation */
-    if ( !( encoder->output_size = AMRNB_CHUNK_MAX * encoder->frames_max / AMRNB_SAMPLES_MAX ) )
+    /* Requested mode is the ceiling for bitrate adaptation */
+    encoder->amrnb_max = encoder->amrnb_mode;
+    encoder->rtt_min = 0;
+    encoder->adapt_hold = 0;
+    encoder->adapt_clear = 0;
+
+    /* Prepare buffers allocation, samples kept from previous cycle may add one more frame */
+    if ( !encoder->frames_max )
     {
         return -1;
     }
 
-    if ( !( encoder->resample_in =
+    /* Direct path pads each frame up to one more chunk, descriptor filler takes two at most */
+    encoder->output_size =
+        ( AUDIO_FRAME_MAX + AMRNB_CHUNK_MAX ) * ( encoder->frames_max / AMRNB_SAMPLES_MAX + 1 ) +
+        2 * AMRNB_CHUNK_MAX;
+
+    if ( !encoder->s16 && !( encoder->resample_in =
             ( float * ) malloc ( encoder->frames_max * encoder->channels * sizeof ( float ) ) ) )
     {
         nettalk_errcode ( context, "mic resample-out inalloc failed", errno );
@@ -75,7 +114,7 @@ int nettalk_audio_encoder_init ( struct nettalk_context_t *context,
         return -1;
     }
 
-    if ( !( encoder->resample_out =
+    if ( !encoder->s16 && !( encoder->resample_out =
             ( float * ) malloc ( encoder->frames_max * sizeof ( float ) ) ) )
     {
         nettalk_errcode ( context, "mic resample-out alloc failed", errno );
@@ -100,29 +139,26 @@ int nettalk_audio_encoder_init ( struct nettalk_context_t *context,
         return -1;
     }
 
-    /* Initialize AMR-NB encoder */
-    status = AMREncodeInit ( &encoder->amrnb, &encoder->sid_sync, FALSE );
+    /* Initialize encoder of best codec peer announced so far */
+    encoder->codec = audio_codec_pick ( context->peer_codecs, context->codec );
+    encoder->dtx_on = encoder->dtx && context->peer_codecs;
 
-    /* Check for error */
-    if ( !encoder->amrnb || status < 0 )
+    if ( audio_codec_get ( encoder->codec )->encoder_init ( context, encoder ) < 0 )
     {
-        nettalk_error ( context, "mic amr-nb init failed (%s)", soxr_error );
         nettalk_audio_encoder_free ( encoder );
         return -1;
     }
 
-    /* Select resample filter quality */
-    q_spec = soxr_quality_spec ( SOXR_VHQ, SOXR_VR | SOXR_DOUBLE_PRECISION );
-
-    /* Initialize SOXR resampler */
-    encoder->soxr =
-        soxr_create ( encoder->inrate, encoder->outrate, AUDIO_LAYOUT_MONO,
-        &soxr_error, SOXR_FLOAT32_I, &q_spec, NULL );
+    /* Input at AMR-NB rate needs no resampling */
+    if ( encoder->inrate == encoder->outrate )
+    {
+        return 0;
+    }
 
-    /* Check for error */
-    if ( !encoder->soxr || soxr_error )
+    /* Create resampler selected by profile */
+    if ( audio_resampler_init ( context, "mic", encoder->inrate, encoder->outrate, encoder->s16,
+            &encoder->soxr, &encoder->fir ) < 0 )
     {
-        nettalk_error ( context, "mic soxr init failed (%s)", soxr_error );
         nettalk_audio_encoder_free ( encoder );
         return -1;
     }
@@ -131,40 +167,73 @@ int nettalk_audio_encoder_init ( struct nettalk_context_t *context,
 }
 
 /**
- * Calculate average from numbers
+ * Initialize AMR-NB encoder backend
  */
-static float calc_average ( float *values, size_t count )
+int audio_amrnb_encoder_init ( struct nettalk_context_t *context,
+    struct audio_encoder_t *encoder )
 {
-    size_t i;
-    float result;
+    int status;
 
-    if ( count )
-    {
-        for ( i = 0, result = 0; i < count; i++ )
-        {
-            result += values[i];
-        }
+    /* Silence is sent as descriptor frames unless disabled */
+    status = AMREncodeInit ( &encoder->amrnb, &encoder->sid_sync, encoder->dtx_on );
 
-        return result / count;
+    /* Check for error */
+    if ( !encoder->amrnb || status < 0 )
+    {
+        nettalk_error ( context, "mic amr-nb init failed" );
+        audio_amrnb_encoder_free ( encoder );
+        return -1;
     }
 
     return 0;
 }
 
 /**
- * Shrink sound from multi-channel to mono
+ * Reset AMR-NB encoder backend state
  */
-static void shrink_to_mono_samples ( size_t channels, float *samples, size_t frames_cnt )
+int audio_amrnb_encoder_reset ( struct audio_encoder_t *encoder )
 {
-    size_t i;
-    size_t c;
+    return AMREncodeReset ( encoder->amrnb, encoder->sid_sync ) < 0 ? -1 : 0;
+}
 
-    if ( channels > AUDIO_LAYOUT_MONO )
+/**
+ * Encode AMR-NB frame, returns output length, zero if nothing is sent
+ */
+ssize_t audio_amrnb_encode ( struct audio_encoder_t *encoder, short *samples,
+    unsigned char *output, int *silent )
+{
+    ssize_t len;
+    enum Frame_Type_3GPP ft = ( enum Frame_Type_3GPP ) 0;
+
+    if ( ( len =
+            AMREncode ( encoder->amrnb, encoder->sid_sync, ( enum Mode ) encoder->amrnb_mode,
+                samples, output, &ft, AMR_TX_IETF ) ) <= 0 )
     {
-        for ( i = 0, c = 0; i < frames_cnt; i++, c += channels )
-        {
-            samples[i] = calc_average ( samples + c, channels );
-        }
+        return -1;
+    }
+
+    /* Silence between descriptor frames is not sent at all */
+    *silent = ( int ) ft >= AMRNB_FRAME_SID;
+
+    if ( ( int ) ft == AMRNB_FRAME_NO_DATA )
+    {
+        return 0;
+    }
+
+    output[0] |= 0x04;
+    return len;
+}
+
+/**
+ * Uninitialize AMR-NB encoder backend
+ */
+void audio_amrnb_encoder_free ( struct audio_encoder_t *encoder )
+{
+    if ( encoder->amrnb && encoder->sid_sync )
+    {
+        AMREncodeExit ( &encoder->amrnb, &encoder->sid_sync );
+        encoder->amrnb = NULL;
+        encoder->sid_sync = NULL;
     }
 }
 
@@ -198,21 +267,201 @@ static int handle_message_output ( struct nettalk_context_t *context )
     return 0;
 }
 
+/**
+ * Convert, downmix and resample samples in float format to AMR-NB input
+ */
+static int resample_float_samples ( struct audio_encoder_t *encoder, const void *frames,
+    size_t *nframes )
+{
+    size_t samples_cnt;
+    size_t resample_idone;
+    size_t resample_odone;
+    soxr_error_t soxr_error;
+
+    /* Calculate samples count */
+    samples_cnt = *nframes * encoder->channels;
+
+    /* Convert samples to float32 format */
+    switch ( encoder->format )
+    {
+    case SND_PCM_FORMAT_S16_LE:
+    case SND_PCM_FORMAT_S16_BE:
+        audio_short_to_float_array ( frames, encoder->resample_in, samples_cnt );
+        break;
+    case SND_PCM_FORMAT_FLOAT_LE:
+    case SND_PCM_FORMAT_FLOAT_BE:
+        memcpy ( encoder->resample_in, frames, samples_cnt * sizeof ( float ) );
+        break;
+    case SND_PCM_FORMAT_S32_LE:
+    case SND_PCM_FORMAT_S32_BE:
+        audio_int_to_float_array ( frames, encoder->resample_in, samples_cnt );
+        break;
+    default:
+        return -1;
+    }
+
+    /* Shrink sound from multi-channel to mono */
+    if ( encoder->channels != AUDIO_LAYOUT_MONO )
+    {
+        audio_downmix_float_array ( encoder->resample_in, encoder->channels, *nframes );
+    }
+
+    /* Resample source sound */
+    if ( encoder->soxr )
+    {
+        soxr_error =
+            soxr_process ( encoder->soxr, encoder->resample_in, *nframes, &resample_idone,
+            encoder->resample_out, encoder->frames_max, &resample_odone );
+
+        /* Check for resampling error */
+        if ( soxr_error || resample_odone > encoder->frames_max )
+        {
+            return -1;
+        }
+
+        /* Update sound sample count */
+        *nframes = resample_odone;
+
+    } else if ( encoder->fir.taps )
+    {
+        *nframes =
+            audio_fir_process ( &encoder->fir, encoder->resample_in, *nframes,
+            encoder->resample_out );
+
+    } else
+    {
+        memcpy ( encoder->resample_out, encoder->resample_in, *nframes * sizeof ( float ) );
+    }
+
+    /* Convert samples from soxr format to AMR-NB format */
+    audio_float_to_short_array ( encoder->resample_out, encoder->samples + encoder->samples_left,
+        *nframes );
+
+    return 0;
+}
+
+/**
+ * Get next AMR-NB mode on adaptation ladder, not above the ceiling
+ */
+static int amrnb_step_mode ( int mode, int ceiling, int up )
+{
+    int i;
+    static const int ladder[] = { AMR_475, AMR_795, AMR_122 };
+
+    if ( up )
+    {
+        for ( i = 0; i < ( int ) ( sizeof ( ladder ) / sizeof ( ladder[0] ) ); i++ )
+        {
+            if ( ladder[i] > mode )
+            {
+                return ladder[i] < ceiling ? ladder[i] : ceiling;
+            }
+        }
+        return ceiling;
+    }
+
+    for ( i = sizeof ( ladder ) / sizeof ( ladder[0] ) - 1; i >= 0; i-- )
+    {
+        if ( ladder[i] < mode )
+        {
+            return ladder[i];
+        }
+    }
+
+    return mode;
+}
+
+/**
+ * Step AMR-NB mode down on growing send backlog or round trip time, and back up on recovery
+ */
+static void adapt_amrnb_mode ( struct nettalk_context_t *context,
+    struct audio_encoder_t *encoder )
+{
+    int mode;
+    int backlog;
+    unsigned int rtt;
+    unsigned int delay;
+
+    backlog = context->session.backlog;
+    rtt = context->session.rtt;
+
+    /* Smallest round trip seen is taken as uncongested path */
+    if ( rtt && ( !encoder->rtt_min || rtt < encoder->rtt_min ) )
+    {
+        encoder->rtt_min = rtt;
+    }
+
+    /* Queued bytes as milliseconds of audio at current bitrate */
+    delay = ( unsigned long long ) ( backlog > 0 ? backlog : 0 ) * 8000 /
+        amrnb_bitrate[encoder->amrnb_mode];
+
+    encoder->adapt_hold++;
+
+    if ( delay > NETTALK_ADAPT_BACKLOG_HIGH
+        || ( rtt && rtt > encoder->rtt_min + NETTALK_ADAPT_RTT_RISE ) )
+    {
+        encoder->adapt_clear = 0;
+
+        if ( encoder->adapt_hold < NETTALK_ADAPT_DOWN_HOLD )
+        {
+            return;
+        }
+
+        mode = amrnb_step_mode ( encoder->amrnb_mode, encoder->amrnb_max, FALSE );
+
+    } else if ( delay < NETTALK_ADAPT_BACKLOG_LOW
+        && ( !rtt || rtt < encoder->rtt_min + NETTALK_ADAPT_RTT_RISE / 2 ) )
+    {
+        /* Path must stay clear for a while before stepping up */
+        if ( ++encoder->adapt_clear < NETTALK_ADAPT_UP_HOLD )
+        {
+            return;
+        }
+
+        mode = amrnb_step_mode ( encoder->amrnb_mode, encoder->amrnb_max, TRUE );
+
+    } else
+    {
+        encoder->adapt_clear = 0;
+        return;
+    }
+
+    encoder->adapt_hold = 0;
+    encoder->adapt_clear = 0;
+
+    if ( mode == encoder->amrnb_mode )
+    {
+        return;
+    }
+
+    /* Encoder takes new mode with next frame, no reset needed */
+    encoder->amrnb_mode = mode;
+    nettalk_stats_add ( &context->stats.voice_mode_changes, 1 );
+    nettalk_info ( context, "voice bitrate %u bps (backlog %d bytes, rtt %u ms)",
+        amrnb_bitrate[mode], backlog, rtt );
+}
+
 /**
  * Process audio encoding
  */
 int nettalk_encode_audio ( struct nettalk_context_t *context, struct audio_encoder_t *encoder,
     const void *frames, size_t nframes )
 {
+    int codec;
+    int dtx_on;
+    int silent;
     ssize_t len;
+    size_t padding;
     size_t frames_cnt;
     size_t output_pos;
-    size_t samples_cnt;
+    size_t sent = 0;
+    size_t gated = 0;
     size_t resample_idone;
     size_t resample_odone;
+    unsigned long long ns;
     soxr_error_t soxr_error;
-    enum Frame_Type_3GPP ft = ( enum Frame_Type_3GPP ) 0;
     short left[AMRNB_SAMPLES_MAX];
+    unsigned char caps[AMRNB_CHUNK_MAX];
 
     /* Reset remote peer encoder */
     if ( context->reset_encoder_peer )
@@ -228,7 +477,42 @@ int nettalk_encode_audio ( struct nettalk_context_t *context, struct audio_encod
     /* Reset self encoder */
     if ( context->reset_encoder_self )
     {
-        if ( AMREncodeReset ( encoder->amrnb, encoder->sid_sync ) < 0 )
+        /* Switch to better codec, if peer announced one meanwhile */
+        codec = audio_codec_pick ( context->peer_codecs, context->codec );
+
+        /* Older peer announces nothing and takes no filler, so DTX waits for announcement */
+        dtx_on = encoder->dtx && context->peer_codecs;
+
+        if ( codec != encoder->codec || dtx_on != encoder->dtx_on )
+        {
+            audio_codec_get ( encoder->codec )->encoder_free ( encoder );
+
+            if ( codec != encoder->codec )
+            {
+                nettalk_info ( context, "voice codec %s", audio_codec_get ( codec )->name );
+            }
+
+            encoder->codec = codec;
+            encoder->dtx_on = dtx_on;
+
+            if ( audio_codec_get ( codec )->encoder_init ( context, encoder ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( audio_codec_get ( codec )->encoder_reset ( encoder ) < 0 )
+        {
+            return -1;
+        }
+
+        /* Reset peer decoder needs new silence descriptor */
+        encoder->silent = FALSE;
+
+        /* Codecs are announced in band, older peer skips them while waiting for init */
+        caps_chunk_encode ( audio_codec_caps (  ), caps );
+
+        if ( send_complete_with_reset ( context, context->bridge.u.s.local, caps,
+                sizeof ( caps ), NETTALK_SEND_TIMEOUT ) < 0 )
         {
             return -1;
         }
@@ -253,83 +537,130 @@ int nettalk_encode_audio ( struct nettalk_context_t *context, struct audio_encod
         return -1;
     }
 
-    /* Calculate samples count */
-    samples_cnt = nframes * encoder->channels;
-
-    /* Convert samples to float32 format */
-    switch ( encoder->format )
+    /* Resample short samples straight into AMR-NB input */
+    if ( encoder->s16 )
     {
-    case SND_PCM_FORMAT_S16_LE:
-    case SND_PCM_FORMAT_S16_BE:
-        audio_short_to_float_array ( frames, encoder->resample_in, samples_cnt );
-        break;
-    case SND_PCM_FORMAT_FLOAT_LE:
-    case SND_PCM_FORMAT_FLOAT_BE:
-        memcpy ( encoder->resample_in, frames, samples_cnt * sizeof ( float ) );
-        break;
-    case SND_PCM_FORMAT_S32_LE:
-    case SND_PCM_FORMAT_S32_BE:
-        audio_int_to_float_array ( frames, encoder->resample_in, samples_cnt );
-        break;
-    default:
-        return -1;
-    }
+        if ( encoder->soxr )
+        {
+            soxr_error =
+                soxr_process ( encoder->soxr, frames, nframes, &resample_idone,
+                encoder->samples + encoder->samples_left, encoder->frames_max, &resample_odone );
 
-    /* Shrink sound from multi-channel to mono */
-    if ( encoder->channels != AUDIO_LAYOUT_MONO )
-    {
-        shrink_to_mono_samples ( encoder->channels, encoder->resample_in, nframes );
-    }
+            if ( soxr_error || resample_odone > encoder->frames_max )
+            {
+                return -1;
+            }
 
-    /* Resample source sound */
-    soxr_error =
-        soxr_process ( encoder->soxr, encoder->resample_in, nframes, &resample_idone,
-        encoder->resample_out, encoder->frames_max, &resample_odone );
+            nframes = resample_odone;
+
+        } else if ( encoder->fir.taps16 )
+        {
+            nframes =
+                audio_fir_process_s16 ( &encoder->fir, frames, nframes,
+                encoder->samples + encoder->samples_left );
 
-    /* Check for resampling error */
-    if ( soxr_error || resample_odone > encoder->frames_max )
+        } else
+        {
+            memcpy ( encoder->samples + encoder->samples_left, frames, nframes * sizeof ( short ) );
+        }
+
+    } else if ( resample_float_samples ( encoder, frames, &nframes ) < 0 )
     {
         return -1;
     }
 
-    /* Update sound sample count */
-    nframes = resample_odone;
+    /* Count samples kept from previous cycle */
+    nframes += encoder->samples_left;
 
-    /* Convert samples from soxr format to AMR-NB format */
-    audio_float_to_short_array ( encoder->resample_out, encoder->samples + encoder->samples_left,
-        nframes );
+    /* Direct path drops and interleaves whole chunks, so there each frame takes its own */
+    encoder->chunked = context->session.direct.state == NETTALK_DIRECT_UP;
 
     /* Encode samples */
-    for ( frames_cnt = 0, output_pos = 0; frames_cnt + AMRNB_SAMPLES_MAX < nframes;
-        output_pos += len, frames_cnt += AMRNB_SAMPLES_MAX )
+    ns = audio_thread_nanos (  );
+
+    for ( frames_cnt = 0, output_pos = 0; frames_cnt + AMRNB_SAMPLES_MAX <= nframes;
+        frames_cnt += AMRNB_SAMPLES_MAX )
     {
+        /* Skip encoder on frames gated as silence */
+        if ( encoder->dtx_on
+            && !audio_vad_process ( &encoder->vad, encoder->samples + frames_cnt,
+                encoder->silent ) )
+        {
+            gated++;
+            continue;
+        }
+
+        /* Follow path congestion with AMR-NB mode, Opus bitrate is derived from it */
+        adapt_amrnb_mode ( context, encoder );
+
         if ( ( len =
-                AMREncode ( encoder->amrnb, encoder->sid_sync,
-                    ( enum Mode ) encoder->amrnb_mode, encoder->samples + frames_cnt,
-                    encoder->output + output_pos, &ft, AMR_TX_IETF ) ) <= 0 )
+                audio_codec_get ( encoder->codec )->encode ( encoder,
+                    encoder->samples + frames_cnt, encoder->output + output_pos,
+                    &silent ) ) < 0 )
         {
             return -1;
         }
 
-        encoder->output[output_pos] |= 0x04;
+        encoder->silent = silent;
+
+        if ( !len )
+        {
+            continue;
+        }
+
+        sent++;
+
+        /* Frame is padded to chunk boundary at once, lost datagram takes whole frames only */
+        if ( encoder->chunked )
+        {
+            padding = audio_dtx_padding ( encoder->stream_pos + output_pos + len, len );
+            memset ( encoder->output + output_pos + len, ( AMRNB_FRAME_FILLER << 3 ) | 0x04,
+                padding );
+            output_pos += len + padding;
+            encoder->last_len = 0;
+            continue;
+        }
+
+        encoder->last_len = len;
+        output_pos += len;
+    }
+
+    /* Flush last frame through transport alignment with filler frames, once silence begins */
+    if ( encoder->silent && encoder->last_len )
+    {
+        len = audio_dtx_padding ( encoder->stream_pos + output_pos, encoder->last_len );
+        memset ( encoder->output + output_pos, ( AMRNB_FRAME_FILLER << 3 ) | 0x04, len );
+        output_pos += len;
+        encoder->last_len = 0;
     }
 
+    encoder->stream_pos = ( encoder->stream_pos + output_pos ) % AMRNB_CHUNK_MAX;
+
+    /* Account sent and skipped frames */
+    ns = audio_thread_nanos (  ) - ns;
+    encoder->frames += frames_cnt / AMRNB_SAMPLES_MAX;
+    encoder->sent += sent;
+    encoder->gated += gated;
+    encoder->bytes += output_pos;
+    encoder->encode_ns += ns;
+    nettalk_stats_add ( &context->stats.voice_frames, frames_cnt / AMRNB_SAMPLES_MAX );
+    nettalk_stats_add ( &context->stats.voice_sent_frames, sent );
+    nettalk_stats_add ( &context->stats.voice_gated_frames, gated );
+    nettalk_stats_add ( &context->stats.voice_bytes, output_pos );
+    nettalk_stats_add ( &context->stats.voice_encode_ns, ns );
+
     /* Keep unconsumed samples */
     if ( ( len = nframes - frames_cnt ) )
     {
-        if ( len > AMRNB_SAMPLES_MAX )
-        {
-            len = AMRNB_SAMPLES_MAX;
-        }
-        memcpy ( left, encoder->samples + frames_cnt, len );
-        memcpy ( encoder->samples, left, len );
-
+        memcpy ( left, encoder->samples + frames_cnt, len * sizeof ( short ) );
+        memcpy ( encoder->samples, left, len * sizeof ( short ) );
     }
 
     encoder->samples_left = len;
 
     /* Send output data */
-    if ( send_complete_with_reset ( context, context->bridge.u.s.local, encoder->output,
+    if ( output_pos
+        && send_complete_with_reset ( context, context->bridge.u.s.local, encoder->output,
             output_pos, NETTALK_SEND_TIMEOUT ) < 0 )
     {
         return -1;
@@ -338,16 +669,47 @@ int nettalk_encode_audio ( struct nettalk_context_t *context, struct audio_encod
     return 0;
 }
 
+/**
+ * Log bandwidth and CPU time saved by discontinuous transmission
+ */
+void nettalk_audio_encoder_report ( struct nettalk_context_t *context,
+    struct audio_encoder_t *encoder )
+{
+    unsigned long long full;
+    unsigned long long encoded;
+
+    if ( !encoder->dtx || !encoder->frames )
+    {
+        return;
+    }
+
+    /* Compare with full rate frames sent continuously */
+    full = encoder->frames * amrnb_frame_size[encoder->amrnb_max];
+    encoded = encoder->frames - encoder->gated;
+
+    nettalk_info ( context,
+        "dtx sent %llu of %llu frames, %llu%% of bytes and %llu%% of encoder runs saved",
+        encoder->sent, encoder->frames,
+        encoder->bytes < full ? ( full - encoder->bytes ) * 100 / full : 0ULL,
+        encoder->gated * 100 / encoder->frames );
+
+    if ( encoded && encoder->gated )
+    {
+        nettalk_info ( context, "dtx gate saved %llu us of encoder CPU time",
+            encoder->gated * encoder->encode_ns / encoded / 1000 );
+    }
+}
+
 /**
  * Uninitialize audio encoder
  */
 void nettalk_audio_encoder_free ( struct audio_encoder_t *encoder )
 {
-    if ( encoder->amrnb && encoder->sid_sync )
+    int i;
+
+    for ( i = 0; i < AUDIO_CODEC_COUNT; i++ )
     {
-        AMREncodeExit ( &encoder->amrnb, &encoder->sid_sync );
-        encoder->amrnb = NULL;
-        encoder->sid_sync = NULL;
+        audio_codec_get ( i )->encoder_free ( encoder );
     }
 
     if ( encoder->soxr )
@@ -356,6 +718,8 @@ void nettalk_audio_encoder_free ( struct audio_encoder_t *encoder )
         encoder->soxr = NULL;
     }
 
+    audio_fir_free ( &encoder->fir );
+
     free_ref ( ( void ** ) &encoder->resample_in );
     free_ref ( ( void ** ) &encoder->resample_out );
     free_ref ( ( void ** ) &encoder->samples );
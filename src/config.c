@@ -86,6 +86,103 @@ static void decode_rsa_key ( char *buffer, size_t limit )
     }
 }
 
+/**
+ * Decode relay server list from properties
+ */
+static int decode_relays ( struct nettalk_config_t *config, const char *list,
+    unsigned short port )
+{
+    size_t len;
+    unsigned int lport;
+    const char *ptr;
+    const char *end;
+    const char *sep;
+    struct nettalk_relay_t *relay;
+
+    config->nrelays = 0;
+
+    for ( ptr = list; *ptr; ptr = *end ? end + 1 : end )
+    {
+        if ( !( end = strchr ( ptr, ',' ) ) )
+        {
+            end = ptr + strlen ( ptr );
+        }
+
+        if ( end == ptr )
+        {
+            continue;
+        }
+
+        if ( config->nrelays >= NETTALK_RELAYS_MAX )
+        {
+            return -1;
+        }
+
+        relay = &config->relays[config->nrelays];
+        relay->port = port;
+
+        /* Optional per-relay port number */
+        if ( ( sep = memchr ( ptr, ':', end - ptr ) ) )
+        {
+            if ( sscanf ( sep + 1, "%u", &lport ) <= 0 || !lport || lport >= 65536 )
+            {
+                return -1;
+            }
+            relay->port = lport;
+            len = sep - ptr;
+
+        } else
+        {
+            len = end - ptr;
+        }
+
+        if ( !len || len >= sizeof ( relay->hostname ) )
+        {
+            return -1;
+        }
+
+        memcpy ( relay->hostname, ptr, len );
+        relay->hostname[len] = '\0';
+        config->nrelays++;
+    }
+
+    return config->nrelays ? 0 : -1;
+}
+
+/**
+ * Order relays by channel so that both peers pick the same owner first
+ */
+static void order_relays ( struct nettalk_config_t *config )
+{
+    size_t i;
+    size_t j;
+    uint64_t scores[NETTALK_RELAYS_MAX];
+    uint64_t score;
+    struct nettalk_relay_t relay;
+
+    for ( i = 0; i < config->nrelays; i++ )
+    {
+        scores[i] =
+            nettalk_relay_score ( config->channel, config->relays[i].hostname,
+            config->relays[i].port );
+    }
+
+    for ( i = 1; i < config->nrelays; i++ )
+    {
+        score = scores[i];
+        relay = config->relays[i];
+
+        for ( j = i; j > 0 && scores[j - 1] < score; j-- )
+        {
+            scores[j] = scores[j - 1];
+            config->relays[j] = config->relays[j - 1];
+        }
+
+        scores[j] = score;
+        config->relays[j] = relay;
+    }
+}
+
 /**
  * Load config internal
  */
@@ -97,33 +194,41 @@ static int load_config_in ( struct nettalk_context_t *context, const char *props
 
     config = &context->config;
 
-    if ( props_get ( props, "host", config->hostname, sizeof ( config->hostname ) ) < 0 )
+    if ( props_get ( props, "port", buffer, bufsize ) < 0 )
     {
         return -1;
     }
 
-    if ( props_get ( props, "port", buffer, bufsize ) < 0 )
+    if ( sscanf ( buffer, "%u", &lport ) <= 0 )
     {
         return -1;
     }
 
-    if ( sscanf ( buffer, "%u", &lport ) <= 0 )
+    if ( lport >= 65536 )
     {
         return -1;
     }
 
-    if ( lport >= 65536 )
+    if ( props_get ( props, "host", buffer, bufsize ) < 0 )
     {
         return -1;
     }
 
-    config->port = lport;
+    if ( decode_relays ( config, buffer, lport ) < 0 )
+    {
+        return -1;
+    }
+
+    context->relay_index = 0;
+    context->relay_refusals = 0;
 
     if ( props_get ( props, "chan", config->channel, sizeof ( config->channel ) ) < 0 )
     {
         return -1;
     }
 
+    order_relays ( config );
+
     if ( props_get ( props, "self", buffer, bufsize ) < 0 )
     {
         return -1;
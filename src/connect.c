@@ -41,14 +41,64 @@ int resolve_ipv4 ( const char *hostname, unsigned int *addr )
 }
 
 /**
- * Connect with remote peer
+ * Switch over to next relay server
  */
-int nettalk_connect ( struct nettalk_context_t *context )
+static void switch_relay ( struct nettalk_context_t *context )
 {
+    context->relay_refusals++;
+    context->relay_index = ( context->relay_index + 1 ) % context->config.nrelays;
+}
+
+/**
+ * Check if relay server refused the rendezvous
+ */
+static int is_busy_reply ( const char *channel )
+{
+    size_t i;
+
+    for ( i = 0; i < CHANLEN; i++ )
+    {
+        if ( channel[i] != NETTALK_BUSY_BYTE )
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * Use connection with peer found on local network
+ */
+static int use_lan_peer ( struct nettalk_context_t *context, int sock )
+{
+    if ( socket_set_low_latency ( sock ) < 0 )
+    {
+        nettalk_errcode ( context, "failed to set socket options", errno );
+    }
+
+    context->session.sock = sock;
+    nettalk_stats_add ( &context->stats.pairings, 1 );
+    nettalk_info ( context, "remote peer is online on local network" );
+
+    return 0;
+}
+
+/**
+ * Connect with remote peer through relay
+ */
+static int relay_connect ( struct nettalk_context_t *context )
+{
+    int sock;
     unsigned int addr;
     struct sockaddr_in saddr;
+    struct nettalk_relay_t *relay;
+    long long broadcast_time;
     char channel[CHANLEN + 1];
 
+    relay = &context->config.relays[context->relay_index];
+    nettalk_stats_add ( &context->stats.connects, 1 );
+
     nettalk_info ( context, "resolved server hostname" );
 
     memset ( &saddr, '\0', sizeof ( saddr ) );
@@ -61,14 +111,15 @@ int nettalk_connect ( struct nettalk_context_t *context )
 
     } else
     {
-        if ( resolve_ipv4 ( context->config.hostname, &addr ) < 0 )
+        if ( resolve_ipv4 ( relay->hostname, &addr ) < 0 )
         {
             nettalk_errcode ( context, "server dns lookup failed", errno );
+            switch_relay ( context );
             return -1;
         }
 
         saddr.sin_addr.s_addr = addr;
-        saddr.sin_port = htons ( context->config.port );
+        saddr.sin_port = htons ( relay->port );
     }
 
     if ( ( context->session.sock = socket ( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
@@ -87,11 +138,17 @@ int nettalk_connect ( struct nettalk_context_t *context )
         } else
         {
             nettalk_errcode ( context, "failed to connect server", errno );
+            switch_relay ( context );
         }
         shutdown_then_close ( context->session.sock );
         return -1;
     }
 
+    if ( socket_set_low_latency ( context->session.sock ) < 0 )
+    {
+        nettalk_errcode ( context, "failed to set socket options", errno );
+    }
+
     if ( context->socks5_enabled )
     {
         nettalk_info ( context, "connected with proxy" );
@@ -112,10 +169,11 @@ int nettalk_connect ( struct nettalk_context_t *context )
 
         nettalk_info ( context, "socks-5 handshake passed" );
 
-        if ( socks5_request_hostname ( context, context->session.sock, context->config.hostname,
-                context->config.port ) < 0 )
+        if ( socks5_request_hostname ( context, context->session.sock, relay->hostname,
+                relay->port ) < 0 )
         {
             nettalk_errcode ( context, "socks-5 request failed", errno );
+            switch_relay ( context );
             shutdown_then_close ( context->session.sock );
             return -1;
         }
@@ -130,15 +188,27 @@ int nettalk_connect ( struct nettalk_context_t *context )
         return -1;
     }
 
+    broadcast_time = nettalk_stats_micros (  );
     nettalk_info ( context, "broadcasted channel id" );
     nettalk_info ( context, "waiting for remote peer..." );
 
-    if ( recv_complete_with_reset ( context, context->session.sock, channel, CHANLEN,
+    /* Keep looking for peer on local network meanwhile */
+    if ( context->lan.msock >= 0
+        && ( sock =
+            nettalk_lan_poll ( context, context->session.sock, NETTALK_WAIT_TIMEOUT ) ) >= 0 )
+    {
+        shutdown_then_close ( context->session.sock );
+        return use_lan_peer ( context, sock );
+    }
+
+    if ( ( context->lan.msock >= 0 && errno != EAGAIN )
+        || recv_complete_with_reset ( context, context->session.sock, channel, CHANLEN,
             NETTALK_WAIT_TIMEOUT ) < 0 )
     {
         if ( errno == ETIMEDOUT )
         {
             nettalk_info ( context, "reconnecting with server..." );
+            context->relay_index = 0;
         } else
         {
             nettalk_errcode ( context, "connection shutdown", errno );
@@ -149,6 +219,15 @@ int nettalk_connect ( struct nettalk_context_t *context )
 
     channel[CHANLEN] = '\0';
 
+    if ( is_busy_reply ( channel ) )
+    {
+        nettalk_info ( context, "server is busy, trying next one..." );
+        nettalk_stats_add ( &context->stats.refusals, 1 );
+        switch_relay ( context );
+        shutdown_then_close ( context->session.sock );
+        return -1;
+    }
+
     if ( strcmp ( context->config.channel, channel ) )
     {
         nettalk_error ( context, "bound to wrong channel" );
@@ -156,7 +235,51 @@ int nettalk_connect ( struct nettalk_context_t *context )
         return -1;
     }
 
+    context->relay_refusals = 0;
+    nettalk_stats_add ( &context->stats.pairings, 1 );
+    nettalk_stats_observe ( &context->stats.pairing_latency,
+        nettalk_stats_micros (  ) - broadcast_time );
+
     nettalk_info ( context, "remote peer is online" );
 
     return 0;
 }
+
+/**
+ * Connect with remote peer
+ */
+int nettalk_connect ( struct nettalk_context_t *context )
+{
+    int sock;
+    int status;
+
+    /* Discovery would reveal presence hidden by proxy */
+    if ( !context->lan_enabled || context->socks5_enabled )
+    {
+        return relay_connect ( context );
+    }
+
+    if ( nettalk_lan_open ( context ) < 0 )
+    {
+        nettalk_errcode ( context, "local discovery failed", errno );
+        return relay_connect ( context );
+    }
+
+    /* Give peer on local network a moment before using relay */
+    if ( ( sock = nettalk_lan_poll ( context, -1, NETTALK_LAN_TIMEOUT ) ) >= 0 )
+    {
+        status = use_lan_peer ( context, sock );
+
+    } else if ( errno == EINTR )
+    {
+        status = -1;
+
+    } else
+    {
+        status = relay_connect ( context );
+    }
+
+    nettalk_lan_close ( context );
+
+    return status;
+}
@@ -0,0 +1,271 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Sample Conversion Benchmark
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+#include <float.h>
+
+#define CONVBENCH_LEN 1027
+#define CONVBENCH_ROUNDS 20000
+
+/**
+ * Conversion under test
+ */
+enum
+{
+    CONVBENCH_FLOAT_TO_SHORT = 0,
+    CONVBENCH_FLOAT_TO_INT,
+    CONVBENCH_SHORT_TO_FLOAT,
+    CONVBENCH_INT_TO_FLOAT,
+    CONVBENCH_DOWNMIX,
+    CONVBENCH_UPMIX,
+    CONVBENCH_NKERNELS
+};
+
+/**
+ * Conversion names
+ */
+static const char *convbench_names[CONVBENCH_NKERNELS] = {
+    "float->s16", "float->s32", "s16->float", "s32->float", "downmix", "upmix"
+};
+
+/**
+ * Test vectors shared by all levels
+ */
+struct convbench_data_t
+{
+    float floats[2 * CONVBENCH_LEN];
+    short shorts[CONVBENCH_LEN];
+    int ints[CONVBENCH_LEN];
+};
+
+/**
+ * Conversion output buffers
+ */
+union convbench_output_t
+{
+    float floats[2 * CONVBENCH_LEN];
+    short shorts[CONVBENCH_LEN];
+    int ints[CONVBENCH_LEN];
+};
+
+/**
+ * Get thread CPU time in nanoseconds
+ */
+static unsigned long long convbench_nanos ( void )
+{
+    struct timespec ts;
+
+    if ( clock_gettime ( CLOCK_THREAD_CPUTIME_ID, &ts ) < 0 )
+    {
+        return 0;
+    }
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Generate pseudo-random number
+ */
+static unsigned int convbench_random ( unsigned int *state )
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/**
+ * Fill test vectors with random samples and rounding edge cases
+ */
+static void convbench_prepare ( struct convbench_data_t *data )
+{
+    size_t i;
+    unsigned int state = 0x12345678;
+    static const float edges[] = {
+        0.0f, -0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 1e30f, -1e30f, FLT_MIN, -FLT_MIN,
+        FLT_MIN / 4, 1.0f / 65536 / 32768, 0.5f / 32768, -0.5f / 32768,
+        1.5f / 32768, -1.5f / 32768, 32767.5f / 32768, -32768.5f / 32768,
+        0.99999994f, -0.99999994f, 0.5f / 2147483648.0f, 1.5f / 2147483648.0f,
+        0.99999994f / 32768, -0.99999994f / 32768, 2.9999998f / 32768, -2.9999998f / 32768
+    };
+
+    for ( i = 0; i < 2 * CONVBENCH_LEN; i++ )
+    {
+        /* Ties between output steps and tiny offsets around them */
+        switch ( i % 4 )
+        {
+        case 0:
+            data->floats[i] = ( ( int ) convbench_random ( &state ) >> 8 ) / 8388608.0f * 1.25f;
+            break;
+        case 1:
+            data->floats[i] = ( ( short ) convbench_random ( &state ) + 0.5f ) / 32768;
+            break;
+        case 2:
+            data->floats[i] = nextafterf ( ( ( short ) convbench_random ( &state ) ) / 32768.0f,
+                ( i & 4 ) ? 2.0f : -2.0f );
+            break;
+        default:
+            data->floats[i] = edges[( i / 4 ) % ( sizeof ( edges ) / sizeof ( float ) )];
+        }
+    }
+
+    for ( i = 0; i < CONVBENCH_LEN; i++ )
+    {
+        data->shorts[i] = ( short ) ( i * 64 + i % 64 );
+        data->ints[i] = ( int ) convbench_random ( &state );
+    }
+
+    data->ints[0] = 2147483647;
+    data->ints[1] = -2147483647 - 1;
+    data->ints[2] = 16777217;
+}
+
+/**
+ * Run one conversion
+ */
+static void convbench_convert ( int kernel, const struct convbench_data_t *data,
+    union convbench_output_t *output, int count )
+{
+    switch ( kernel )
+    {
+    case CONVBENCH_FLOAT_TO_SHORT:
+        audio_float_to_short_array ( data->floats, output->shorts, count );
+        break;
+    case CONVBENCH_FLOAT_TO_INT:
+        audio_float_to_int_array ( data->floats, output->ints, count );
+        break;
+    case CONVBENCH_SHORT_TO_FLOAT:
+        audio_short_to_float_array ( data->shorts, output->floats, count );
+        break;
+    case CONVBENCH_INT_TO_FLOAT:
+        audio_int_to_float_array ( data->ints, output->floats, count );
+        break;
+    case CONVBENCH_DOWNMIX:
+        memcpy ( output->floats, data->floats, 2 * count * sizeof ( float ) );
+        audio_downmix_float_array ( output->floats, AUDIO_LAYOUT_STEREO, count );
+        break;
+    case CONVBENCH_UPMIX:
+        memcpy ( output->floats, data->floats, count * sizeof ( float ) );
+        audio_upmix_float_array ( output->floats, AUDIO_LAYOUT_STEREO, count );
+        break;
+    }
+}
+
+/**
+ * Get conversion output size in bytes
+ */
+static size_t convbench_output_size ( int kernel, int count )
+{
+    switch ( kernel )
+    {
+    case CONVBENCH_FLOAT_TO_SHORT:
+        return count * sizeof ( short );
+    case CONVBENCH_FLOAT_TO_INT:
+        return count * sizeof ( int );
+    case CONVBENCH_UPMIX:
+        return 2 * count * sizeof ( float );
+    }
+
+    return count * sizeof ( float );
+}
+
+/**
+ * Compare level output against reference for every length up to test size
+ */
+static int convbench_verify ( int level, int kernel, const struct convbench_data_t *data )
+{
+    int count;
+    union convbench_output_t reference;
+    union convbench_output_t output;
+
+    for ( count = 0; count <= CONVBENCH_LEN; count += count < 40 ? 1 : 97 )
+    {
+        audio_simd_select ( AUDIO_SIMD_SCALAR );
+        convbench_convert ( kernel, data, &reference, count );
+        audio_simd_select ( level );
+        convbench_convert ( kernel, data, &output, count );
+
+        if ( memcmp ( &reference, &output, convbench_output_size ( kernel, count ) ) )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Measure conversion speed in nanoseconds per sample
+ */
+static double convbench_measure ( int level, int kernel, const struct convbench_data_t *data )
+{
+    int i;
+    unsigned long long ns;
+    union convbench_output_t output;
+
+    audio_simd_select ( level );
+    ns = convbench_nanos (  );
+
+    for ( i = 0; i < CONVBENCH_ROUNDS; i++ )
+    {
+        convbench_convert ( kernel, data, &output, CONVBENCH_LEN );
+    }
+
+    ns = convbench_nanos (  ) - ns;
+
+    return ( double ) ns / CONVBENCH_ROUNDS / CONVBENCH_LEN;
+}
+
+/**
+ * Program entry point
+ */
+int main ( void )
+{
+    int level;
+    int kernel;
+    int status = 0;
+    static struct convbench_data_t data;
+
+    convbench_prepare ( &data );
+
+    printf ( "  %-12s", "kernel" );
+
+    for ( level = 0; level < AUDIO_SIMD_NLEVELS; level++ )
+    {
+        if ( audio_simd_supported ( level ) )
+        {
+            printf ( " %14s", audio_simd_name ( level ) );
+        }
+    }
+
+    printf ( "\n" );
+
+    for ( kernel = 0; kernel < CONVBENCH_NKERNELS; kernel++ )
+    {
+        printf ( "  %-12s", convbench_names[kernel] );
+
+        for ( level = 0; level < AUDIO_SIMD_NLEVELS; level++ )
+        {
+            if ( !audio_simd_supported ( level ) )
+            {
+                continue;
+            }
+
+            if ( convbench_verify ( level, kernel, &data ) < 0 )
+            {
+                printf ( " %14s", "MISMATCH" );
+                status = 1;
+                continue;
+            }
+
+            printf ( " %11.3f ns", convbench_measure ( level, kernel, &data ) );
+        }
+
+        printf ( "\n" );
+    }
+
+    return status;
+}
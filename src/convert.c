@@ -0,0 +1,770 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Sample Format Conversion
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Sample conversion kernels
+ */
+struct audio_kernels_t
+{
+    void ( *float_to_short ) ( const float *input, short *output, int count );
+    void ( *float_to_int ) ( const float *input, int *output, int count );
+    void ( *short_to_float ) ( const short *input, float *output, int count );
+    void ( *int_to_float ) ( const int *input, float *output, int count );
+    void ( *downmix_stereo ) ( float *samples, int frames );
+    void ( *upmix_stereo ) ( float *samples, int frames );
+};
+
+/**
+ * Convert float array to short integer array, reference version
+ */
+static void audio_float_to_short_scalar ( const float *input, short *output, int count )
+{
+    double scaled_value;
+
+    while ( count > 0 )
+    {
+        count--;
+        scaled_value = input[count] * ( 8.0 * 0x10000000 );
+
+        if ( scaled_value >= ( 1.0 * 0x7FFFFFFF ) )
+        {
+            output[count] = 32767;
+
+        } else if ( scaled_value <= ( -8.0 * 0x10000000 ) )
+        {
+            output[count] = -32768;
+
+        } else
+        {
+            output[count] = ( short ) ( lrint ( scaled_value ) >> 16 );
+        }
+    }
+}
+
+/**
+ * Convert float array to integer array, reference version
+ */
+static void audio_float_to_int_scalar ( const float *input, int *output, int count )
+{
+    double scaled_value;
+
+    while ( count > 0 )
+    {
+        count--;
+        scaled_value = input[count] * ( 8.0 * 0x10000000 );
+
+        if ( scaled_value >= ( 1.0 * 0x7FFFFFFF ) )
+        {
+            output[count] = 2147483647;
+
+        } else if ( scaled_value <= ( -8.0 * 0x10000000 ) )
+        {
+            output[count] = -2147483648;
+
+        } else
+        {
+            output[count] = lrint ( scaled_value );
+        }
+    }
+}
+
+/**
+ * Convert short integer array to float array, reference version
+ */
+static void audio_short_to_float_scalar ( const short *input, float *output, int count )
+{
+    /* Rescale and save samples values */
+    while ( count > 0 )
+    {
+        count--;
+        output[count] = ( ( float ) input[count] ) / ( 1.0 * 0x8000 );
+    }
+}
+
+/**
+ * Convert integer array to float array, reference version
+ */
+static void audio_int_to_float_scalar ( const int *input, float *output, int count )
+{
+    while ( count > 0 )
+    {
+        count--;
+        output[count] = ( ( float ) input[count] ) / ( 8.0 * 0x10000000 );
+    }
+}
+
+/**
+ * Shrink sound frames from first to last to mono, reference version
+ */
+static void audio_downmix_range ( float *samples, size_t channels, int first, int frames )
+{
+    int i;
+    size_t c;
+    float result;
+
+    for ( i = first; i < frames; i++ )
+    {
+        for ( c = 0, result = 0; c < channels; c++ )
+        {
+            result += samples[i * channels + c];
+        }
+
+        samples[i] = result / channels;
+    }
+}
+
+/**
+ * Expand sound frames from first to last from mono, reference version
+ */
+static void audio_upmix_range ( float *samples, size_t channels, int first, int frames )
+{
+    int i;
+    size_t c;
+
+    /* Go backwards, so no input is overwritten before read */
+    for ( i = frames - 1; i >= first; i-- )
+    {
+        for ( c = 0; c < channels; c++ )
+        {
+            samples[i * channels + c] = samples[i];
+        }
+    }
+}
+
+/**
+ * Shrink stereo sound to mono, reference version
+ */
+static void audio_downmix_stereo_scalar ( float *samples, int frames )
+{
+    audio_downmix_range ( samples, AUDIO_LAYOUT_STEREO, 0, frames );
+}
+
+/**
+ * Expand mono sound to stereo, reference version
+ */
+static void audio_upmix_stereo_scalar ( float *samples, int frames )
+{
+    audio_upmix_range ( samples, AUDIO_LAYOUT_STEREO, 0, frames );
+}
+
+/**
+ * Reference kernels
+ */
+static const struct audio_kernels_t audio_kernels_scalar = {
+    audio_float_to_short_scalar,
+    audio_float_to_int_scalar,
+    audio_short_to_float_scalar,
+    audio_int_to_float_scalar,
+    audio_downmix_stereo_scalar,
+    audio_upmix_stereo_scalar
+};
+
+/*
+ * Vector kernels widen samples to double, so scaling by 2^31 stays exact, clamp
+ * to integer range and round to nearest even like lrint() does. Downmix adds to
+ * zero first like the reference sum, so even the sign of zero is the same.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * Scale, clamp and round low two float samples
+ */
+static inline __m128i audio_sse2_round ( __m128 x )
+{
+    const __m128d scale = _mm_set1_pd ( 8.0 * 0x10000000 );
+    const __m128d hi = _mm_set1_pd ( 1.0 * 0x7FFFFFFF );
+    const __m128d lo = _mm_set1_pd ( -8.0 * 0x10000000 );
+
+    return _mm_cvtpd_epi32 ( _mm_max_pd ( lo, _mm_min_pd ( hi,
+                _mm_mul_pd ( _mm_cvtps_pd ( x ), scale ) ) ) );
+}
+
+/**
+ * Scale, clamp and round four float samples
+ */
+static inline __m128i audio_sse2_round4 ( const float *input )
+{
+    __m128 x = _mm_loadu_ps ( input );
+
+    return _mm_unpacklo_epi64 ( audio_sse2_round ( x ),
+        audio_sse2_round ( _mm_movehl_ps ( x, x ) ) );
+}
+
+/**
+ * Convert float array to short integer array, SSE2 version
+ */
+static void audio_float_to_short_sse2 ( const float *input, short *output, int count )
+{
+    int i = 0;
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        _mm_storeu_si128 ( ( __m128i * ) ( output + i ),
+            _mm_packs_epi32 ( _mm_srai_epi32 ( audio_sse2_round4 ( input + i ), 16 ),
+                _mm_srai_epi32 ( audio_sse2_round4 ( input + i + 4 ), 16 ) ) );
+    }
+
+    audio_float_to_short_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert float array to integer array, SSE2 version
+ */
+static void audio_float_to_int_sse2 ( const float *input, int *output, int count )
+{
+    int i = 0;
+
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        _mm_storeu_si128 ( ( __m128i * ) ( output + i ), audio_sse2_round4 ( input + i ) );
+    }
+
+    audio_float_to_int_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert short integer array to float array, SSE2 version
+ */
+static void audio_short_to_float_sse2 ( const short *input, float *output, int count )
+{
+    int i = 0;
+    __m128i v;
+    const __m128 scale = _mm_set1_ps ( 1.0f / 0x8000 );
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        /* Sign extend by placing samples in upper halves */
+        v = _mm_loadu_si128 ( ( const __m128i * ) ( input + i ) );
+        _mm_storeu_ps ( output + i, _mm_mul_ps ( _mm_cvtepi32_ps ( _mm_srai_epi32 (
+                        _mm_unpacklo_epi16 ( v, v ), 16 ) ), scale ) );
+        _mm_storeu_ps ( output + i + 4, _mm_mul_ps ( _mm_cvtepi32_ps ( _mm_srai_epi32 (
+                        _mm_unpackhi_epi16 ( v, v ), 16 ) ), scale ) );
+    }
+
+    audio_short_to_float_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert integer array to float array, SSE2 version
+ */
+static void audio_int_to_float_sse2 ( const int *input, float *output, int count )
+{
+    int i = 0;
+    const __m128 scale = _mm_set1_ps ( 1.0f / ( 8.0f * 0x10000000 ) );
+
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        _mm_storeu_ps ( output + i, _mm_mul_ps ( _mm_cvtepi32_ps ( _mm_loadu_si128 (
+                        ( const __m128i * ) ( input + i ) ) ), scale ) );
+    }
+
+    audio_int_to_float_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Shrink stereo sound to mono, SSE2 version
+ */
+static void audio_downmix_stereo_sse2 ( float *samples, int frames )
+{
+    int i = 0;
+    __m128 a;
+    __m128 b;
+    const __m128 zero = _mm_setzero_ps (  );
+    const __m128 half = _mm_set1_ps ( 0.5f );
+
+    /* Whole block is loaded before store, output never overtakes input */
+    for ( ; i + 4 <= frames; i += 4 )
+    {
+        a = _mm_loadu_ps ( samples + 2 * i );
+        b = _mm_loadu_ps ( samples + 2 * i + 4 );
+        _mm_storeu_ps ( samples + i, _mm_mul_ps ( _mm_add_ps ( _mm_add_ps ( zero,
+                        _mm_shuffle_ps ( a, b, _MM_SHUFFLE ( 2, 0, 2, 0 ) ) ),
+                    _mm_shuffle_ps ( a, b, _MM_SHUFFLE ( 3, 1, 3, 1 ) ) ), half ) );
+    }
+
+    audio_downmix_range ( samples, AUDIO_LAYOUT_STEREO, i, frames );
+}
+
+/**
+ * Expand mono sound to stereo, SSE2 version
+ */
+static void audio_upmix_stereo_sse2 ( float *samples, int frames )
+{
+    int i = frames & ~3;
+    __m128 x;
+
+    /* Tail goes first, then blocks backwards */
+    audio_upmix_range ( samples, AUDIO_LAYOUT_STEREO, i, frames );
+
+    while ( i )
+    {
+        i -= 4;
+        x = _mm_loadu_ps ( samples + i );
+        _mm_storeu_ps ( samples + 2 * i, _mm_unpacklo_ps ( x, x ) );
+        _mm_storeu_ps ( samples + 2 * i + 4, _mm_unpackhi_ps ( x, x ) );
+    }
+}
+
+/**
+ * SSE2 kernels
+ */
+static const struct audio_kernels_t audio_kernels_sse2 = {
+    audio_float_to_short_sse2,
+    audio_float_to_int_sse2,
+    audio_short_to_float_sse2,
+    audio_int_to_float_sse2,
+    audio_downmix_stereo_sse2,
+    audio_upmix_stereo_sse2
+};
+
+/**
+ * Scale, clamp and round four float samples, AVX2 version
+ */
+__attribute__ ( ( target ( "avx2" ) ) )
+static inline __m128i audio_avx2_round ( __m128 x )
+{
+    const __m256d scale = _mm256_set1_pd ( 8.0 * 0x10000000 );
+    const __m256d hi = _mm256_set1_pd ( 1.0 * 0x7FFFFFFF );
+    const __m256d lo = _mm256_set1_pd ( -8.0 * 0x10000000 );
+
+    return _mm256_cvtpd_epi32 ( _mm256_max_pd ( lo, _mm256_min_pd ( hi,
+                _mm256_mul_pd ( _mm256_cvtps_pd ( x ), scale ) ) ) );
+}
+
+/**
+ * Convert float array to short integer array, AVX2 version
+ */
+__attribute__ ( ( target ( "avx2" ) ) )
+static void audio_float_to_short_avx2 ( const float *input, short *output, int count )
+{
+    int i = 0;
+    __m256 x;
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        x = _mm256_loadu_ps ( input + i );
+        _mm_storeu_si128 ( ( __m128i * ) ( output + i ),
+            _mm_packs_epi32 ( _mm_srai_epi32 ( audio_avx2_round ( _mm256_castps256_ps128 ( x ) ),
+                    16 ), _mm_srai_epi32 ( audio_avx2_round ( _mm256_extractf128_ps ( x, 1 ) ),
+                    16 ) ) );
+    }
+
+    audio_float_to_short_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert float array to integer array, AVX2 version
+ */
+__attribute__ ( ( target ( "avx2" ) ) )
+static void audio_float_to_int_avx2 ( const float *input, int *output, int count )
+{
+    int i = 0;
+    __m256 x;
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        x = _mm256_loadu_ps ( input + i );
+        _mm_storeu_si128 ( ( __m128i * ) ( output + i ),
+            audio_avx2_round ( _mm256_castps256_ps128 ( x ) ) );
+        _mm_storeu_si128 ( ( __m128i * ) ( output + i + 4 ),
+            audio_avx2_round ( _mm256_extractf128_ps ( x, 1 ) ) );
+    }
+
+    audio_float_to_int_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert short integer array to float array, AVX2 version
+ */
+__attribute__ ( ( target ( "avx2" ) ) )
+static void audio_short_to_float_avx2 ( const short *input, float *output, int count )
+{
+    int i = 0;
+    const __m256 scale = _mm256_set1_ps ( 1.0f / 0x8000 );
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        _mm256_storeu_ps ( output + i, _mm256_mul_ps ( _mm256_cvtepi32_ps ( _mm256_cvtepi16_epi32 (
+                        _mm_loadu_si128 ( ( const __m128i * ) ( input + i ) ) ) ), scale ) );
+    }
+
+    audio_short_to_float_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert integer array to float array, AVX2 version
+ */
+__attribute__ ( ( target ( "avx2" ) ) )
+static void audio_int_to_float_avx2 ( const int *input, float *output, int count )
+{
+    int i = 0;
+    const __m256 scale = _mm256_set1_ps ( 1.0f / ( 8.0f * 0x10000000 ) );
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        _mm256_storeu_ps ( output + i, _mm256_mul_ps ( _mm256_cvtepi32_ps ( _mm256_loadu_si256 (
+                        ( const __m256i * ) ( input + i ) ) ), scale ) );
+    }
+
+    audio_int_to_float_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Shrink stereo sound to mono, AVX2 version
+ */
+__attribute__ ( ( target ( "avx2" ) ) )
+static void audio_downmix_stereo_avx2 ( float *samples, int frames )
+{
+    int i = 0;
+    __m256 a;
+    __m256 b;
+    __m256 sum;
+    const __m256 zero = _mm256_setzero_ps (  );
+    const __m256 half = _mm256_set1_ps ( 0.5f );
+
+    for ( ; i + 8 <= frames; i += 8 )
+    {
+        a = _mm256_loadu_ps ( samples + 2 * i );
+        b = _mm256_loadu_ps ( samples + 2 * i + 8 );
+        sum = _mm256_mul_ps ( _mm256_add_ps ( _mm256_add_ps ( zero,
+                    _mm256_shuffle_ps ( a, b, _MM_SHUFFLE ( 2, 0, 2, 0 ) ) ),
+                _mm256_shuffle_ps ( a, b, _MM_SHUFFLE ( 3, 1, 3, 1 ) ) ), half );
+
+        /* In-lane shuffle leaves frames as 0 1 4 5 2 3 6 7 */
+        _mm256_storeu_ps ( samples + i, _mm256_castpd_ps ( _mm256_permute4x64_pd (
+                    _mm256_castps_pd ( sum ), _MM_SHUFFLE ( 3, 1, 2, 0 ) ) ) );
+    }
+
+    audio_downmix_range ( samples, AUDIO_LAYOUT_STEREO, i, frames );
+}
+
+/**
+ * Expand mono sound to stereo, AVX2 version
+ */
+__attribute__ ( ( target ( "avx2" ) ) )
+static void audio_upmix_stereo_avx2 ( float *samples, int frames )
+{
+    int i = frames & ~7;
+    __m256 x;
+    __m256 lo;
+    __m256 hi;
+
+    audio_upmix_range ( samples, AUDIO_LAYOUT_STEREO, i, frames );
+
+    while ( i )
+    {
+        i -= 8;
+        x = _mm256_loadu_ps ( samples + i );
+        lo = _mm256_unpacklo_ps ( x, x );
+        hi = _mm256_unpackhi_ps ( x, x );
+        _mm256_storeu_ps ( samples + 2 * i, _mm256_permute2f128_ps ( lo, hi, 0x20 ) );
+        _mm256_storeu_ps ( samples + 2 * i + 8, _mm256_permute2f128_ps ( lo, hi, 0x31 ) );
+    }
+}
+
+/**
+ * AVX2 kernels
+ */
+static const struct audio_kernels_t audio_kernels_avx2 = {
+    audio_float_to_short_avx2,
+    audio_float_to_int_avx2,
+    audio_short_to_float_avx2,
+    audio_int_to_float_avx2,
+    audio_downmix_stereo_avx2,
+    audio_upmix_stereo_avx2
+};
+
+#elif defined(__aarch64__)
+
+/**
+ * Scale, clamp and round four float samples
+ */
+static inline int32x4_t audio_neon_round4 ( const float *input )
+{
+    float32x4_t x = vld1q_f32 ( input );
+    float64x2_t a = vmulq_n_f64 ( vcvt_f64_f32 ( vget_low_f32 ( x ) ), 8.0 * 0x10000000 );
+    float64x2_t b = vmulq_n_f64 ( vcvt_high_f64_f32 ( x ), 8.0 * 0x10000000 );
+    const float64x2_t hi = vdupq_n_f64 ( 1.0 * 0x7FFFFFFF );
+    const float64x2_t lo = vdupq_n_f64 ( -8.0 * 0x10000000 );
+
+    a = vmaxq_f64 ( lo, vminq_f64 ( hi, a ) );
+    b = vmaxq_f64 ( lo, vminq_f64 ( hi, b ) );
+
+    return vcombine_s32 ( vmovn_s64 ( vcvtnq_s64_f64 ( a ) ),
+        vmovn_s64 ( vcvtnq_s64_f64 ( b ) ) );
+}
+
+/**
+ * Convert float array to short integer array, NEON version
+ */
+static void audio_float_to_short_neon ( const float *input, short *output, int count )
+{
+    int i = 0;
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        vst1q_s16 ( output + i,
+            vcombine_s16 ( vqmovn_s32 ( vshrq_n_s32 ( audio_neon_round4 ( input + i ), 16 ) ),
+                vqmovn_s32 ( vshrq_n_s32 ( audio_neon_round4 ( input + i + 4 ), 16 ) ) ) );
+    }
+
+    audio_float_to_short_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert float array to integer array, NEON version
+ */
+static void audio_float_to_int_neon ( const float *input, int *output, int count )
+{
+    int i = 0;
+
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        vst1q_s32 ( output + i, audio_neon_round4 ( input + i ) );
+    }
+
+    audio_float_to_int_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert short integer array to float array, NEON version
+ */
+static void audio_short_to_float_neon ( const short *input, float *output, int count )
+{
+    int i = 0;
+    int16x8_t v;
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        v = vld1q_s16 ( input + i );
+        vst1q_f32 ( output + i, vmulq_n_f32 ( vcvtq_f32_s32 ( vmovl_s16 ( vget_low_s16 ( v ) ) ),
+                1.0f / 0x8000 ) );
+        vst1q_f32 ( output + i + 4, vmulq_n_f32 ( vcvtq_f32_s32 ( vmovl_high_s16 ( v ) ),
+                1.0f / 0x8000 ) );
+    }
+
+    audio_short_to_float_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Convert integer array to float array, NEON version
+ */
+static void audio_int_to_float_neon ( const int *input, float *output, int count )
+{
+    int i = 0;
+
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        vst1q_f32 ( output + i, vmulq_n_f32 ( vcvtq_f32_s32 ( vld1q_s32 ( input + i ) ),
+                1.0f / ( 8.0f * 0x10000000 ) ) );
+    }
+
+    audio_int_to_float_scalar ( input + i, output + i, count - i );
+}
+
+/**
+ * Shrink stereo sound to mono, NEON version
+ */
+static void audio_downmix_stereo_neon ( float *samples, int frames )
+{
+    int i = 0;
+    float32x4x2_t v;
+    const float32x4_t zero = vdupq_n_f32 ( 0.0f );
+
+    for ( ; i + 4 <= frames; i += 4 )
+    {
+        v = vld2q_f32 ( samples + 2 * i );
+        vst1q_f32 ( samples + i, vmulq_n_f32 ( vaddq_f32 ( vaddq_f32 ( zero, v.val[0] ),
+                    v.val[1] ), 0.5f ) );
+    }
+
+    audio_downmix_range ( samples, AUDIO_LAYOUT_STEREO, i, frames );
+}
+
+/**
+ * Expand mono sound to stereo, NEON version
+ */
+static void audio_upmix_stereo_neon ( float *samples, int frames )
+{
+    int i = frames & ~3;
+    float32x4x2_t v;
+
+    audio_upmix_range ( samples, AUDIO_LAYOUT_STEREO, i, frames );
+
+    while ( i )
+    {
+        i -= 4;
+        v.val[0] = vld1q_f32 ( samples + i );
+        v.val[1] = v.val[0];
+        vst2q_f32 ( samples + 2 * i, v );
+    }
+}
+
+/**
+ * NEON kernels
+ */
+static const struct audio_kernels_t audio_kernels_neon = {
+    audio_float_to_short_neon,
+    audio_float_to_int_neon,
+    audio_short_to_float_neon,
+    audio_int_to_float_neon,
+    audio_downmix_stereo_neon,
+    audio_upmix_stereo_neon
+};
+
+#endif
+
+/**
+ * Selected kernels
+ */
+static const struct audio_kernels_t *audio_kernels = &audio_kernels_scalar;
+
+/**
+ * Get kernels for instruction set level if CPU supports it
+ */
+static const struct audio_kernels_t *audio_simd_kernels ( int level )
+{
+    switch ( level )
+    {
+    case AUDIO_SIMD_SCALAR:
+        return &audio_kernels_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    case AUDIO_SIMD_SSE2:
+        __builtin_cpu_init (  );
+        return __builtin_cpu_supports ( "sse2" ) ? &audio_kernels_sse2 : NULL;
+    case AUDIO_SIMD_AVX2:
+        __builtin_cpu_init (  );
+        return __builtin_cpu_supports ( "avx2" ) ? &audio_kernels_avx2 : NULL;
+#elif defined(__aarch64__)
+    case AUDIO_SIMD_NEON:
+        return &audio_kernels_neon;
+#endif
+    }
+
+    return NULL;
+}
+
+/**
+ * Check if CPU supports instruction set level
+ */
+int audio_simd_supported ( int level )
+{
+    return audio_simd_kernels ( level ) != NULL;
+}
+
+/**
+ * Select conversion kernels by instruction set level
+ */
+int audio_simd_select ( int level )
+{
+    const struct audio_kernels_t *kernels;
+
+    if ( !( kernels = audio_simd_kernels ( level ) ) )
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    audio_kernels = kernels;
+    return 0;
+}
+
+/**
+ * Get instruction set level name
+ */
+const char *audio_simd_name ( int level )
+{
+    static const char *names[AUDIO_SIMD_NLEVELS] = { "scalar", "sse2", "avx2", "neon" };
+
+    return level >= 0 && level < AUDIO_SIMD_NLEVELS ? names[level] : "unknown";
+}
+
+/**
+ * Select best conversion kernels at program startup
+ */
+__attribute__ ( ( constructor ) )
+static void audio_simd_init ( void )
+{
+    int level;
+
+    for ( level = AUDIO_SIMD_NLEVELS - 1; level > AUDIO_SIMD_SCALAR; level-- )
+    {
+        if ( audio_simd_select ( level ) >= 0 )
+        {
+            break;
+        }
+    }
+}
+
+/**
+ * Convert float array to short integer array
+ */
+void audio_float_to_short_array ( const float *input, short *output, int count )
+{
+    audio_kernels->float_to_short ( input, output, count );
+}
+
+/**
+ * Convert float array to integer array
+ */
+void audio_float_to_int_array ( const float *input, int *output, int count )
+{
+    audio_kernels->float_to_int ( input, output, count );
+}
+
+/**
+ * Convert short integer array to float array
+ */
+void audio_short_to_float_array ( const short *input, float *output, int count )
+{
+    audio_kernels->short_to_float ( input, output, count );
+}
+
+/**
+ * Convert integer array to float array
+ */
+void audio_int_to_float_array ( const int *input, float *output, int count )
+{
+    audio_kernels->int_to_float ( input, output, count );
+}
+
+/**
+ * Shrink sound from multi-channel to mono in place
+ */
+void audio_downmix_float_array ( float *samples, size_t channels, int frames )
+{
+    if ( channels == AUDIO_LAYOUT_STEREO )
+    {
+        audio_kernels->downmix_stereo ( samples, frames );
+
+    } else if ( channels > AUDIO_LAYOUT_MONO )
+    {
+        audio_downmix_range ( samples, channels, 0, frames );
+    }
+}
+
+/**
+ * Expand sound from mono to multi-channel in place
+ */
+void audio_upmix_float_array ( float *samples, size_t channels, int frames )
+{
+    if ( channels == AUDIO_LAYOUT_STEREO )
+    {
+        audio_kernels->upmix_stereo ( samples, frames );
+
+    } else if ( channels > AUDIO_LAYOUT_MONO )
+    {
+        audio_upmix_range ( samples, channels, 0, frames );
+    }
+}
@@ -0,0 +1,793 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Direct Peer Path
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+
+#define DIRECT_MAGIC "NTD1"
+#define DIRECT_CANDS_MAGIC "NTC1"
+#define DIRECT_FLAG_HEARD 0x01
+#define DIRECT_TAG_LEN 16
+#define STUN_HEADER_LEN 20
+#define STUN_MAGIC_COOKIE 0x2112A442
+
+enum
+{
+    DIRECT_PROBE = 1,
+    DIRECT_MEDIA
+};
+
+/**
+ * Query STUN server for public address of socket
+ */
+static int direct_stun_query ( struct nettalk_context_t *context, int sock,
+    struct nettalk_candidate_t *cand )
+{
+    int attempt;
+    ssize_t len;
+    size_t pos;
+    size_t end;
+    unsigned int atype;
+    unsigned int alen;
+    unsigned int cookie;
+    struct pollfd fds[1];
+    struct sockaddr_in saddr;
+    uint8_t request[STUN_HEADER_LEN];
+    uint8_t response[512];
+
+    memset ( &saddr, '\0', sizeof ( saddr ) );
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = context->stun_addr;
+    saddr.sin_port = htons ( context->stun_port );
+
+    /* Binding request with random transaction id */
+    memset ( request, '\0', sizeof ( request ) );
+    request[1] = 0x01;
+    cookie = htonl ( STUN_MAGIC_COOKIE );
+    memcpy ( request + 4, &cookie, sizeof ( cookie ) );
+
+    if ( nettalk_random_bytes ( &context->random, request + 8, 12 ) < 0 )
+    {
+        return -1;
+    }
+
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+
+    for ( attempt = 0; attempt < 3; attempt++ )
+    {
+        if ( sendto ( sock, request, sizeof ( request ), 0, ( struct sockaddr * ) &saddr,
+                sizeof ( saddr ) ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( poll ( fds, 1, NETTALK_STUN_TIMEOUT ) <= 0 )
+        {
+            continue;
+        }
+
+        if ( ( len = recv ( sock, response, sizeof ( response ), 0 ) ) < STUN_HEADER_LEN )
+        {
+            continue;
+        }
+
+        /* Accept only success response to our transaction */
+        if ( response[0] != 0x01 || response[1] != 0x01
+            || memcmp ( response + 4, request + 4, 16 ) )
+        {
+            continue;
+        }
+
+        if ( ( end = STUN_HEADER_LEN + ( ( response[2] << 8 ) | response[3] ) ) > ( size_t ) len )
+        {
+            continue;
+        }
+
+        /* Look for IPv4 mapped address attribute */
+        for ( pos = STUN_HEADER_LEN; pos + 4 <= end; pos += 4 + ( ( alen + 3 ) & ~3u ) )
+        {
+            atype = ( response[pos] << 8 ) | response[pos + 1];
+            alen = ( response[pos + 2] << 8 ) | response[pos + 3];
+
+            if ( pos + 4 + alen > end )
+            {
+                break;
+            }
+
+            if ( ( atype == 0x0020 || atype == 0x0001 ) && alen >= 8 && response[pos + 5] == 0x01 )
+            {
+                memcpy ( &cand->port, response + pos + 6, sizeof ( cand->port ) );
+                memcpy ( &cand->addr, response + pos + 8, sizeof ( cand->addr ) );
+
+                /* XOR-MAPPED-ADDRESS is masked with magic cookie */
+                if ( atype == 0x0020 )
+                {
+                    cand->port ^= htons ( STUN_MAGIC_COOKIE >> 16 );
+                    cand->addr ^= cookie;
+                }
+
+                return 0;
+            }
+        }
+    }
+
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+/**
+ * Gather self direct path candidates
+ */
+static size_t direct_gather ( struct nettalk_context_t *context, int sock,
+    struct nettalk_candidate_t *cands )
+{
+    size_t ncands = 0;
+    socklen_t slen;
+    struct sockaddr_in saddr;
+    struct sockaddr_in laddr;
+
+    slen = sizeof ( saddr );
+
+    if ( getsockname ( context->session.sock, ( struct sockaddr * ) &saddr, &slen ) < 0 )
+    {
+        return 0;
+    }
+
+    slen = sizeof ( laddr );
+
+    if ( getsockname ( sock, ( struct sockaddr * ) &laddr, &slen ) < 0 )
+    {
+        return 0;
+    }
+
+    /* Host candidate is interface address used to reach the relay */
+    cands[ncands].addr = saddr.sin_addr.s_addr;
+    cands[ncands].port = laddr.sin_port;
+    ncands++;
+
+    /* Server reflexive candidate is public address seen by STUN server */
+    if ( context->stun_port && direct_stun_query ( context, sock, cands + ncands ) >= 0 )
+    {
+        if ( cands[ncands].addr != cands[0].addr || cands[ncands].port != cands[0].port )
+        {
+            ncands++;
+        }
+
+    } else if ( context->stun_port )
+    {
+        nettalk_errcode ( context, "stun query failed", errno );
+    }
+
+    return ncands;
+}
+
+/**
+ * Exchange candidates with peer through the relay
+ */
+static int direct_exchange ( struct nettalk_context_t *context,
+    const struct nettalk_candidate_t *cands, size_t ncands )
+{
+    size_t i;
+    uint8_t block[AMRNB_CHUNK_MAX];
+    uint8_t cipher[AMRNB_CHUNK_MAX];
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    /* Candidates block fits single chunk */
+    memset ( block, '\0', sizeof ( block ) );
+    memcpy ( block, DIRECT_CANDS_MAGIC, 4 );
+    block[4] = ncands;
+
+    for ( i = 0; i < ncands; i++ )
+    {
+        memcpy ( block + 8 + i * 6, &cands[i].addr, sizeof ( cands[i].addr ) );
+        memcpy ( block + 12 + i * 6, &cands[i].port, sizeof ( cands[i].port ) );
+    }
+
+    if ( mbedtls_aes_crypt_cbc ( &context->session.tx_aes, MBEDTLS_AES_ENCRYPT, sizeof ( block ),
+            context->session.tx_iv, block, cipher ) != 0 )
+    {
+        return -1;
+    }
+
+    if ( send_complete_with_reset ( context, context->session.sock, cipher, sizeof ( cipher ),
+            NETTALK_SEND_TIMEOUT ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( recv_complete_with_reset ( context, context->session.sock, cipher, sizeof ( cipher ),
+            NETTALK_RECV_TIMEOUT ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( mbedtls_aes_crypt_cbc ( &context->session.rx_aes, MBEDTLS_AES_DECRYPT, sizeof ( cipher ),
+            context->session.rx_iv, cipher, block ) != 0 )
+    {
+        return -1;
+    }
+
+    if ( memcmp ( block, DIRECT_CANDS_MAGIC, 4 ) || block[4] > NETTALK_DIRECT_NCANDS )
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    direct->ncands = block[4];
+
+    for ( i = 0; i < direct->ncands; i++ )
+    {
+        memcpy ( &direct->cands[i].addr, block + 8 + i * 6, sizeof ( direct->cands[i].addr ) );
+        memcpy ( &direct->cands[i].port, block + 12 + i * 6, sizeof ( direct->cands[i].port ) );
+    }
+
+    return 0;
+}
+
+/**
+ * Exchange direct path candidates with peer
+ */
+int nettalk_direct_setup ( struct nettalk_context_t *context )
+{
+    size_t ncands;
+    struct sockaddr_in saddr;
+    struct nettalk_candidate_t cands[NETTALK_DIRECT_NCANDS];
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    direct->sock = -1;
+    direct->state = NETTALK_DIRECT_OFF;
+
+    if ( !context->direct_enabled )
+    {
+        return 0;
+    }
+
+    /* Direct path would reveal address hidden by proxy */
+    if ( context->socks5_enabled )
+    {
+        nettalk_info ( context, "direct path disabled behind proxy" );
+        return 0;
+    }
+
+    if ( ( direct->sock = socket ( AF_INET, SOCK_DGRAM, 0 ) ) < 0 )
+    {
+        nettalk_errcode ( context, "failed to create direct socket", errno );
+        return -1;
+    }
+
+    memset ( &saddr, '\0', sizeof ( saddr ) );
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = INADDR_ANY;
+
+    if ( bind ( direct->sock, ( struct sockaddr * ) &saddr, sizeof ( saddr ) ) < 0 )
+    {
+        nettalk_errcode ( context, "failed to bind direct socket", errno );
+        nettalk_direct_free ( context );
+        return -1;
+    }
+
+    if ( !( ncands = direct_gather ( context, direct->sock, cands ) ) )
+    {
+        nettalk_errcode ( context, "failed to gather candidates", errno );
+        nettalk_direct_free ( context );
+        return -1;
+    }
+
+    nettalk_info ( context, "gathered %u direct path candidates", ( unsigned int ) ncands );
+
+    if ( direct_exchange ( context, cands, ncands ) < 0 )
+    {
+        nettalk_errcode ( context, "peer did not send candidates", errno );
+        nettalk_direct_free ( context );
+        return -1;
+    }
+
+    nettalk_info ( context, "received %u peer candidates", ( unsigned int ) direct->ncands );
+
+    direct->state = NETTALK_DIRECT_PUNCHING;
+    direct->heard = FALSE;
+    direct->tx_seq = 0;
+    direct->rx_seq = 0;
+    direct->rx_gap = FALSE;
+    direct->started = 0;
+    direct->probed = 0;
+    direct->received = 0;
+
+    return 0;
+}
+
+/**
+ * Sign datagram with truncated HMAC-SHA256 of iv and ciphertext
+ */
+static int direct_sign ( const uint8_t * key, const uint8_t * datagram, size_t len,
+    uint8_t * tag )
+{
+    uint8_t hash[SHA256_BLOCKLEN];
+
+    if ( mbedtls_md_hmac ( mbedtls_md_info_from_type ( MBEDTLS_MD_SHA256 ), key,
+            SHA256_BLOCKLEN, datagram, len, hash ) != 0 )
+    {
+        return -1;
+    }
+
+    memcpy ( tag, hash, DIRECT_TAG_LEN );
+    return 0;
+}
+
+/**
+ * Encrypt and send single datagram
+ */
+static int direct_sendto ( struct nettalk_context_t *context, const struct sockaddr_in *saddr,
+    int type, int flags, const uint8_t * payload, size_t len )
+{
+    size_t i;
+    unsigned long long seq;
+    uint8_t iv[AES256_BLOCKLEN];
+    uint8_t plain[AES256_BLOCKLEN + NETTALK_DIRECT_PAYLOAD];
+    uint8_t datagram[AES256_BLOCKLEN * 2 + NETTALK_DIRECT_PAYLOAD + DIRECT_TAG_LEN];
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    /* Header carries sequence number against replays */
+    memset ( plain, '\0', AES256_BLOCKLEN );
+    memcpy ( plain, DIRECT_MAGIC, 4 );
+    plain[4] = type;
+    plain[5] = flags;
+
+    for ( i = 0, seq = ++direct->tx_seq; i < 8; i++ )
+    {
+        plain[15 - i] = seq >> ( i * 8 );
+    }
+
+    if ( len )
+    {
+        memcpy ( plain + AES256_BLOCKLEN, payload, len );
+    }
+
+    /* Each datagram has own iv, so that losses do not break the chain */
+    if ( nettalk_random_bytes ( &context->random, datagram, AES256_BLOCKLEN ) < 0 )
+    {
+        return -1;
+    }
+
+    memcpy ( iv, datagram, sizeof ( iv ) );
+
+    if ( mbedtls_aes_crypt_cbc ( &context->session.tx_aes, MBEDTLS_AES_ENCRYPT,
+            AES256_BLOCKLEN + len, iv, plain, datagram + AES256_BLOCKLEN ) != 0 )
+    {
+        return -1;
+    }
+
+    /* Encrypt then sign, so that receiver checks datagram before decrypting it */
+    if ( direct_sign ( direct->tx_key, datagram, AES256_BLOCKLEN * 2 + len,
+            datagram + AES256_BLOCKLEN * 2 + len ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( sendto ( direct->sock, datagram, AES256_BLOCKLEN * 2 + len + DIRECT_TAG_LEN, MSG_DONTWAIT,
+            ( const struct sockaddr * ) saddr, sizeof ( *saddr ) ) < 0 )
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Receive and decrypt single datagram
+ */
+static ssize_t direct_recvfrom ( struct nettalk_context_t *context, struct sockaddr_in *saddr,
+    int *type, int *flags, uint8_t * payload )
+{
+    size_t i;
+    ssize_t len;
+    socklen_t slen;
+    unsigned long long seq;
+    uint8_t diff;
+    uint8_t iv[AES256_BLOCKLEN];
+    uint8_t tag[DIRECT_TAG_LEN];
+    uint8_t plain[AES256_BLOCKLEN + NETTALK_DIRECT_PAYLOAD];
+    uint8_t datagram[AES256_BLOCKLEN * 2 + NETTALK_DIRECT_PAYLOAD + DIRECT_TAG_LEN];
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    slen = sizeof ( *saddr );
+
+    if ( ( len =
+            recvfrom ( direct->sock, datagram, sizeof ( datagram ), MSG_DONTWAIT,
+                ( struct sockaddr * ) saddr, &slen ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( len < AES256_BLOCKLEN * 2 + DIRECT_TAG_LEN || ( len - DIRECT_TAG_LEN ) % AES256_BLOCKLEN )
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    len -= DIRECT_TAG_LEN;
+
+    /* Nothing is decrypted before signature of peer is verified, in constant time */
+    if ( direct_sign ( direct->rx_key, datagram, len, tag ) < 0 )
+    {
+        return -1;
+    }
+
+    for ( i = 0, diff = 0; i < DIRECT_TAG_LEN; i++ )
+    {
+        diff |= tag[i] ^ datagram[len + i];
+    }
+
+    if ( diff )
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    memcpy ( iv, datagram, sizeof ( iv ) );
+
+    if ( mbedtls_aes_crypt_cbc ( &context->session.rx_aes, MBEDTLS_AES_DECRYPT,
+            len - AES256_BLOCKLEN, iv, datagram + AES256_BLOCKLEN, plain ) != 0 )
+    {
+        return -1;
+    }
+
+    /* Signed datagram from other protocol version is still rejected */
+    if ( memcmp ( plain, DIRECT_MAGIC, 4 ) )
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    for ( i = 0, seq = 0; i < 8; i++ )
+    {
+        seq = ( seq << 8 ) | plain[8 + i];
+    }
+
+    /* Drop replayed and late datagrams */
+    if ( seq <= direct->rx_seq )
+    {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    /* Skipped sequence numbers are datagrams lost on the way */
+    direct->rx_gap = seq > direct->rx_seq + 1;
+    direct->rx_seq = seq;
+    *type = plain[4];
+    *flags = plain[5];
+    len -= AES256_BLOCKLEN * 2;
+    memcpy ( payload, plain + AES256_BLOCKLEN, len );
+
+    return len;
+}
+
+/**
+ * Get interval between probes
+ */
+static int direct_probe_interval ( const struct nettalk_direct_t *direct, long long now )
+{
+    /* Probe often at first, then keep retrying slowly */
+    if ( !direct->started || now - direct->started < NETTALK_DIRECT_PUNCH_TIME )
+    {
+        return NETTALK_DIRECT_PROBE_INTERVAL;
+    }
+
+    return NETTALK_DIRECT_RETRY_INTERVAL;
+}
+
+/**
+ * Send probes to peer candidates
+ */
+static void direct_probe ( struct nettalk_context_t *context, long long now )
+{
+    size_t i;
+    struct sockaddr_in saddr;
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    if ( !direct->started )
+    {
+        direct->started = now;
+    }
+
+    if ( now < direct->probed + direct_probe_interval ( direct, now ) )
+    {
+        return;
+    }
+
+    direct->probed = now;
+
+    if ( direct->heard )
+    {
+        direct_sendto ( context, &direct->peer, DIRECT_PROBE, DIRECT_FLAG_HEARD, NULL, 0 );
+        return;
+    }
+
+    memset ( &saddr, '\0', sizeof ( saddr ) );
+    saddr.sin_family = AF_INET;
+
+    for ( i = 0; i < direct->ncands; i++ )
+    {
+        saddr.sin_addr.s_addr = direct->cands[i].addr;
+        saddr.sin_port = direct->cands[i].port;
+        direct_sendto ( context, &saddr, DIRECT_PROBE, 0, NULL, 0 );
+    }
+}
+
+/**
+ * Check if datagram comes from established peer, or from candidate it sent through relay
+ */
+static int direct_known_source ( const struct nettalk_direct_t *direct,
+    const struct sockaddr_in *saddr )
+{
+    size_t i;
+
+    if ( direct->state == NETTALK_DIRECT_UP )
+    {
+        return saddr->sin_addr.s_addr == direct->peer.sin_addr.s_addr
+            && saddr->sin_port == direct->peer.sin_port;
+    }
+
+    for ( i = 0; i < direct->ncands; i++ )
+    {
+        if ( saddr->sin_addr.s_addr == direct->cands[i].addr
+            && saddr->sin_port == direct->cands[i].port )
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Move media onto direct path
+ */
+static void direct_up ( struct nettalk_context_t *context, const struct sockaddr_in *saddr )
+{
+    char straddr[INET_ADDRSTRLEN];
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    direct->peer = *saddr;
+    direct->state = NETTALK_DIRECT_UP;
+
+    if ( !inet_ntop ( AF_INET, &saddr->sin_addr, straddr, sizeof ( straddr ) ) )
+    {
+        strcpy ( straddr, "?" );
+    }
+
+    nettalk_info ( context, "direct path to %s:%u established", straddr,
+        ntohs ( saddr->sin_port ) );
+}
+
+/**
+ * Get milliseconds left until next direct path event
+ */
+int nettalk_direct_timeout ( struct nettalk_context_t *context, long long now )
+{
+    long long when;
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    if ( direct->state == NETTALK_DIRECT_OFF )
+    {
+        return NETTALK_KEEPALIVE_INTERVAL;
+    }
+
+    if ( direct->state == NETTALK_DIRECT_UP )
+    {
+        when = direct->received + NETTALK_DIRECT_TIMEOUT;
+
+    } else
+    {
+        when = direct->probed + direct_probe_interval ( direct, now );
+    }
+
+    return when > now ? when - now : 0;
+}
+
+/**
+ * Handle direct path probes and incoming datagrams
+ */
+int nettalk_direct_cycle ( struct nettalk_context_t *context, struct pollfd *pfd, long long now )
+{
+    int type;
+    int flags;
+    ssize_t len;
+    struct sockaddr_in saddr;
+    uint8_t payload[NETTALK_DIRECT_PAYLOAD];
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    if ( direct->state == NETTALK_DIRECT_OFF )
+    {
+        return 0;
+    }
+
+    /* Fall back to relay when direct path goes silent */
+    if ( direct->state == NETTALK_DIRECT_UP && direct->received + NETTALK_DIRECT_TIMEOUT < now )
+    {
+        nettalk_info ( context, "direct path lost, using relay" );
+        direct->state = NETTALK_DIRECT_PUNCHING;
+        direct->heard = FALSE;
+        direct->started = now;
+    }
+
+    if ( direct->state == NETTALK_DIRECT_PUNCHING )
+    {
+        direct_probe ( context, now );
+    }
+
+    /* Keep bridge byte order while relayed data is pending */
+    if ( !( pfd->revents & POLLIN ) || context->session.rx_nleft )
+    {
+        return 0;
+    }
+
+    /* Ignore datagrams not from peer, established path is never moved elsewhere */
+    if ( ( len = direct_recvfrom ( context, &saddr, &type, &flags, payload ) ) < 0
+        || !direct_known_source ( direct, &saddr ) )
+    {
+        return 0;
+    }
+
+    direct->received = now;
+
+    if ( type == DIRECT_PROBE )
+    {
+        if ( direct->state != NETTALK_DIRECT_UP )
+        {
+            direct->peer = saddr;
+            direct->heard = TRUE;
+
+            /* Peer heard us too, so both ways work */
+            if ( flags & DIRECT_FLAG_HEARD )
+            {
+                direct_up ( context, &saddr );
+            }
+        }
+
+        direct_sendto ( context, &saddr, DIRECT_PROBE, DIRECT_FLAG_HEARD, NULL, 0 );
+        return 1;
+    }
+
+    if ( type != DIRECT_MEDIA )
+    {
+        return 0;
+    }
+
+    /* Media from peer means it has already switched */
+    if ( direct->state != NETTALK_DIRECT_UP )
+    {
+        direct_up ( context, &saddr );
+    }
+
+    /* Decoder rebuilds frame of lost datagram from redundancy in the next one */
+    if ( direct->rx_gap
+        && send_complete_with_reset ( context, context->bridge.u.s.remote, loss_chunk,
+            sizeof ( loss_chunk ), NETTALK_SEND_TIMEOUT ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( send_complete_with_reset ( context, context->bridge.u.s.remote, payload, len,
+            NETTALK_SEND_TIMEOUT ) < 0 )
+    {
+        return -1;
+    }
+
+    context->session.counters.rx_bytes += len;
+    context->session.counters.rx_packets++;
+    nettalk_stats_add ( &context->stats.rx_bytes, len );
+    nettalk_stats_add ( &context->stats.rx_packets, 1 );
+
+    return 1;
+}
+
+/**
+ * Check if chunk must not be lost, codec control and text are relayed
+ */
+static int direct_reliable_chunk ( const uint8_t * chunk )
+{
+    return !memcmp ( chunk, reset_chunk, sizeof ( reset_chunk ) )
+        || !memcmp ( chunk, init_chunk, sizeof ( init_chunk ) )
+        || !memcmp ( chunk, caps_chunk, 24 ) || !memcmp ( chunk, text_chunk, 24 )
+        || !memcmp ( chunk, ack_chunk, 24 );
+}
+
+/**
+ * Forward application data over direct path
+ */
+int nettalk_direct_send ( struct nettalk_context_t *context, int srcfd )
+{
+    int len = NETTALK_DIRECT_PAYLOAD;
+    int pos;
+    int recvlim;
+    uint8_t payload[NETTALK_DIRECT_PAYLOAD];
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    if ( ioctl ( srcfd, FIONREAD, &recvlim ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( recvlim < len )
+    {
+        len = recvlim;
+    }
+
+    if ( len > context->session.shaper.tokens )
+    {
+        len = context->session.shaper.tokens;
+    }
+
+    /* Whole chunks only, so switching paths never splits one */
+    len = len - ( len % AMRNB_CHUNK_MAX );
+
+    if ( !len )
+    {
+        return 0;
+    }
+
+    if ( recv ( srcfd, payload, len, MSG_PEEK ) < len )
+    {
+        return -1;
+    }
+
+    /* Datagram ends before first chunk that has to arrive */
+    pos = 0;
+
+    while ( pos < len && !direct_reliable_chunk ( payload + pos ) )
+    {
+        pos += AMRNB_CHUNK_MAX;
+    }
+
+    len = pos ? pos : AMRNB_CHUNK_MAX;
+
+    if ( recv ( srcfd, payload, len, 0 ) < len )
+    {
+        return -1;
+    }
+
+    /* Relay carries it, voice sent after codec reset waits until it is out */
+    if ( !pos )
+    {
+        if ( nettalk_relay_send_chunk ( context, payload ) < 0 )
+        {
+            return -1;
+        }
+
+        if ( memcmp ( payload, text_chunk, 24 ) && memcmp ( payload, ack_chunk, 24 ) )
+        {
+            context->session.relay_hold = TRUE;
+        }
+
+    } else
+    {
+        /* Lost datagrams are concealed by codec, relay takes over if path dies */
+        direct_sendto ( context, &direct->peer, DIRECT_MEDIA, 0, payload, len );
+    }
+
+    context->session.shaper.tokens -= len;
+    context->session.counters.tx_bytes += len;
+    context->session.counters.tx_packets++;
+    nettalk_stats_add ( &context->stats.tx_bytes, len );
+    nettalk_stats_add ( &context->stats.tx_packets, 1 );
+
+    return 1;
+}
+
+/**
+ * Close direct path
+ */
+void nettalk_direct_free ( struct nettalk_context_t *context )
+{
+    struct nettalk_direct_t *direct = &context->session.direct;
+
+    if ( direct->sock >= 0 )
+    {
+        close ( direct->sock );
+        direct->sock = -1;
+    }
+
+    direct->state = NETTALK_DIRECT_OFF;
+}
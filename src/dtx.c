@@ -0,0 +1,92 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Discontinuous Transmission Support
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+/**
+ * Initialize voice activity gate
+ */
+void audio_vad_init ( struct audio_vad_t *vad )
+{
+    vad->floor = AUDIO_VAD_ENERGY_MIN;
+    vad->hangover = AUDIO_VAD_HANGOVER;
+    vad->skipped = 0;
+}
+
+/**
+ * Check if AMR-NB frame should be encoded, silent one is skipped after hangover
+ */
+int audio_vad_process ( struct audio_vad_t *vad, const short *samples, int silent )
+{
+    size_t i;
+    int active;
+    unsigned long long energy = 0;
+
+    /* Calculate mean frame energy */
+    for ( i = 0; i < AMRNB_SAMPLES_MAX; i++ )
+    {
+        energy += ( long long ) samples[i] * samples[i];
+    }
+
+    energy /= AMRNB_SAMPLES_MAX;
+    active = energy > vad->floor * AUDIO_VAD_RATIO;
+
+    /* Noise floor follows quiet frames at once and rises slowly only with louder noise, */
+    /* so sustained speech never lifts it up to its own level */
+    if ( energy < vad->floor )
+    {
+        vad->floor = energy > AUDIO_VAD_ENERGY_MIN ? energy : AUDIO_VAD_ENERGY_MIN;
+
+    } else if ( !active )
+    {
+        vad->floor += ( vad->floor >> 6 ) + 1;
+    }
+
+    if ( active )
+    {
+        vad->hangover = AUDIO_VAD_HANGOVER;
+        vad->skipped = 0;
+        return TRUE;
+    }
+
+    if ( vad->hangover )
+    {
+        vad->hangover--;
+        return TRUE;
+    }
+
+    /* Peer needs silence descriptor before encoder goes quiet */
+    if ( !silent )
+    {
+        return TRUE;
+    }
+
+    /* Encoder still sees some frames, so that comfort noise parameters are refreshed */
+    if ( ++vad->skipped < AUDIO_VAD_SUBSAMPLE )
+    {
+        return FALSE;
+    }
+
+    vad->skipped = 0;
+    return TRUE;
+}
+
+/**
+ * Get filler length, so that stream ends aligned and last frame is followed by full chunk
+ */
+size_t audio_dtx_padding ( size_t stream_len, size_t frame_len )
+{
+    size_t padding;
+
+    padding = ( AMRNB_CHUNK_MAX - stream_len % AMRNB_CHUNK_MAX ) % AMRNB_CHUNK_MAX;
+
+    /* Decoder looks at full chunk, before it takes a frame */
+    if ( frame_len + padding < AMRNB_CHUNK_MAX )
+    {
+        padding += AMRNB_CHUNK_MAX;
+    }
+
+    return padding;
+}
@@ -0,0 +1,307 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Discontinuous Transmission Benchmark
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+#include <gsmamr_enc.h>
+
+#define DTXBENCH_TONE_SECONDS 20
+#define DTXBENCH_TONE_FREQ 440
+#define DTXBENCH_TONE_LEVEL 1000
+
+/**
+ * Benchmarked transmission mode
+ */
+struct dtxbench_mode_t
+{
+    const char *name;
+    int dtx;
+    int gate;
+};
+
+/**
+ * Benchmarked modes, first one is the continuous reference
+ */
+static const struct dtxbench_mode_t modes[] = {
+    {"continuous", FALSE, FALSE},
+    {"dtx", TRUE, FALSE},
+    {"dtx+gate", TRUE, TRUE}
+};
+
+/**
+ * Transmission mode result
+ */
+struct dtxbench_result_t
+{
+    unsigned long long frames;
+    unsigned long long sent;
+    unsigned long long gated;
+    unsigned long long bytes;
+    unsigned long long ns;
+};
+
+/**
+ * Get thread CPU time in nanoseconds
+ */
+static unsigned long long dtxbench_nanos ( void )
+{
+    struct timespec ts;
+
+    if ( clock_gettime ( CLOCK_THREAD_CPUTIME_ID, &ts ) < 0 )
+    {
+        return 0;
+    }
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Append raw S16_LE mono corpus file
+ */
+static int dtxbench_load ( const char *path, short **samples, size_t *len )
+{
+    FILE *file;
+    long size;
+    size_t count;
+    short *joined;
+
+    if ( !( file = fopen ( path, "rb" ) ) )
+    {
+        return -1;
+    }
+
+    if ( fseek ( file, 0, SEEK_END ) < 0 || ( size = ftell ( file ) ) < 0
+        || fseek ( file, 0, SEEK_SET ) < 0 )
+    {
+        fclose ( file );
+        return -1;
+    }
+
+    count = size / sizeof ( short );
+
+    if ( !( joined = ( short * ) realloc ( *samples, ( *len + count ) * sizeof ( short ) ) ) )
+    {
+        fclose ( file );
+        return -1;
+    }
+
+    *samples = joined;
+
+    if ( fread ( joined + *len, sizeof ( short ), count, file ) != count )
+    {
+        fclose ( file );
+        return -1;
+    }
+
+    *len += count;
+    fclose ( file );
+
+    return 0;
+}
+
+/**
+ * Encode whole corpus the way microphone encoder does
+ */
+static int dtxbench_run ( const struct dtxbench_mode_t *mode, int amrnb_mode,
+    const short *samples, size_t len, struct dtxbench_result_t *result )
+{
+    int silent = FALSE;
+    int status;
+    size_t pos;
+    size_t padding;
+    size_t stream_pos = 0;
+    ssize_t frame_len;
+    void *amrnb = NULL;
+    void *sid_sync = NULL;
+    unsigned long long ns;
+    struct audio_vad_t vad;
+    enum Frame_Type_3GPP ft = ( enum Frame_Type_3GPP ) 0;
+    short frame[AMRNB_SAMPLES_MAX];
+    unsigned char output[AMRNB_CHUNK_MAX];
+
+    memset ( result, '\0', sizeof ( struct dtxbench_result_t ) );
+    audio_vad_init ( &vad );
+
+    status = AMREncodeInit ( &amrnb, &sid_sync, mode->dtx );
+
+    if ( !amrnb || status < 0 )
+    {
+        return -1;
+    }
+
+    ns = dtxbench_nanos (  );
+
+    for ( pos = 0; pos + AMRNB_SAMPLES_MAX <= len; pos += AMRNB_SAMPLES_MAX )
+    {
+        result->frames++;
+
+        /* Encoder may modify its input */
+        memcpy ( frame, samples + pos, sizeof ( frame ) );
+
+        if ( mode->gate && !audio_vad_process ( &vad, frame, silent ) )
+        {
+            result->gated++;
+            continue;
+        }
+
+        if ( ( frame_len =
+                AMREncode ( amrnb, sid_sync, ( enum Mode ) amrnb_mode, frame, output, &ft,
+                    AMR_TX_IETF ) ) <= 0 )
+        {
+            AMREncodeExit ( &amrnb, &sid_sync );
+            return -1;
+        }
+
+        silent = ( int ) ft >= AMRNB_FRAME_SID;
+
+        if ( ( int ) ft == AMRNB_FRAME_NO_DATA )
+        {
+            continue;
+        }
+
+        /* Descriptor is flushed with same filler as microphone encoder adds */
+        padding = silent ? audio_dtx_padding ( stream_pos + frame_len, frame_len ) : 0;
+
+        result->sent++;
+        result->bytes += frame_len + padding;
+        stream_pos = ( stream_pos + frame_len + padding ) % AMRNB_CHUNK_MAX;
+    }
+
+    result->ns = dtxbench_nanos (  ) - ns;
+    AMREncodeExit ( &amrnb, &sid_sync );
+
+    return 0;
+}
+
+/**
+ * Check that gate never skips continuous tone at quiet speech level
+ */
+static int dtxbench_tone ( void )
+{
+    size_t i;
+    size_t pos;
+    struct audio_vad_t vad;
+    short frame[AMRNB_SAMPLES_MAX];
+
+    audio_vad_init ( &vad );
+
+    for ( pos = 0; pos < DTXBENCH_TONE_SECONDS * 8000; pos += AMRNB_SAMPLES_MAX )
+    {
+        for ( i = 0; i < AMRNB_SAMPLES_MAX; i++ )
+        {
+            frame[i] = ( short ) ( DTXBENCH_TONE_LEVEL
+                * sin ( 2 * M_PI * DTXBENCH_TONE_FREQ * ( pos + i ) / 8000 ) );
+        }
+
+        /* Encoder is taken as silent, so any frame gate considers inactive gets skipped */
+        if ( !audio_vad_process ( &vad, frame, TRUE ) )
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Show program usage message
+ */
+static void show_usage ( void )
+{
+    fprintf ( stderr, "\n" "usage: nettalk-dtxbench [-b bitrate] corpus.raw...\n\n"
+        "corpus files are raw S16_LE mono 8 kHz conversation recordings\n\n" );
+}
+
+/**
+ * Program entry point
+ */
+int main ( int argc, char *argv[] )
+{
+    int i;
+    int arg_off = 1;
+    int amrnb_mode = -1;
+    size_t len = 0;
+    double seconds;
+    short *samples = NULL;
+    unsigned int bitrate = 12200;
+    struct dtxbench_result_t reference;
+    struct dtxbench_result_t result;
+    static const unsigned int bitrates[] =
+        { 4750, 5150, 5900, 6700, 7400, 7950, 10200, 12200 };
+
+    if ( argc > 2 && !strcmp ( argv[1], "-b" ) )
+    {
+        if ( sscanf ( argv[2], "%u", &bitrate ) <= 0 )
+        {
+            show_usage (  );
+            return 1;
+        }
+        arg_off = 3;
+    }
+
+    for ( i = 0; i < ( int ) ( sizeof ( bitrates ) / sizeof ( bitrates[0] ) ); i++ )
+    {
+        if ( bitrates[i] == bitrate )
+        {
+            amrnb_mode = i;
+        }
+    }
+
+    if ( amrnb_mode < 0 || arg_off >= argc )
+    {
+        show_usage (  );
+        return 1;
+    }
+
+    /* Join all corpus files into one recording */
+    for ( i = arg_off; i < argc; i++ )
+    {
+        if ( dtxbench_load ( argv[i], &samples, &len ) < 0 )
+        {
+            fprintf ( stderr, "Error: cannot load '%s'.\n", argv[i] );
+            return 1;
+        }
+    }
+
+    if ( !( seconds = ( double ) ( len / AMRNB_SAMPLES_MAX * AMRNB_SAMPLES_MAX ) / 8000 ) )
+    {
+        fprintf ( stderr, "Error: corpus is shorter than one frame.\n" );
+        return 1;
+    }
+
+    if ( dtxbench_tone (  ) < 0 )
+    {
+        fprintf ( stderr, "Error: gate skipped continuous %u s tone.\n", DTXBENCH_TONE_SECONDS );
+        return 1;
+    }
+
+    printf ( "corpus: %.1f s of conversation, %u bps\n", seconds, bitrate );
+    printf ( "%-12s %8s %8s %10s %8s %12s %8s\n", "mode", "sent", "gated", "bytes/s", "saved",
+        "cpu us/s", "saved" );
+
+    for ( i = 0; i < ( int ) ( sizeof ( modes ) / sizeof ( modes[0] ) ); i++ )
+    {
+        if ( dtxbench_run ( &modes[i], amrnb_mode, samples, len, &result ) < 0 )
+        {
+            fprintf ( stderr, "Error: %s encoding failed.\n", modes[i].name );
+            return 1;
+        }
+
+        if ( !i )
+        {
+            reference = result;
+        }
+
+        printf ( "%-12s %7.1f%% %7.1f%% %10.0f %7.1f%% %12.1f %7.1f%%\n", modes[i].name,
+            result.sent * 100.0 / result.frames, result.gated * 100.0 / result.frames,
+            result.bytes / seconds, 100.0 - result.bytes * 100.0 / reference.bytes,
+            result.ns / 1000.0 / seconds,
+            reference.ns ? 100.0 - result.ns * 100.0 / reference.ns : 0.0 );
+    }
+
+    free ( samples );
+
+    return 0;
+}
@@ -9,6 +9,7 @@ enum
     POLL_NETWORK_SOCKET = 0,
     POLL_BRIDGE_SOCKET,
     POLL_RESET_PIPE,
+    POLL_DIRECT_SOCKET,
     POLL_FDS_COUNT
 };
 
@@ -42,6 +43,20 @@ static int decrypt_data ( struct nettalk_context_t *context, size_t len, const u
     return 0;
 }
 
+/**
+ * Get relayed data alignment
+ */
+static int forward_align ( struct nettalk_context_t *context )
+{
+    /* Paths may be switched only between whole chunks */
+    if ( context->session.direct.state != NETTALK_DIRECT_OFF )
+    {
+        return AMRNB_CHUNK_MAX;
+    }
+
+    return AES256_BLOCKLEN;
+}
+
 /**
  * Encrypt traffic internal
  */
@@ -111,7 +126,12 @@ static int encrypt_traffic_in ( struct nettalk_context_t *context, int srcfd, in
 
     if ( !context->session.tx_nleft )
     {
-        len = len - ( len % AES256_BLOCKLEN );
+        if ( len > context->session.shaper.tokens )
+        {
+            len = context->session.shaper.tokens;
+        }
+
+        len = len - ( len % forward_align ( context ) );
 
         if ( !len )
         {
@@ -129,6 +149,7 @@ static int encrypt_traffic_in ( struct nettalk_context_t *context, int srcfd, in
         }
 
         context->session.tx_nleft = len;
+        context->session.shaper.tokens -= len;
     }
 
     if ( ( len =
@@ -140,6 +161,14 @@ static int encrypt_traffic_in ( struct nettalk_context_t *context, int srcfd, in
 
     if ( len )
     {
+        context->session.counters.tx_bytes += len;
+        context->session.counters.tx_packets++;
+        nettalk_stats_add ( &context->stats.tx_bytes, len );
+        nettalk_stats_add ( &context->stats.tx_packets, 1 );
+
+        /* Direct path waits until relayed data is out, so peer gets it in order */
+        context->session.relay_hold = TRUE;
+
         nleft = context->session.tx_nleft - len;
         memcpy ( left, context->session.tx_left + len, nleft );
         memcpy ( context->session.tx_left, left, nleft );
@@ -218,7 +247,7 @@ static int decrypt_traffic_in ( struct nettalk_context_t *context, int srcfd, in
 
     if ( !context->session.rx_nleft )
     {
-        len = len - ( len % AES256_BLOCKLEN );
+        len = len - ( len % forward_align ( context ) );
 
         if ( !len )
         {
@@ -230,6 +259,11 @@ static int decrypt_traffic_in ( struct nettalk_context_t *context, int srcfd, in
             return -1;
         }
 
+        context->session.counters.rx_bytes += len;
+        context->session.counters.rx_packets++;
+        nettalk_stats_add ( &context->stats.rx_bytes, len );
+        nettalk_stats_add ( &context->stats.rx_packets, 1 );
+
         if ( decrypt_data ( context, len, left, context->session.rx_left ) < 0 )
         {
             return -1;
@@ -263,9 +297,60 @@ static int encrypt_traffic ( struct nettalk_context_t *context, struct pollfd *s
     struct pollfd *dst )
 {
     int status;
+    int queued;
+
+    /* Send over direct path while it works and relay has nothing pending */
+    if ( context->session.direct.state == NETTALK_DIRECT_UP && !context->session.tx_nleft )
+    {
+        dst->events &= ~POLLOUT;
+
+        /* Relay socket must be drained and acknowledged first */
+        if ( context->session.relay_hold )
+        {
+            if ( ioctl ( context->session.sock, TIOCOUTQ, &queued ) < 0 )
+            {
+                return -1;
+            }
+
+            if ( queued )
+            {
+                src->events &= ~POLLIN;
+                return 0;
+            }
+
+            context->session.relay_hold = FALSE;
+        }
+
+        if ( context->session.shaper.tokens < AMRNB_CHUNK_MAX )
+        {
+            src->events &= ~POLLIN;
+            context->session.shaper.throttled = TRUE;
+            nettalk_stats_add ( &context->stats.throttled, 1 );
+            return 0;
+        }
+
+        src->events |= POLLIN;
+
+        if ( src->revents & POLLIN )
+        {
+            return nettalk_direct_send ( context, src->fd );
+        }
+
+        return 0;
+    }
 
     if ( dst->revents & POLLOUT )
     {
+        /* Hold back traffic until shaper refills */
+        if ( !context->session.tx_nleft
+            && context->session.shaper.tokens < forward_align ( context ) )
+        {
+            dst->events &= ~POLLOUT;
+            context->session.shaper.throttled = TRUE;
+            nettalk_stats_add ( &context->stats.throttled, 1 );
+            return 0;
+        }
+
         if ( ( status = encrypt_traffic_in ( context, src->fd, dst->fd ) ) < 0 )
         {
             return -1;
@@ -333,6 +418,130 @@ static long long get_millis ( void )
     return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
+/**
+ * Initialize token bucket
+ */
+static void bucket_init ( struct nettalk_bucket_t *bucket, long long rate, long long burst,
+    long long now )
+{
+    bucket->throttled = FALSE;
+    bucket->rate = rate;
+    bucket->burst = burst;
+    bucket->tokens = burst;
+    bucket->stamp = now;
+}
+
+/**
+ * Refill token bucket
+ */
+static void bucket_refill ( struct nettalk_bucket_t *bucket, long long now )
+{
+    if ( now > bucket->stamp )
+    {
+        bucket->tokens += ( now - bucket->stamp ) * bucket->rate / 1000;
+
+        if ( bucket->tokens > bucket->burst )
+        {
+            bucket->tokens = bucket->burst;
+        }
+
+        bucket->stamp = now;
+    }
+}
+
+/**
+ * Get milliseconds left until next keepalive tick
+ */
+static int keepalive_timeout ( long long now )
+{
+    return NETTALK_KEEPALIVE_INTERVAL - now % NETTALK_KEEPALIVE_INTERVAL;
+}
+
+/**
+ * Send single chunk over relay while media goes direct
+ */
+int nettalk_relay_send_chunk ( struct nettalk_context_t *context, const uint8_t * chunk )
+{
+    uint8_t cipher[AMRNB_CHUNK_MAX];
+
+    if ( encrypt_data ( context, sizeof ( cipher ), chunk, cipher ) < 0 )
+    {
+        return -1;
+    }
+
+    return send_complete_with_reset ( context, context->session.sock, cipher, sizeof ( cipher ),
+        NETTALK_SEND_TIMEOUT ) < 0 ? -1 : 0;
+}
+
+/**
+ * Keep relay path warm while media goes direct
+ */
+static int keep_relay_alive ( struct nettalk_context_t *context, struct nettalk_ack_t *ack,
+    long long now )
+{
+    if ( context->session.direct.state != NETTALK_DIRECT_UP || context->session.tx_nleft
+        || ack->relayed / NETTALK_KEEPALIVE_INTERVAL >= now / NETTALK_KEEPALIVE_INTERVAL )
+    {
+        return 0;
+    }
+
+    if ( nettalk_relay_send_chunk ( context, noop_chunk ) < 0 )
+    {
+        return -1;
+    }
+
+    ack->relayed = now;
+
+    return 0;
+}
+
+/**
+ * Publish send backlog and round trip time for voice bitrate adaptation
+ */
+static void sample_path ( struct nettalk_context_t *context, struct nettalk_ack_t *ack,
+    long long now )
+{
+    int queued;
+    int backlog;
+    unsigned int rtt = 0;
+    socklen_t optlen;
+    struct tcp_info info;
+
+    if ( ack->sampled / NETTALK_ADAPT_INTERVAL >= now / NETTALK_ADAPT_INTERVAL )
+    {
+        return;
+    }
+
+    ack->sampled = now;
+
+    /* Data not encrypted yet waits in bridge */
+    if ( ioctl ( context->bridge.u.s.remote, FIONREAD, &backlog ) < 0 )
+    {
+        backlog = 0;
+    }
+
+    backlog += context->session.tx_nleft;
+
+    /* Relay queue and round trip matter only while media goes through it */
+    if ( context->session.direct.state != NETTALK_DIRECT_UP )
+    {
+        if ( ioctl ( context->session.sock, TIOCOUTQ, &queued ) >= 0 )
+        {
+            backlog += queued;
+        }
+
+        optlen = sizeof ( info );
+
+        if ( getsockopt ( context->session.sock, IPPROTO_TCP, TCP_INFO, &info, &optlen ) >= 0 )
+        {
+            rtt = info.tcpi_rtt / 1000;
+        }
+    }
+
+    context->session.backlog = backlog;
+    context->session.rtt = rtt;
+}
+
 /**
  * Forward data cycle
  */
@@ -340,14 +549,44 @@ static int nettalk_forward_cycle ( struct nettalk_context_t *context, struct pol
     size_t nfds, struct nettalk_ack_t *ack )
 {
     int status;
+    int timeout;
+    long long now;
+    long long woken;
+    struct nettalk_bucket_t *shaper = &context->session.shaper;
+
+    /* Resume shaped traffic once tokens cover whole chunk the sender is waiting for */
+    now = get_millis (  );
+    bucket_refill ( shaper, now );
+
+    if ( shaper->throttled && shaper->tokens >= forward_align ( context ) )
+    {
+        shaper->throttled = FALSE;
+        fds[POLL_BRIDGE_SOCKET].events |= POLLIN;
+    }
+
+    /* Idle sessions wake up together on keepalive ticks, unless direct path is probing */
+    if ( ( timeout = keepalive_timeout ( now ) ) > nettalk_direct_timeout ( context, now ) )
+    {
+        timeout = nettalk_direct_timeout ( context, now );
+    }
+
+    /* Throttled traffic and direct path waiting for relay are looked at again shortly */
+    if ( shaper->throttled || ( context->session.relay_hold
+            && context->session.direct.state == NETTALK_DIRECT_UP ) )
+    {
+        timeout = 5;
+    }
 
     /* Check for abilities */
-    if ( poll ( fds, nfds, 200 ) < 0 )
+    if ( poll ( fds, nfds, timeout ) < 0 )
     {
         nettalk_errcode ( context, "poll fds failed", errno );
         return -1;
     }
 
+    woken = nettalk_stats_micros (  );
+    nettalk_stats_add ( &context->stats.wakeups, 1 );
+
     /* Check for error */
     if ( ( fds[POLL_RESET_PIPE].revents | fds[POLL_NETWORK_SOCKET].
             revents | fds[POLL_BRIDGE_SOCKET].revents ) & ( POLLERR | POLLHUP ) )
@@ -382,6 +621,19 @@ static int nettalk_forward_cycle ( struct nettalk_context_t *context, struct pol
         ack->decrypted = get_millis (  );
     }
 
+    /* Forward data from direct path to application */
+    if ( ( status =
+            nettalk_direct_cycle ( context, fds + POLL_DIRECT_SOCKET, get_millis (  ) ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Update ACK */
+    if ( status > 0 )
+    {
+        ack->decrypted = get_millis (  );
+    }
+
     /* Forward data from application to socket */
     if ( ( status =
             encrypt_traffic ( context, fds + POLL_BRIDGE_SOCKET, fds + POLL_NETWORK_SOCKET ) ) < 0 )
@@ -395,8 +647,10 @@ static int nettalk_forward_cycle ( struct nettalk_context_t *context, struct pol
         ack->encrypted = get_millis (  );
     }
 
-    /* Reply with noop on idle */
-    if ( ack->encrypted + 200 < get_millis (  ) )
+    /* Reply with noop if nothing was sent since last keepalive tick */
+    if ( !shaper->throttled
+        && ack->encrypted / NETTALK_KEEPALIVE_INTERVAL <
+        get_millis (  ) / NETTALK_KEEPALIVE_INTERVAL )
     {
         if ( send_complete_with_reset ( context, context->bridge.u.s.local, noop_chunk,
                 sizeof ( noop_chunk ), NETTALK_SEND_TIMEOUT ) < 0 )
@@ -405,6 +659,18 @@ static int nettalk_forward_cycle ( struct nettalk_context_t *context, struct pol
         }
     }
 
+    /* Relay stays hot fallback for direct path */
+    if ( keep_relay_alive ( context, ack, get_millis (  ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Let encoder see congestion */
+    sample_path ( context, ack, get_millis (  ) );
+
+    /* Account time spent handling events */
+    nettalk_stats_observe ( &context->stats.loop_busy, nettalk_stats_micros (  ) - woken );
+
     return 0;
 }
 
@@ -421,6 +687,14 @@ int nettalk_forward_data ( struct nettalk_context_t *context )
     now = get_millis (  );
     ack.encrypted = now;
     ack.decrypted = now;
+    ack.relayed = now;
+    ack.sampled = now;
+
+    /* Reset shaper and traffic counters */
+    bucket_init ( &context->session.shaper, NETTALK_SHAPE_RATE, NETTALK_SHAPE_BURST, now );
+    memset ( &context->session.counters, '\0', sizeof ( context->session.counters ) );
+    context->session.backlog = 0;
+    context->session.rtt = 0;
 
     /* Setup poll list */
     fds[POLL_NETWORK_SOCKET].fd = context->session.sock;
@@ -429,10 +703,17 @@ int nettalk_forward_data ( struct nettalk_context_t *context )
     fds[POLL_BRIDGE_SOCKET].events = POLLERR | POLLHUP | POLLIN;
     fds[POLL_RESET_PIPE].fd = context->reset_pipe.u.s.readfd;
     fds[POLL_RESET_PIPE].events = POLLERR | POLLHUP | POLLIN;
+    fds[POLL_DIRECT_SOCKET].fd = context->session.direct.sock;
+    fds[POLL_DIRECT_SOCKET].events = POLLIN;
 
     /* Forward data loop */
     while ( nettalk_forward_cycle ( context, fds,
             sizeof ( fds ) / sizeof ( struct pollfd ), &ack ) >= 0 );
 
+    nettalk_info ( context, "sent %llu bytes in %llu packets",
+        context->session.counters.tx_bytes, context->session.counters.tx_packets );
+    nettalk_info ( context, "received %llu bytes in %llu packets",
+        context->session.counters.rx_bytes, context->session.counters.rx_packets );
+
     return 0;
 }
@@ -88,6 +88,7 @@ int nettalk_handshake ( struct nettalk_context_t *context )
         uint8_t bytes[AES256_BLOCKLEN + SHA256_BLOCKLEN];
     } rx;
     uint8_t calc_hmac[SHA256_BLOCKLEN];
+    uint8_t label[4 + AES256_BLOCKLEN];
 
     if ( nettalk_random_bytes ( &context->random, self_partial_key, sizeof ( self_partial_key ) ) )
     {
@@ -97,6 +98,7 @@ int nettalk_handshake ( struct nettalk_context_t *context )
 
     context->session.tx_nleft = 0;
     context->session.rx_nleft = 0;
+    context->session.relay_hold = FALSE;
 
     nettalk_info ( context, "generated self session partial-key" );
 
@@ -214,6 +216,30 @@ int nettalk_handshake ( struct nettalk_context_t *context )
 
     nettalk_info ( context, "remote peer has been authorized" );
 
+    /* Direct path datagrams are signed with keys of their own, one per sending side */
+    memcpy ( label, "NTD1", 4 );
+    memcpy ( label + 4, tx.s.iv, sizeof ( tx.s.iv ) );
+
+    if ( ( ret =
+            hmac_sha256 ( aeskey, sizeof ( aeskey ), label, sizeof ( label ),
+                context->session.direct.tx_key ) ) != 0 )
+    {
+        nettalk_errcode ( context, "direct path key derivation failed", ret );
+        memset ( aeskey, '\0', sizeof ( aeskey ) );
+        return -1;
+    }
+
+    memcpy ( label + 4, rx.s.iv, sizeof ( rx.s.iv ) );
+
+    if ( ( ret =
+            hmac_sha256 ( aeskey, sizeof ( aeskey ), label, sizeof ( label ),
+                context->session.direct.rx_key ) ) != 0 )
+    {
+        nettalk_errcode ( context, "direct path key derivation failed", ret );
+        memset ( aeskey, '\0', sizeof ( aeskey ) );
+        return -1;
+    }
+
     mbedtls_aes_init ( &context->session.tx_aes );
     mbedtls_aes_init ( &context->session.rx_aes );
 
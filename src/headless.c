@@ -0,0 +1,538 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Headless Daemon Mode
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+/**
+ * Headless mode contact
+ */
+struct headless_contact_t
+{
+    const char *name;
+    struct nettalk_context_t *context;
+};
+
+/**
+ * Headless mode contacts list
+ */
+struct headless_t
+{
+    struct audio_mixer_t *mixer;
+    size_t ncontacts;
+    struct headless_contact_t contacts[NETTALK_CONTACTS_MAX];
+};
+
+/**
+ * Print single line event to stdout
+ */
+static void headless_print ( const struct headless_contact_t *contact, const char *event,
+    const char *message, size_t len )
+{
+    size_t i;
+
+    /* Tag events with contact name if there are many */
+    if ( contact && contact->name )
+    {
+        printf ( "%s@%s ", event, contact->name );
+
+    } else
+    {
+        printf ( "%s ", event );
+    }
+
+    /* Keep one event per line */
+    for ( i = 0; i < len; i++ )
+    {
+        putchar ( message[i] == '\n' || message[i] == '\r' ? ' ' : message[i] );
+    }
+
+    putchar ( '\n' );
+    fflush ( stdout );
+}
+
+/**
+ * Text message callback
+ */
+static void headless_on_text ( void *user, int self, const char *message, size_t len )
+{
+    headless_print ( ( struct headless_contact_t * ) user, self ? "self" : "peer", message,
+        len );
+}
+
+/**
+ * Session status callback
+ */
+static void headless_on_status ( void *user, int online )
+{
+    const char *message;
+
+    message = online ? "online" : "offline";
+    headless_print ( ( struct headless_contact_t * ) user, "status", message,
+        strlen ( message ) );
+}
+
+/**
+ * Log message callback
+ */
+static void headless_on_log ( void *user, int event, const char *message, size_t len )
+{
+    struct headless_contact_t *contact = ( struct headless_contact_t * ) user;
+
+    switch ( event )
+    {
+    case LIBNETTALK_LOG_SUCCESS:
+        headless_print ( contact, "success", message, len );
+        break;
+    case LIBNETTALK_LOG_ERROR:
+        headless_print ( contact, "error", message, len );
+        break;
+    default:
+        headless_print ( contact, "info", message, len );
+    }
+}
+
+/**
+ * Headless mode event callbacks
+ */
+static const struct libnettalk_callbacks_t headless_callbacks = {
+    headless_on_text,
+    headless_on_status,
+    headless_on_log,
+    NULL
+};
+
+/**
+ * Read password line from stdin
+ */
+static int headless_read_password ( char *password, size_t size )
+{
+    char c;
+    size_t len = 0;
+
+    while ( read ( 0, &c, sizeof ( c ) ) > 0 )
+    {
+        if ( c == '\n' )
+        {
+            password[len] = '\0';
+            return 0;
+        }
+
+        if ( len + 1 >= size )
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        password[len++] = c;
+    }
+
+    errno = EPIPE;
+    return -1;
+}
+
+/**
+ * Get contact name from config path
+ */
+static const char *headless_contact_name ( const char *path )
+{
+    const char *ptr;
+
+    if ( ( ptr = strrchr ( path, '/' ) ) )
+    {
+        return ptr + 1;
+    }
+
+    return path;
+}
+
+/**
+ * Print process and per contact statistics
+ */
+static void headless_print_stats ( struct headless_t *headless )
+{
+    size_t i;
+    int slot;
+    long pages = 0;
+    FILE *file;
+    unsigned long long frames;
+    unsigned long long out_frames;
+    unsigned long long cost_us = 0;
+    unsigned long long ncosts = 0;
+    struct nettalk_context_t *context;
+    struct audio_mixer_slot_t *participant;
+    char message[BUFSIZE];
+
+    /* Get resident set size of whole process */
+    if ( ( file = fopen ( "/proc/self/statm", "r" ) ) )
+    {
+        if ( fscanf ( file, "%*d %ld", &pages ) != 1 )
+        {
+            pages = 0;
+        }
+        fclose ( file );
+    }
+
+    snprintf ( message, sizeof ( message ), "contacts=%lu rss_kb=%ld",
+        ( unsigned long ) headless->ncontacts, pages * ( sysconf ( _SC_PAGESIZE ) / 1024 ) );
+    headless_print ( NULL, "stats", message, strlen ( message ) );
+
+    for ( i = 0; i < headless->ncontacts; i++ )
+    {
+        context = headless->contacts[i].context;
+        snprintf ( message, sizeof ( message ), "online=%i wakeups=%llu tx_packets=%llu",
+            context->online, __atomic_load_n ( &context->stats.wakeups, __ATOMIC_RELAXED ),
+            __atomic_load_n ( &context->stats.tx_packets, __ATOMIC_RELAXED ) );
+        headless_print ( &headless->contacts[i], "stats", message, strlen ( message ) );
+
+        if ( !headless->mixer || ( slot = context->mixer_slot ) < 0 )
+        {
+            continue;
+        }
+
+        /* Report decode, mix and encode CPU cost per second of participant audio */
+        participant = &headless->mixer->slots[slot];
+        pthread_mutex_lock ( &headless->mixer->mutex );
+        frames = participant->frames ? participant->frames : 1;
+        out_frames = participant->out_frames ? participant->out_frames : 1;
+        snprintf ( message, sizeof ( message ),
+            "decode_us_per_s=%llu mix_us_per_s=%llu encode_us_per_s=%llu",
+            participant->decode_ns * AUDIO_MIXER_RATE / frames / 1000,
+            participant->mix_ns * AUDIO_MIXER_RATE / frames / 1000,
+            participant->encode_ns * AUDIO_MIXER_RATE / out_frames / 1000 );
+        cost_us += ( participant->decode_ns + participant->mix_ns ) * AUDIO_MIXER_RATE / frames
+            / 1000 + participant->encode_ns * AUDIO_MIXER_RATE / out_frames / 1000;
+        ncosts++;
+        pthread_mutex_unlock ( &headless->mixer->mutex );
+        headless_print ( &headless->contacts[i], "stats", message, strlen ( message ) );
+    }
+
+    /* Estimate how many participants one core could serve as conference host */
+    if ( headless->mixer && headless->mixer->mcu && cost_us )
+    {
+        snprintf ( message, sizeof ( message ), "mcu_participants_per_core=%llu",
+            ncosts * 1000000ULL / cost_us );
+        headless_print ( NULL, "stats", message, strlen ( message ) );
+    }
+}
+
+/**
+ * Find contact addressed by command line
+ */
+static struct headless_contact_t *headless_find_contact ( struct headless_t *headless,
+    const char **line )
+{
+    size_t i;
+    size_t len;
+    const char *name;
+
+    /* Lines without @name prefix go to first contact */
+    if ( **line != '@' )
+    {
+        return headless->contacts;
+    }
+
+    for ( i = 0; i < headless->ncontacts; i++ )
+    {
+        if ( !( name = headless->contacts[i].name ) )
+        {
+            continue;
+        }
+
+        len = strlen ( name );
+
+        if ( !strncmp ( *line + 1, name, len ) && ( *line )[len + 1] == ' ' )
+        {
+            *line += len + 2;
+            return &headless->contacts[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Handle single command line from stdin
+ */
+static int headless_command ( struct headless_t *headless, const char *line )
+{
+    int status;
+    const char *message;
+    struct headless_contact_t *contact;
+
+    if ( !strcmp ( line, "/quit" ) )
+    {
+        return -1;
+
+    } else if ( !strcmp ( line, "/stats" ) )
+    {
+        headless_print_stats ( headless );
+        return 0;
+    }
+
+    if ( !( contact = headless_find_contact ( headless, &line ) ) )
+    {
+        message = "unknown contact";
+        headless_print ( NULL, "error", message, strlen ( message ) );
+        return 0;
+    }
+
+    if ( !strncmp ( line, "/mic ", 5 ) )
+    {
+        libnettalk_set_capture ( contact->context, !strcmp ( line + 5, "on" ) );
+
+    } else if ( !strncmp ( line, "/speaker ", 9 ) )
+    {
+        libnettalk_set_playback ( contact->context, !strcmp ( line + 9, "on" ) );
+
+    } else if ( !strcmp ( line, "/reconnect" ) )
+    {
+        libnettalk_reconnect ( contact->context );
+
+    } else if ( *line )
+    {
+        if ( ( status = libnettalk_send_text ( contact->context, line ) ) < 0 )
+        {
+            message = "message not sent";
+            headless_print ( contact, "error", message, strlen ( message ) );
+
+        } else if ( status > 0 )
+        {
+            message = "message queued until peer is online";
+            headless_print ( contact, "info", message, strlen ( message ) );
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Read commands from stdin
+ */
+static int headless_read_commands ( struct headless_t *headless,
+    struct nettalk_msgbuf_t *cmdbuf )
+{
+    ssize_t i;
+    ssize_t len;
+    char buffer[1024];
+
+    if ( ( len = read ( 0, buffer, sizeof ( buffer ) ) ) <= 0 )
+    {
+        return -1;
+    }
+
+    for ( i = 0; i < len; i++ )
+    {
+        if ( buffer[i] == '\n' )
+        {
+            cmdbuf->array[cmdbuf->len] = '\0';
+            cmdbuf->len = 0;
+
+            if ( headless_command ( headless, cmdbuf->array ) < 0 )
+            {
+                return -1;
+            }
+
+        } else if ( cmdbuf->len + 1 < sizeof ( cmdbuf->array ) )
+        {
+            cmdbuf->array[cmdbuf->len++] = buffer[i];
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Start contact session with password from stdin
+ */
+static int headless_start ( struct headless_contact_t *contact )
+{
+    int status;
+    char password[BUFSIZE];
+
+    libnettalk_set_callbacks ( contact->context, &headless_callbacks, contact );
+    libnettalk_set_verbose ( contact->context, TRUE );
+
+    /* Decrypt config with password from next stdin line */
+    if ( headless_read_password ( password, sizeof ( password ) ) < 0 )
+    {
+        fprintf ( stderr, "Error: Password not provided.\n" );
+        return -1;
+    }
+
+    status = libnettalk_start ( contact->context, password );
+    memset ( password, '\0', sizeof ( password ) );
+
+    if ( status < 0 )
+    {
+        fprintf ( stderr, "Error: Failed to start session.\n" );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop contacts sessions
+ */
+static void headless_free ( struct headless_t *headless )
+{
+    size_t i;
+
+    /* First contact context is freed by caller */
+    for ( i = 0; i < headless->ncontacts; i++ )
+    {
+        if ( i )
+        {
+            libnettalk_free ( headless->contacts[i].context );
+
+        } else
+        {
+            nettask_stop ( headless->contacts[i].context );
+        }
+    }
+
+    if ( headless->mixer )
+    {
+        audio_mixer_stop ( headless->mixer );
+        free ( headless->mixer );
+    }
+}
+
+/**
+ * Run application without user interface
+ */
+int headless_init ( struct nettalk_context_t *context, char *const *confpaths,
+    size_t nconfpaths )
+{
+    int status = 0;
+    size_t i;
+    size_t nfds;
+    struct headless_t headless;
+    struct nettalk_msgbuf_t cmdbuf;
+    struct pollfd fds[1 + NETTALK_CONTACTS_MAX * LIBNETTALK_NPOLLFDS];
+
+    if ( nconfpaths > NETTALK_CONTACTS_MAX )
+    {
+        fprintf ( stderr, "Error: Too many contacts.\n" );
+        return -1;
+    }
+
+    cmdbuf.len = 0;
+    headless.ncontacts = 0;
+    headless.mixer = NULL;
+
+    /* All contacts share one mixer and speaker in group call */
+    if ( context->group )
+    {
+        if ( !( headless.mixer =
+                ( struct audio_mixer_t * ) calloc ( 1, sizeof ( struct audio_mixer_t ) ) ) )
+        {
+            return -1;
+        }
+
+        headless.mixer->mcu = context->mcu;
+
+        if ( audio_mixer_launch ( context, headless.mixer ) < 0 )
+        {
+            free ( headless.mixer );
+            return -1;
+        }
+    }
+
+    /* First contact reuses application context */
+    for ( i = 0; i < nconfpaths; i++ )
+    {
+        headless.contacts[i].name =
+            nconfpaths > 1 ? headless_contact_name ( confpaths[i] ) : NULL;
+
+        if ( !i )
+        {
+            headless.contacts[i].context = context;
+
+        } else if ( !( headless.contacts[i].context = libnettalk_new ( confpaths[i] ) ) )
+        {
+            fprintf ( stderr, "Error: Initialization failed.\n" );
+            headless_free ( &headless );
+            return -1;
+        }
+
+        headless.ncontacts++;
+
+        /* Other contacts follow proxy, discovery, direct path and sound access options */
+        if ( i )
+        {
+            headless.contacts[i].context->socks5_enabled = context->socks5_enabled;
+            headless.contacts[i].context->socks5_addr = context->socks5_addr;
+            headless.contacts[i].context->socks5_port = context->socks5_port;
+            headless.contacts[i].context->lan_enabled = context->lan_enabled;
+            headless.contacts[i].context->direct_enabled = context->direct_enabled;
+            headless.contacts[i].context->stun_addr = context->stun_addr;
+            headless.contacts[i].context->stun_port = context->stun_port;
+            headless.contacts[i].context->alsa_rw = context->alsa_rw;
+            headless.contacts[i].context->audio_float = context->audio_float;
+            headless.contacts[i].context->no_dtx = context->no_dtx;
+            headless.contacts[i].context->codec = context->codec;
+            headless.contacts[i].context->audio_rate = context->audio_rate;
+            headless.contacts[i].context->resampler = context->resampler;
+            headless.contacts[i].context->resampler_double = context->resampler_double;
+        }
+
+        if ( headless.mixer )
+        {
+            headless.contacts[i].context->mixer = headless.mixer;
+            libnettalk_set_playback ( headless.contacts[i].context, TRUE );
+
+            /* Conference host sends each contact mix of the others */
+            if ( headless.mixer->mcu )
+            {
+                libnettalk_set_capture ( headless.contacts[i].context, TRUE );
+            }
+        }
+
+        if ( headless_start ( &headless.contacts[i] ) < 0 )
+        {
+            headless_free ( &headless );
+            return -1;
+        }
+    }
+
+    fds[0].fd = 0;
+    fds[0].events = POLLIN;
+    nfds = 1;
+
+    for ( i = 0; i < headless.ncontacts; i++ )
+    {
+        nfds +=
+            libnettalk_get_pollfds ( headless.contacts[i].context, fds + nfds,
+            LIBNETTALK_NPOLLFDS );
+    }
+
+    for ( ;; )
+    {
+        if ( poll ( fds, nfds, 100 ) < 0 && errno != EINTR )
+        {
+            status = -1;
+            break;
+        }
+
+        /* Stop on end of input or quit command */
+        if ( fds[0].revents & ( POLLIN | POLLHUP ) )
+        {
+            if ( headless_read_commands ( &headless, &cmdbuf ) < 0 )
+            {
+                break;
+            }
+        }
+
+        for ( i = 0; i < headless.ncontacts; i++ )
+        {
+            libnettalk_dispatch ( headless.contacts[i].context, 0 );
+        }
+    }
+
+    headless_free ( &headless );
+
+    return status;
+}
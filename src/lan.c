@@ -0,0 +1,324 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Local Network Discovery
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+
+#define LAN_MAGIC "NTL1"
+#define LAN_ANNOUNCE_LEN ( 4 + SHA256_BLOCKLEN + 8 + 2 )
+
+/**
+ * Get monotonic time in milliseconds
+ */
+static long long lan_millis ( void )
+{
+    return nettalk_stats_micros (  ) / 1000;
+}
+
+/**
+ * Open local network discovery sockets
+ */
+int nettalk_lan_open ( struct nettalk_context_t *context )
+{
+    int reuse = 1;
+    socklen_t slen;
+    struct ip_mreq mreq;
+    struct sockaddr_in saddr;
+    struct nettalk_lan_t *lan = &context->lan;
+
+    lan->msock = -1;
+    lan->lsock = -1;
+    lan->peer_addr = 0;
+    lan->announced = 0;
+
+    /* Announcements carry only hash of channel id */
+    if ( mbedtls_md ( mbedtls_md_info_from_type ( MBEDTLS_MD_SHA256 ),
+            ( const unsigned char * ) context->config.channel, strlen ( context->config.channel ),
+            lan->hash ) != 0 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( nettalk_random_bytes ( &context->random, lan->nonce, sizeof ( lan->nonce ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Listen for connection from peer */
+    if ( ( lan->lsock = socket ( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    memset ( &saddr, '\0', sizeof ( saddr ) );
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = INADDR_ANY;
+    slen = sizeof ( saddr );
+
+    if ( bind ( lan->lsock, ( struct sockaddr * ) &saddr, sizeof ( saddr ) ) < 0
+        || listen ( lan->lsock, 1 ) < 0
+        || getsockname ( lan->lsock, ( struct sockaddr * ) &saddr, &slen ) < 0
+        || socket_set_nonblocking ( lan->lsock ) < 0 )
+    {
+        nettalk_lan_close ( context );
+        return -1;
+    }
+
+    lan->port = saddr.sin_port;
+
+    /* Join discovery multicast group */
+    if ( ( lan->msock = socket ( AF_INET, SOCK_DGRAM, 0 ) ) < 0 )
+    {
+        nettalk_lan_close ( context );
+        return -1;
+    }
+
+    if ( setsockopt ( lan->msock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof ( reuse ) ) < 0 )
+    {
+        nettalk_lan_close ( context );
+        return -1;
+    }
+
+    saddr.sin_addr.s_addr = INADDR_ANY;
+    saddr.sin_port = htons ( NETTALK_LAN_PORT );
+
+    if ( bind ( lan->msock, ( struct sockaddr * ) &saddr, sizeof ( saddr ) ) < 0 )
+    {
+        nettalk_lan_close ( context );
+        return -1;
+    }
+
+    memset ( &mreq, '\0', sizeof ( mreq ) );
+    inet_pton ( AF_INET, NETTALK_LAN_GROUP, &mreq.imr_multiaddr );
+    mreq.imr_interface.s_addr = INADDR_ANY;
+
+    if ( setsockopt ( lan->msock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof ( mreq ) ) < 0 )
+    {
+        nettalk_lan_close ( context );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Announce channel hash on local network
+ */
+static void lan_announce ( struct nettalk_context_t *context, long long now )
+{
+    struct sockaddr_in saddr;
+    uint8_t packet[LAN_ANNOUNCE_LEN];
+    struct nettalk_lan_t *lan = &context->lan;
+
+    lan->announced = now;
+
+    memcpy ( packet, LAN_MAGIC, 4 );
+    memcpy ( packet + 4, lan->hash, SHA256_BLOCKLEN );
+    memcpy ( packet + 4 + SHA256_BLOCKLEN, lan->nonce, sizeof ( lan->nonce ) );
+    memcpy ( packet + 4 + SHA256_BLOCKLEN + 8, &lan->port, sizeof ( lan->port ) );
+
+    memset ( &saddr, '\0', sizeof ( saddr ) );
+    saddr.sin_family = AF_INET;
+    saddr.sin_port = htons ( NETTALK_LAN_PORT );
+    inet_pton ( AF_INET, NETTALK_LAN_GROUP, &saddr.sin_addr );
+
+    if ( sendto ( lan->msock, packet, sizeof ( packet ), MSG_DONTWAIT,
+            ( struct sockaddr * ) &saddr, sizeof ( saddr ) ) < 0 )
+    {
+    }
+}
+
+/**
+ * Receive announcement from local network
+ */
+static void lan_receive ( struct nettalk_context_t *context )
+{
+    socklen_t slen;
+    struct sockaddr_in saddr;
+    uint8_t packet[LAN_ANNOUNCE_LEN + 1];
+    struct nettalk_lan_t *lan = &context->lan;
+
+    slen = sizeof ( saddr );
+
+    if ( recvfrom ( lan->msock, packet, sizeof ( packet ), MSG_DONTWAIT,
+            ( struct sockaddr * ) &saddr, &slen ) != LAN_ANNOUNCE_LEN )
+    {
+        return;
+    }
+
+    /* Skip other channels and own announcements */
+    if ( memcmp ( packet, LAN_MAGIC, 4 ) || memcmp ( packet + 4, lan->hash, SHA256_BLOCKLEN )
+        || !memcmp ( packet + 4 + SHA256_BLOCKLEN, lan->nonce, sizeof ( lan->nonce ) ) )
+    {
+        return;
+    }
+
+    if ( !lan->peer_addr )
+    {
+        nettalk_info ( context, "remote peer announced on local network" );
+    }
+
+    /* Lower nonce dials, higher one accepts */
+    lan->peer_addr = saddr.sin_addr.s_addr;
+    memcpy ( &lan->peer_port, packet + 4 + SHA256_BLOCKLEN + 8, sizeof ( lan->peer_port ) );
+    lan->dial = memcmp ( lan->nonce, packet + 4 + SHA256_BLOCKLEN, sizeof ( lan->nonce ) ) < 0;
+}
+
+/**
+ * Connect with peer found on local network
+ */
+static int lan_dial ( struct nettalk_context_t *context )
+{
+    int sock;
+    struct sockaddr_in saddr;
+    struct nettalk_lan_t *lan = &context->lan;
+
+    /* Make sure peer knows our address before it accepts */
+    lan_announce ( context, lan_millis (  ) );
+
+    memset ( &saddr, '\0', sizeof ( saddr ) );
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = lan->peer_addr;
+    saddr.sin_port = lan->peer_port;
+
+    if ( ( sock = socket ( AF_INET, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( connect_timeout ( sock, ( struct sockaddr * ) &saddr, sizeof ( saddr ),
+            NETTALK_LAN_TIMEOUT ) < 0 )
+    {
+        nettalk_errcode ( context, "failed to connect local peer", errno );
+        shutdown_then_close ( sock );
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * Accept connection from peer found on local network
+ */
+static int lan_accept ( struct nettalk_context_t *context )
+{
+    int sock;
+    socklen_t slen;
+    struct sockaddr_in saddr;
+    struct nettalk_lan_t *lan = &context->lan;
+
+    slen = sizeof ( saddr );
+
+    if ( ( sock = accept ( lan->lsock, ( struct sockaddr * ) &saddr, &slen ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Only host which announced our channel may connect */
+    if ( !lan->peer_addr || saddr.sin_addr.s_addr != lan->peer_addr
+        || socket_set_nonblocking ( sock ) < 0 )
+    {
+        shutdown_then_close ( sock );
+        return -1;
+    }
+
+    return sock;
+}
+
+/**
+ * Look for peer on local network
+ */
+int nettalk_lan_poll ( struct nettalk_context_t *context, int extrafd, int timeout )
+{
+    int sock;
+    int wait;
+    long long now;
+    long long deadline;
+    struct pollfd fds[4];
+    struct nettalk_lan_t *lan = &context->lan;
+
+    deadline = lan_millis (  ) + timeout;
+
+    while ( ( now = lan_millis (  ) ) < deadline )
+    {
+        if ( now >= lan->announced + NETTALK_LAN_INTERVAL )
+        {
+            lan_announce ( context, now );
+        }
+
+        if ( lan->peer_addr && lan->dial )
+        {
+            if ( ( sock = lan_dial ( context ) ) >= 0 )
+            {
+                return sock;
+            }
+            lan->peer_addr = 0;
+        }
+
+        fds[0].fd = lan->msock;
+        fds[0].events = POLLIN;
+        fds[1].fd = lan->lsock;
+        fds[1].events = POLLIN;
+        fds[2].fd = context->reset_pipe.u.s.readfd;
+        fds[2].events = POLLIN;
+        fds[3].fd = extrafd;
+        fds[3].events = POLLIN;
+
+        if ( ( wait = lan->announced + NETTALK_LAN_INTERVAL - now ) > deadline - now )
+        {
+            wait = deadline - now;
+        }
+
+        if ( poll ( fds, sizeof ( fds ) / sizeof ( struct pollfd ), wait ) < 0 && errno != EINTR )
+        {
+            return -1;
+        }
+
+        /* Check for reset event */
+        if ( fds[2].revents )
+        {
+            errno = EINTR;
+            return -1;
+        }
+
+        /* Let caller handle its own socket */
+        if ( fds[3].revents )
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        /* Announcement is handled first, so that dialing peer is known */
+        if ( fds[0].revents & POLLIN )
+        {
+            lan_receive ( context );
+        }
+
+        if ( ( fds[1].revents & POLLIN ) && ( sock = lan_accept ( context ) ) >= 0 )
+        {
+            return sock;
+        }
+    }
+
+    errno = ETIMEDOUT;
+    return -1;
+}
+
+/**
+ * Close local network discovery sockets
+ */
+void nettalk_lan_close ( struct nettalk_context_t *context )
+{
+    if ( context->lan.msock >= 0 )
+    {
+        close ( context->lan.msock );
+        context->lan.msock = -1;
+    }
+
+    if ( context->lan.lsock >= 0 )
+    {
+        close ( context->lan.lsock );
+        context->lan.lsock = -1;
+    }
+}
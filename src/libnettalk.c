@@ -0,0 +1,360 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Embeddable Library
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+
+/**
+ * Initialize application context
+ */
+int nettalk_context_init ( struct nettalk_context_t *context )
+{
+    context->nmessages = 0;
+    context->online = FALSE;
+    context->playback_status = FALSE;
+    context->playback_status_timestamp.tv_sec = 0;
+    context->playback_status_timestamp.tv_usec = 0;
+    context->capture_status = FALSE;
+    context->capture_status_timestamp.tv_sec = 0;
+    context->capture_status_timestamp.tv_usec = 0;
+    context->playback_preset = FALSE;
+    context->playback_preset_timestamp.tv_sec = 0;
+    context->playback_preset_timestamp.tv_usec = 0;
+    context->capture_preset = FALSE;
+    context->capture_preset_timestamp.tv_sec = 0;
+    context->capture_preset_timestamp.tv_usec = 0;
+
+    context->bridge.u.s.local = -1;
+    context->bridge.u.s.remote = -1;
+    context->reset_pipe.u.s.readfd = -1;
+    context->reset_pipe.u.s.writefd = -1;
+    context->notpid = -1;
+    context->notexp = 0;
+    context->notif = NULL;
+    context->callbacks = NULL;
+    context->user = NULL;
+    context->running = FALSE;
+    context->stopping = FALSE;
+    context->user_reconnect = FALSE;
+    context->reported_online = FALSE;
+    context->mixer = NULL;
+    context->mixer_slot = -1;
+    context->session.direct.sock = -1;
+    context->session.direct.state = NETTALK_DIRECT_OFF;
+    context->lan.msock = -1;
+    context->lan.lsock = -1;
+
+    if ( pipe_new_nonblocking ( &context->reset_pipe ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( socket_set_nonblocking ( context->reset_pipe.u.s.readfd ) < 0 )
+    {
+        pipe_close ( &context->reset_pipe );
+        return -1;
+    }
+
+    if ( pipe_new_nonblocking ( &context->msgin ) < 0 )
+    {
+        pipe_close ( &context->reset_pipe );
+        return -1;
+    }
+
+    if ( pipe_new_nonblocking ( &context->msgout ) < 0 )
+    {
+        pipe_close ( &context->reset_pipe );
+        pipe_close ( &context->msgin );
+        return -1;
+    }
+
+    if ( pipe_new_nonblocking ( &context->msgloop ) < 0 )
+    {
+        pipe_close ( &context->reset_pipe );
+        pipe_close ( &context->msgin );
+        pipe_close ( &context->msgout );
+        return -1;
+    }
+
+    if ( pipe_new_nonblocking ( &context->applog ) < 0 )
+    {
+        pipe_close ( &context->reset_pipe );
+        pipe_close ( &context->msgin );
+        pipe_close ( &context->msgout );
+        pipe_close ( &context->msgloop );
+        return -1;
+    }
+
+    if ( nettalk_random_init ( &context->random ) < 0 )
+    {
+        pipe_close ( &context->reset_pipe );
+        pipe_close ( &context->msgin );
+        pipe_close ( &context->msgout );
+        pipe_close ( &context->msgloop );
+        pipe_close ( &context->applog );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Uninitialize application context
+ */
+void nettalk_context_free ( struct nettalk_context_t *context )
+{
+    pipe_close ( &context->reset_pipe );
+    pipe_close ( &context->msgin );
+    pipe_close ( &context->msgout );
+    pipe_close ( &context->msgloop );
+    pipe_close ( &context->applog );
+    nettalk_random_free ( &context->random );
+    mbedtls_pk_free ( &context->config.self_rsa_priv_key );
+    mbedtls_pk_free ( &context->config.self_rsa_pub_key );
+    mbedtls_pk_free ( &context->config.peer_rsa_pub_key );
+}
+
+/**
+ * Allocate new session context for config file
+ */
+struct nettalk_context_t *libnettalk_new ( const char *confpath )
+{
+    struct nettalk_context_t *context;
+
+    if ( !( context =
+            ( struct nettalk_context_t * ) calloc ( 1, sizeof ( struct nettalk_context_t ) ) ) )
+    {
+        return NULL;
+    }
+
+    if ( nettalk_context_init ( context ) < 0 )
+    {
+        free ( context );
+        return NULL;
+    }
+
+    context->confpath = confpath;
+
+    return context;
+}
+
+/**
+ * Set session event callbacks
+ */
+void libnettalk_set_callbacks ( struct nettalk_context_t *context,
+    const struct libnettalk_callbacks_t *callbacks, void *user )
+{
+    context->callbacks = callbacks;
+    context->user = user;
+}
+
+/**
+ * Enable or disable log events
+ */
+void libnettalk_set_verbose ( struct nettalk_context_t *context, int enabled )
+{
+    context->verbose = enabled;
+}
+
+/**
+ * Enable or disable microphone
+ */
+void libnettalk_set_capture ( struct nettalk_context_t *context, int enabled )
+{
+    context->capture_status = enabled;
+    gettimeofdayv ( &context->capture_status_timestamp );
+}
+
+/**
+ * Enable or disable speaker
+ */
+void libnettalk_set_playback ( struct nettalk_context_t *context, int enabled )
+{
+    context->playback_status = enabled;
+    gettimeofdayv ( &context->playback_status_timestamp );
+}
+
+/**
+ * Decrypt config and start session networking task
+ */
+int libnettalk_start ( struct nettalk_context_t *context, const char *password )
+{
+    if ( context->running )
+    {
+        errno = EALREADY;
+        return -1;
+    }
+
+    if ( load_config ( context, context->confpath, password ) < 0 )
+    {
+        return -1;
+    }
+
+    nettalk_success ( context, "loaded config from file" );
+
+    context->bufin.len = 0;
+    context->bufloop.len = 0;
+    context->buflog.len = 0;
+    context->outbox.len = 0;
+
+    if ( nettask_launch ( context ) < 0 )
+    {
+        return -1;
+    }
+
+    context->running = TRUE;
+    context->complete = TRUE;
+
+    return 0;
+}
+
+/**
+ * Get descriptors to wait for before dispatching events
+ */
+size_t libnettalk_get_pollfds ( struct nettalk_context_t *context, struct pollfd *fds,
+    size_t nfds )
+{
+    if ( nfds < LIBNETTALK_NPOLLFDS )
+    {
+        return 0;
+    }
+
+    fds[0].fd = context->msgin.u.s.readfd;
+    fds[1].fd = context->msgloop.u.s.readfd;
+    fds[2].fd = context->applog.u.s.readfd;
+    fds[0].events = POLLIN;
+    fds[1].events = POLLIN;
+    fds[2].events = POLLIN;
+
+    return LIBNETTALK_NPOLLFDS;
+}
+
+/**
+ * Pass complete message to callbacks
+ */
+static void dispatch_message ( struct nettalk_context_t *context, int type,
+    struct nettalk_msgbuf_t *msgbuf )
+{
+    const struct libnettalk_callbacks_t *callbacks = context->callbacks;
+
+    if ( !callbacks )
+    {
+        return;
+    }
+
+    msgbuf->array[msgbuf->len] = '\0';
+
+    switch ( type )
+    {
+    case MESSAGE_TYPE_PEER:
+    case MESSAGE_TYPE_SELF:
+        if ( callbacks->on_text )
+        {
+            callbacks->on_text ( context->user, type == MESSAGE_TYPE_SELF, msgbuf->array,
+                msgbuf->len );
+        }
+        break;
+    default:
+        if ( callbacks->on_log && msgbuf->len )
+        {
+            callbacks->on_log ( context->user, msgbuf->array[0], msgbuf->array + 1,
+                msgbuf->len - 1 );
+        }
+    }
+}
+
+/**
+ * Dispatch messages from pipe
+ */
+static void dispatch_pipe ( struct nettalk_context_t *context, int type, int fd,
+    struct nettalk_msgbuf_t *msgbuf )
+{
+    char c;
+
+    for ( ;; )
+    {
+        if ( read ( fd, &c, sizeof ( c ) ) <= 0 )
+        {
+            break;
+        }
+
+        if ( c == '\a' || msgbuf->len + 1 >= sizeof ( msgbuf->array ) )
+        {
+            dispatch_message ( context, type, msgbuf );
+            msgbuf->len = 0;
+        }
+
+        if ( c && c != '\a' )
+        {
+            msgbuf->array[msgbuf->len++] = c;
+        }
+    }
+}
+
+/**
+ * Dispatch pending events to callbacks, waiting at most timeout milliseconds
+ */
+int libnettalk_dispatch ( struct nettalk_context_t *context, int timeout )
+{
+    int online;
+    struct pollfd fds[LIBNETTALK_NPOLLFDS];
+
+    if ( timeout )
+    {
+        libnettalk_get_pollfds ( context, fds, LIBNETTALK_NPOLLFDS );
+
+        if ( poll ( fds, LIBNETTALK_NPOLLFDS, timeout ) < 0 && errno != EINTR )
+        {
+            return -1;
+        }
+    }
+
+    dispatch_pipe ( context, MESSAGE_TYPE_PEER, context->msgin.u.s.readfd, &context->bufin );
+    dispatch_pipe ( context, MESSAGE_TYPE_SELF, context->msgloop.u.s.readfd, &context->bufloop );
+    dispatch_pipe ( context, MESSAGE_TYPE_LOG, context->applog.u.s.readfd, &context->buflog );
+
+    online = context->online;
+
+    if ( context->reported_online != online )
+    {
+        context->reported_online = online;
+
+        if ( context->callbacks && context->callbacks->on_status )
+        {
+            context->callbacks->on_status ( context->user, online );
+        }
+    }
+
+    if ( online )
+    {
+        outbox_flush ( context );
+    }
+
+    return 0;
+}
+
+/**
+ * Send text message to peer, returns 1 if message was queued until peer is online
+ */
+int libnettalk_send_text ( struct nettalk_context_t *context, const char *message )
+{
+    return outbox_send_message ( context, message );
+}
+
+/**
+ * Drop current session and connect again
+ */
+void libnettalk_reconnect ( struct nettalk_context_t *context )
+{
+    user_reconnect_session ( context );
+}
+
+/**
+ * Stop session and free its context
+ */
+void libnettalk_free ( struct nettalk_context_t *context )
+{
+    nettask_stop ( context );
+    nettalk_context_free ( context );
+    secure_free_mem ( context, sizeof ( struct nettalk_context_t ) );
+}
@@ -0,0 +1,1036 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Relay Load Generator
+ * ------------------------------------------------------------------ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "rendezvous.h"
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+#define CHANLEN 16
+#define BUSY_BYTE '#'
+#define RELAYS_MAX 8
+#define LOADGEN_CHUNK_LEN 32
+#define LOADGEN_VOICE_PERIOD_MS 20
+#define LOADGEN_OUTBUF_LEN 16384
+#define LOADGEN_INBUF_LEN 4096
+#define LOADGEN_HIST_NBUCKETS 1024
+#define LOADGEN_MAGIC 0x4e544c47
+
+/**
+ * Simulated chunk types
+ */
+enum
+{
+    LOADGEN_CHUNK_VOICE = 'v',
+    LOADGEN_CHUNK_TEXT = 't'
+};
+
+/**
+ * Simulated client states
+ */
+enum
+{
+    LOADGEN_STATE_CLOSED = 0,
+    LOADGEN_STATE_CONNECTING,
+    LOADGEN_STATE_WAITING,
+    LOADGEN_STATE_PAIRED
+};
+
+/**
+ * Simulated chunk layout, padded to AMR-NB chunk size
+ */
+struct loadgen_chunk_t
+{
+    uint32_t magic;
+    uint32_t type;
+    uint32_t seq;
+    uint32_t reserved;
+    int64_t timestamp;
+    uint8_t padding[LOADGEN_CHUNK_LEN - 24];
+};
+
+/**
+ * Latency histogram with log-linear buckets
+ */
+struct loadgen_hist_t
+{
+    unsigned long long count;
+    unsigned long long max;
+    unsigned long long buckets[LOADGEN_HIST_NBUCKETS];
+};
+
+struct loadgen_pair_t;
+
+/**
+ * Simulated client
+ */
+struct loadgen_client_t
+{
+    int sock;
+    int state;
+    int pollout;
+    struct loadgen_pair_t *pair;
+    long long sent_us;
+    long long paired_us;
+    uint32_t seq;
+    size_t in_len;
+    uint8_t in[LOADGEN_INBUF_LEN];
+    size_t out_len;
+    uint8_t out[LOADGEN_OUTBUF_LEN];
+};
+
+/**
+ * Relay server address
+ */
+struct loadgen_relay_t
+{
+    char hostname[32];
+    unsigned short port;
+    struct sockaddr_in saddr;
+};
+
+/**
+ * Simulated client pair sharing one channel
+ */
+struct loadgen_pair_t
+{
+    int active;
+    size_t relay;
+    char channel[CHANLEN + 1];
+    long long born_us;
+    long long next_text_us;
+    struct loadgen_client_t peers[2];
+};
+
+/**
+ * Load generator settings
+ */
+struct loadgen_settings_t
+{
+    size_t nrelays;
+    struct loadgen_relay_t relays[RELAYS_MAX];
+    size_t npairs;
+    double connect_rate;
+    unsigned int duration;
+    unsigned int lifetime;
+    unsigned int text_interval;
+    unsigned int text_burst;
+};
+
+/**
+ * Load generator statistics
+ */
+struct loadgen_stats_t
+{
+    unsigned long long connects;
+    unsigned long long failures;
+    unsigned long long refusals;
+    unsigned long long pairings;
+    unsigned long long churned;
+    unsigned long long drops;
+    unsigned long long tx_bytes;
+    unsigned long long rx_bytes;
+    unsigned long long rx_chunks;
+    struct loadgen_hist_t pairing;
+    struct loadgen_hist_t forward;
+};
+
+/**
+ * Load generator context
+ */
+struct loadgen_context_t
+{
+    int epfd;
+    volatile int running;
+    size_t nactive;
+    double tokens;
+    struct loadgen_settings_t settings;
+    struct loadgen_stats_t stats;
+    struct loadgen_pair_t *pairs;
+};
+
+static struct loadgen_context_t *loadgen_instance = NULL;
+
+/**
+ * Get monotonic time in microseconds
+ */
+static long long get_micros ( void )
+{
+    struct timespec ts;
+
+    if ( clock_gettime ( CLOCK_MONOTONIC, &ts ) < 0 )
+    {
+        return 0;
+    }
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Get histogram bucket index for a value
+ */
+static size_t hist_index ( unsigned long long value )
+{
+    unsigned int shift;
+
+    if ( value < 32 )
+    {
+        return value;
+    }
+
+    shift = 63 - __builtin_clzll ( value ) - 4;
+
+    return 16 * shift + ( value >> shift );
+}
+
+/**
+ * Get histogram bucket upper bound
+ */
+static unsigned long long hist_value ( size_t index )
+{
+    unsigned int shift;
+
+    if ( index < 32 )
+    {
+        return index;
+    }
+
+    shift = index / 16 - 1;
+
+    return ( ( unsigned long long ) ( index % 16 + 17 ) << shift ) - 1;
+}
+
+/**
+ * Record value in histogram
+ */
+static void hist_record ( struct loadgen_hist_t *hist, unsigned long long value )
+{
+    hist->buckets[hist_index ( value )]++;
+    hist->count++;
+
+    if ( value > hist->max )
+    {
+        hist->max = value;
+    }
+}
+
+/**
+ * Get histogram percentile
+ */
+static unsigned long long hist_percentile ( const struct loadgen_hist_t *hist, double percentile )
+{
+    size_t i;
+    unsigned long long sum = 0;
+    unsigned long long limit;
+
+    if ( !hist->count )
+    {
+        return 0;
+    }
+
+    limit = ( unsigned long long ) ( hist->count * percentile / 100.0 );
+
+    for ( i = 0; i < LOADGEN_HIST_NBUCKETS; i++ )
+    {
+        sum += hist->buckets[i];
+        if ( sum > limit )
+        {
+            return hist_value ( i ) < hist->max ? hist_value ( i ) : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+/**
+ * Generate random channel id
+ */
+static void random_channel ( char *channel )
+{
+    size_t i;
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    for ( i = 0; i < CHANLEN; i++ )
+    {
+        channel[i] = alphabet[rand (  ) % ( sizeof ( alphabet ) - 1 )];
+    }
+
+    channel[CHANLEN] = '\0';
+}
+
+/**
+ * Select owner relay for channel
+ */
+static size_t select_relay ( struct loadgen_context_t *context, const char *channel )
+{
+    size_t i;
+    size_t best = 0;
+    uint64_t score;
+    uint64_t best_score = 0;
+
+    for ( i = 0; i < context->settings.nrelays; i++ )
+    {
+        score =
+            nettalk_relay_score ( channel, context->settings.relays[i].hostname,
+            context->settings.relays[i].port );
+        if ( !i || score > best_score )
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+
+    return best;
+}
+
+/**
+ * Update client poll events
+ */
+static int client_update_events ( struct loadgen_context_t *context,
+    struct loadgen_client_t *client, int op )
+{
+    struct epoll_event ev;
+
+    memset ( &ev, '\0', sizeof ( ev ) );
+    ev.events = EPOLLIN;
+    ev.data.ptr = client;
+
+    client->pollout = client->state == LOADGEN_STATE_CONNECTING || client->out_len;
+
+    if ( client->pollout )
+    {
+        ev.events |= EPOLLOUT;
+    }
+
+    return epoll_ctl ( context->epfd, op, client->sock, &ev );
+}
+
+/**
+ * Close client socket
+ */
+static void client_close ( struct loadgen_context_t *context, struct loadgen_client_t *client )
+{
+    if ( client->sock >= 0 )
+    {
+        epoll_ctl ( context->epfd, EPOLL_CTL_DEL, client->sock, NULL );
+        close ( client->sock );
+        client->sock = -1;
+    }
+
+    client->state = LOADGEN_STATE_CLOSED;
+}
+
+/**
+ * Close client pair
+ */
+static void pair_close ( struct loadgen_context_t *context, struct loadgen_pair_t *pair )
+{
+    if ( pair->active )
+    {
+        client_close ( context, &pair->peers[0] );
+        client_close ( context, &pair->peers[1] );
+        pair->active = FALSE;
+        context->nactive--;
+    }
+}
+
+/**
+ * Flush client output buffer
+ */
+static int client_flush ( struct loadgen_context_t *context, struct loadgen_client_t *client )
+{
+    ssize_t len;
+
+    while ( client->out_len )
+    {
+        if ( ( len = send ( client->sock, client->out, client->out_len, MSG_NOSIGNAL ) ) < 0 )
+        {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+            {
+                break;
+            }
+            return -1;
+        }
+
+        context->stats.tx_bytes += len;
+        memmove ( client->out, client->out + len, client->out_len - len );
+        client->out_len -= len;
+    }
+
+    /* Toggle POLLOUT interest on buffer state change */
+    if ( client->pollout != !!client->out_len )
+    {
+        return client_update_events ( context, client, EPOLL_CTL_MOD );
+    }
+
+    return 0;
+}
+
+/**
+ * Queue data on client output buffer
+ */
+static int client_queue ( struct loadgen_context_t *context, struct loadgen_client_t *client,
+    const void *data, size_t len )
+{
+    if ( client->out_len + len > sizeof ( client->out ) )
+    {
+        context->stats.drops++;
+        return 0;
+    }
+
+    memcpy ( client->out + client->out_len, data, len );
+    client->out_len += len;
+
+    return client_flush ( context, client );
+}
+
+/**
+ * Queue simulated chunk on client output buffer
+ */
+static int client_queue_chunk ( struct loadgen_context_t *context,
+    struct loadgen_client_t *client, int type )
+{
+    struct loadgen_chunk_t chunk;
+
+    memset ( &chunk, '\0', sizeof ( chunk ) );
+    chunk.magic = LOADGEN_MAGIC;
+    chunk.type = type;
+    chunk.seq = client->seq++;
+    chunk.timestamp = get_micros (  );
+
+    return client_queue ( context, client, &chunk, sizeof ( chunk ) );
+}
+
+/**
+ * Start client connection
+ */
+static int client_connect ( struct loadgen_context_t *context, struct loadgen_pair_t *pair,
+    struct loadgen_client_t *client )
+{
+    int nodelay = 1;
+
+    memset ( client, '\0', sizeof ( struct loadgen_client_t ) );
+    client->sock = -1;
+    client->pair = pair;
+
+    if ( ( client->sock = socket ( AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( setsockopt ( client->sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof ( nodelay ) ) < 0 )
+    {
+        client_close ( context, client );
+        return -1;
+    }
+
+    context->stats.connects++;
+
+    if ( connect ( client->sock,
+            ( struct sockaddr * ) &context->settings.relays[pair->relay].saddr,
+            sizeof ( struct sockaddr_in ) ) < 0 && errno != EINPROGRESS )
+    {
+        close ( client->sock );
+        client->sock = -1;
+        return -1;
+    }
+
+    client->state = LOADGEN_STATE_CONNECTING;
+
+    if ( client_update_events ( context, client, EPOLL_CTL_ADD ) < 0 )
+    {
+        close ( client->sock );
+        client->sock = -1;
+        client->state = LOADGEN_STATE_CLOSED;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Open new client pair
+ */
+static int pair_open ( struct loadgen_context_t *context, struct loadgen_pair_t *pair )
+{
+    random_channel ( pair->channel );
+    pair->relay = select_relay ( context, pair->channel );
+
+    if ( client_connect ( context, pair, &pair->peers[0] ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( client_connect ( context, pair, &pair->peers[1] ) < 0 )
+    {
+        client_close ( context, &pair->peers[0] );
+        return -1;
+    }
+
+    pair->active = TRUE;
+    pair->born_us = get_micros (  );
+    pair->next_text_us = pair->born_us + context->settings.text_interval * 1000000LL;
+    context->nactive++;
+
+    return 0;
+}
+
+/**
+ * Handle connection establishment
+ */
+static int client_on_connected ( struct loadgen_context_t *context, struct loadgen_pair_t *pair,
+    struct loadgen_client_t *client )
+{
+    int so_error = 0;
+    socklen_t optlen = sizeof ( so_error );
+
+    if ( getsockopt ( client->sock, SOL_SOCKET, SO_ERROR, &so_error, &optlen ) < 0 || so_error )
+    {
+        return -1;
+    }
+
+    client->state = LOADGEN_STATE_WAITING;
+    client->sent_us = get_micros (  );
+
+    return client_queue ( context, client, pair->channel, CHANLEN );
+}
+
+/**
+ * Handle complete simulated chunks received
+ */
+static void client_on_chunks ( struct loadgen_context_t *context, struct loadgen_client_t *client )
+{
+    size_t pos;
+    long long now;
+    struct loadgen_chunk_t chunk;
+
+    now = get_micros (  );
+
+    for ( pos = 0; pos + LOADGEN_CHUNK_LEN <= client->in_len; pos += LOADGEN_CHUNK_LEN )
+    {
+        memcpy ( &chunk, client->in + pos, sizeof ( chunk ) );
+
+        if ( chunk.magic == LOADGEN_MAGIC && chunk.timestamp <= now )
+        {
+            hist_record ( &context->stats.forward, now - chunk.timestamp );
+        }
+
+        context->stats.rx_chunks++;
+    }
+
+    memmove ( client->in, client->in + pos, client->in_len - pos );
+    client->in_len -= pos;
+}
+
+/**
+ * Handle incoming data
+ */
+static int client_on_readable ( struct loadgen_context_t *context, struct loadgen_pair_t *pair,
+    struct loadgen_client_t *client )
+{
+    ssize_t len;
+    struct loadgen_client_t *other;
+
+    if ( ( len = recv ( client->sock, client->in + client->in_len,
+                sizeof ( client->in ) - client->in_len, 0 ) ) <= 0 )
+    {
+        if ( len < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+        {
+            return 0;
+        }
+        return -1;
+    }
+
+    client->in_len += len;
+    context->stats.rx_bytes += len;
+
+    /* Wait for channel id echoed back by relay */
+    if ( client->state == LOADGEN_STATE_WAITING )
+    {
+        if ( client->in_len < CHANLEN )
+        {
+            return 0;
+        }
+
+        if ( memcmp ( client->in, pair->channel, CHANLEN ) )
+        {
+            /* Relay shed the rendezvous under load */
+            if ( client->in[0] == BUSY_BYTE && !memcmp ( client->in, client->in + 1, CHANLEN - 1 ) )
+            {
+                context->stats.refusals++;
+                pair_close ( context, pair );
+                return 0;
+            }
+            return -1;
+        }
+
+        memmove ( client->in, client->in + CHANLEN, client->in_len - CHANLEN );
+        client->in_len -= CHANLEN;
+        client->state = LOADGEN_STATE_PAIRED;
+        client->paired_us = get_micros (  );
+
+        /* Pairing latency is measured on the client that joined last */
+        other = client == &pair->peers[0] ? &pair->peers[1] : &pair->peers[0];
+        if ( other->state == LOADGEN_STATE_PAIRED )
+        {
+            if ( client->sent_us > other->sent_us )
+            {
+                hist_record ( &context->stats.pairing, client->paired_us - client->sent_us );
+            } else
+            {
+                hist_record ( &context->stats.pairing, other->paired_us - other->sent_us );
+            }
+            context->stats.pairings++;
+        }
+    }
+
+    client_on_chunks ( context, client );
+
+    return 0;
+}
+
+/**
+ * Handle client poll event
+ */
+static void client_on_event ( struct loadgen_context_t *context, struct loadgen_client_t *client,
+    unsigned int events )
+{
+    int status = 0;
+    struct loadgen_pair_t *pair;
+
+    pair = client->pair;
+
+    if ( !pair->active || client->sock < 0 )
+    {
+        return;
+    }
+
+    if ( client->state == LOADGEN_STATE_CONNECTING )
+    {
+        if ( events & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) )
+        {
+            status = client_on_connected ( context, pair, client );
+        }
+
+    } else
+    {
+        if ( events & EPOLLIN )
+        {
+            status = client_on_readable ( context, pair, client );
+
+        } else if ( events & ( EPOLLERR | EPOLLHUP ) )
+        {
+            status = -1;
+        }
+
+        if ( status >= 0 && client->sock >= 0 && ( events & EPOLLOUT ) )
+        {
+            status = client_flush ( context, client );
+        }
+    }
+
+    if ( status < 0 )
+    {
+        context->stats.failures++;
+        pair_close ( context, pair );
+    }
+}
+
+/**
+ * Send voice and text traffic for pairs due in current tick
+ */
+static void loadgen_traffic ( struct loadgen_context_t *context, size_t slot, long long now )
+{
+    size_t i;
+    size_t j;
+    struct loadgen_pair_t *pair;
+
+    for ( i = slot; i < context->settings.npairs; i += LOADGEN_VOICE_PERIOD_MS )
+    {
+        pair = &context->pairs[i];
+
+        if ( !pair->active || pair->peers[0].state != LOADGEN_STATE_PAIRED
+            || pair->peers[1].state != LOADGEN_STATE_PAIRED )
+        {
+            continue;
+        }
+
+        /* Churn pairs that exceeded their lifetime */
+        if ( context->settings.lifetime
+            && pair->born_us + context->settings.lifetime * 1000000LL <= now )
+        {
+            context->stats.churned++;
+            pair_close ( context, pair );
+            continue;
+        }
+
+        /* Both peers talk at voice cadence */
+        if ( client_queue_chunk ( context, &pair->peers[0], LOADGEN_CHUNK_VOICE ) < 0
+            || client_queue_chunk ( context, &pair->peers[1], LOADGEN_CHUNK_VOICE ) < 0 )
+        {
+            context->stats.failures++;
+            pair_close ( context, pair );
+            continue;
+        }
+
+        /* Occasional text message burst */
+        if ( context->settings.text_interval && pair->next_text_us <= now )
+        {
+            for ( j = 0; j < context->settings.text_burst; j++ )
+            {
+                if ( client_queue_chunk ( context, &pair->peers[j & 1], LOADGEN_CHUNK_TEXT ) < 0 )
+                {
+                    context->stats.failures++;
+                    pair_close ( context, pair );
+                    break;
+                }
+            }
+            pair->next_text_us = now + context->settings.text_interval * 1000000LL;
+        }
+    }
+}
+
+/**
+ * Open new pairs within connect rate limit
+ */
+static void loadgen_admit ( struct loadgen_context_t *context, long long elapsed_us )
+{
+    size_t i;
+
+    context->tokens += context->settings.connect_rate * elapsed_us / 1000000.0;
+
+    if ( context->tokens > context->settings.connect_rate + 2 )
+    {
+        context->tokens = context->settings.connect_rate + 2;
+    }
+
+    /* Nothing to open once every pair is up, no need to scan them on each tick */
+    if ( context->nactive >= context->settings.npairs )
+    {
+        return;
+    }
+
+    for ( i = 0; i < context->settings.npairs && context->tokens >= 2; i++ )
+    {
+        if ( !context->pairs[i].active )
+        {
+            if ( pair_open ( context, &context->pairs[i] ) < 0 )
+            {
+                context->stats.failures++;
+            }
+            context->tokens -= 2;
+        }
+    }
+}
+
+/**
+ * Print statistics line
+ */
+static void loadgen_report ( struct loadgen_context_t *context, double secs, const char *label )
+{
+    struct loadgen_stats_t *stats = &context->stats;
+
+    printf ( "%s t=%.1fs active=%lu pairs=%llu fail=%llu busy=%llu churn=%llu drop=%llu"
+        " pairing[us] p50=%llu p90=%llu p99=%llu max=%llu"
+        " fwd[us] p50=%llu p90=%llu p99=%llu max=%llu rx=%.1fkB/s tx=%.1fkB/s\n",
+        label, secs, ( unsigned long ) context->nactive, stats->pairings, stats->failures,
+        stats->refusals, stats->churned, stats->drops, hist_percentile ( &stats->pairing, 50 ),
+        hist_percentile ( &stats->pairing, 90 ), hist_percentile ( &stats->pairing, 99 ),
+        stats->pairing.max, hist_percentile ( &stats->forward, 50 ),
+        hist_percentile ( &stats->forward, 90 ), hist_percentile ( &stats->forward, 99 ),
+        stats->forward.max, secs > 0 ? stats->rx_bytes / secs / 1024.0 : 0,
+        secs > 0 ? stats->tx_bytes / secs / 1024.0 : 0 );
+    fflush ( stdout );
+}
+
+/**
+ * Load generator main loop
+ */
+static int loadgen_run ( struct loadgen_context_t *context )
+{
+    int i;
+    int nevents;
+    long long now;
+    long long start;
+    long long last;
+    long long next_report;
+    long long last_tick;
+    struct epoll_event events[256];
+
+    start = get_micros (  );
+    last = start;
+    last_tick = start / 1000;
+    next_report = start + 1000000;
+
+    while ( context->running )
+    {
+        now = get_micros (  );
+
+        if ( context->settings.duration
+            && now - start >= context->settings.duration * 1000000LL )
+        {
+            break;
+        }
+
+        loadgen_admit ( context, now - last );
+        last = now;
+
+        if ( ( nevents = epoll_wait ( context->epfd, events,
+                    sizeof ( events ) / sizeof ( struct epoll_event ), 1 ) ) < 0 )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            perror ( "epoll_wait" );
+            return -1;
+        }
+
+        for ( i = 0; i < nevents; i++ )
+        {
+            client_on_event ( context, ( struct loadgen_client_t * ) events[i].data.ptr,
+                events[i].events );
+        }
+
+        /* Spread voice cadence over millisecond slots */
+        now = get_micros (  );
+        while ( last_tick < now / 1000 )
+        {
+            last_tick++;
+            loadgen_traffic ( context, last_tick % LOADGEN_VOICE_PERIOD_MS, now );
+        }
+
+        if ( now >= next_report )
+        {
+            loadgen_report ( context, ( now - start ) / 1000000.0, "[run]" );
+            next_report += 1000000;
+        }
+    }
+
+    loadgen_report ( context, ( get_micros (  ) - start ) / 1000000.0, "[end]" );
+
+    return 0;
+}
+
+/**
+ * Signal handler
+ */
+static void loadgen_signal ( int signo )
+{
+    ( void ) signo;
+
+    if ( loadgen_instance )
+    {
+        loadgen_instance->running = FALSE;
+    }
+}
+
+/**
+ * Decode relay ip address and port number
+ */
+static int relay_decode ( const char *input, struct loadgen_relay_t *relay )
+{
+    unsigned int lport;
+    size_t len;
+    const char *ptr;
+
+    if ( !( ptr = strchr ( input, ':' ) ) )
+    {
+        return -1;
+    }
+
+    if ( ( len = ptr - input ) >= sizeof ( relay->hostname ) )
+    {
+        return -1;
+    }
+
+    memcpy ( relay->hostname, input, len );
+    relay->hostname[len] = '\0';
+
+    memset ( &relay->saddr, '\0', sizeof ( struct sockaddr_in ) );
+    relay->saddr.sin_family = AF_INET;
+
+    if ( inet_pton ( AF_INET, relay->hostname, &relay->saddr.sin_addr ) <= 0 )
+    {
+        return -1;
+    }
+
+    if ( sscanf ( ptr + 1, "%u", &lport ) <= 0 || !lport || lport > 65535 )
+    {
+        return -1;
+    }
+
+    relay->port = lport;
+    relay->saddr.sin_port = htons ( lport );
+    return 0;
+}
+
+/**
+ * Raise open files limit for thousands of clients
+ */
+static void raise_nofile_limit ( size_t npairs )
+{
+    struct rlimit rl;
+
+    if ( getrlimit ( RLIMIT_NOFILE, &rl ) < 0 )
+    {
+        return;
+    }
+
+    if ( rl.rlim_cur < npairs * 2 + 64 )
+    {
+        rl.rlim_cur = rl.rlim_max;
+        if ( rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > npairs * 2 + 64 )
+        {
+            rl.rlim_cur = npairs * 2 + 64;
+        }
+        setrlimit ( RLIMIT_NOFILE, &rl );
+    }
+}
+
+/**
+ * Show program usage message
+ */
+static void show_usage ( void )
+{
+    fprintf ( stderr, "\n" "usage: nettalk-loadgen [options] addr:port [addr:port...]\n\n"
+        "options:\n"
+        "  -n pairs     simulated client pairs (default 100)\n"
+        "  -r rate      new connections per second (default 200)\n"
+        "  -d secs      test duration, 0 runs until interrupted (default 30)\n"
+        "  -l secs      pair lifetime before churn, 0 disables churn (default 0)\n"
+        "  -t secs      text burst interval, 0 disables text (default 5)\n"
+        "  -b chunks    text burst length in chunks (default 64)\n\n" );
+}
+
+/**
+ * Program entry point
+ */
+int main ( int argc, char *argv[] )
+{
+    int opt;
+    size_t i;
+    static struct loadgen_context_t context;
+
+    memset ( &context, '\0', sizeof ( context ) );
+    context.settings.npairs = 100;
+    context.settings.connect_rate = 200;
+    context.settings.duration = 30;
+    context.settings.lifetime = 0;
+    context.settings.text_interval = 5;
+    context.settings.text_burst = 64;
+
+    while ( ( opt = getopt ( argc, argv, "n:r:d:l:t:b:" ) ) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'n':
+            context.settings.npairs = strtoul ( optarg, NULL, 10 );
+            break;
+        case 'r':
+            context.settings.connect_rate = strtod ( optarg, NULL );
+            break;
+        case 'd':
+            context.settings.duration = strtoul ( optarg, NULL, 10 );
+            break;
+        case 'l':
+            context.settings.lifetime = strtoul ( optarg, NULL, 10 );
+            break;
+        case 't':
+            context.settings.text_interval = strtoul ( optarg, NULL, 10 );
+            break;
+        case 'b':
+            context.settings.text_burst = strtoul ( optarg, NULL, 10 );
+            break;
+        default:
+            show_usage (  );
+            return 1;
+        }
+    }
+
+    if ( optind >= argc || argc - optind > RELAYS_MAX || !context.settings.npairs
+        || context.settings.connect_rate < 2 )
+    {
+        show_usage (  );
+        return 1;
+    }
+
+    /* Channels are spread over relays as clients would do */
+    for ( context.settings.nrelays = 0; optind < argc; optind++ )
+    {
+        if ( relay_decode ( argv[optind],
+                &context.settings.relays[context.settings.nrelays++] ) < 0 )
+        {
+            show_usage (  );
+            return 1;
+        }
+    }
+
+    raise_nofile_limit ( context.settings.npairs );
+    srand ( time ( NULL ) ^ getpid (  ) );
+
+    if ( !( context.pairs =
+            ( struct loadgen_pair_t * ) calloc ( context.settings.npairs,
+                sizeof ( struct loadgen_pair_t ) ) ) )
+    {
+        perror ( "calloc" );
+        return 1;
+    }
+
+    for ( i = 0; i < context.settings.npairs; i++ )
+    {
+        context.pairs[i].peers[0].sock = -1;
+        context.pairs[i].peers[1].sock = -1;
+    }
+
+    if ( ( context.epfd = epoll_create1 ( 0 ) ) < 0 )
+    {
+        perror ( "epoll_create1" );
+        free ( context.pairs );
+        return 1;
+    }
+
+    loadgen_instance = &context;
+    context.running = TRUE;
+    signal ( SIGINT, loadgen_signal );
+    signal ( SIGTERM, loadgen_signal );
+    signal ( SIGPIPE, SIG_IGN );
+
+    loadgen_run ( &context );
+
+    for ( i = 0; i < context.settings.npairs; i++ )
+    {
+        pair_close ( &context, &context.pairs[i] );
+    }
+
+    close ( context.epfd );
+    free ( context.pairs );
+
+    return 0;
+}
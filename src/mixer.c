@@ -0,0 +1,433 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Group Call Mixer
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+/**
+ * Join group call mixer as a participant
+ */
+int audio_mixer_join ( struct audio_mixer_t *mixer )
+{
+    int slot;
+    struct audio_mixer_slot_t *participant;
+
+    pthread_mutex_lock ( &mixer->mutex );
+
+    for ( slot = 0; slot < NETTALK_CONTACTS_MAX; slot++ )
+    {
+        participant = &mixer->slots[slot];
+
+        if ( !participant->active )
+        {
+            participant->active = TRUE;
+            participant->primed = FALSE;
+            participant->head = 0;
+            participant->tail = 0;
+            participant->out_head = 0;
+            participant->out_tail = 0;
+            pthread_mutex_unlock ( &mixer->mutex );
+            return slot;
+        }
+    }
+
+    pthread_mutex_unlock ( &mixer->mutex );
+
+    errno = ENOSPC;
+    return -1;
+}
+
+/**
+ * Leave group call mixer
+ */
+void audio_mixer_leave ( struct audio_mixer_t *mixer, int slot )
+{
+    pthread_mutex_lock ( &mixer->mutex );
+    mixer->slots[slot].active = FALSE;
+    pthread_mutex_unlock ( &mixer->mutex );
+}
+
+/**
+ * Queue participant decoded frames for mixing
+ */
+void audio_mixer_push ( struct audio_mixer_t *mixer, int slot, const float *frames,
+    size_t nframes, unsigned long long decode_ns )
+{
+    size_t i;
+    struct audio_mixer_slot_t *participant = &mixer->slots[slot];
+
+    pthread_mutex_lock ( &mixer->mutex );
+
+    for ( i = 0; i < nframes; i++ )
+    {
+        /* Drop oldest frames rather than let latency grow */
+        if ( participant->head - participant->tail >= AUDIO_MIXER_RING )
+        {
+            participant->tail++;
+        }
+
+        participant->ring[participant->head++ % AUDIO_MIXER_RING] = frames[i];
+    }
+
+    participant->decode_ns += decode_ns;
+
+    pthread_mutex_unlock ( &mixer->mutex );
+}
+
+/**
+ * Wait for participant mix-minus frames
+ */
+ssize_t audio_mixer_pull ( struct audio_mixer_t *mixer, int slot, float *frames,
+    size_t nframes, unsigned long long encode_ns )
+{
+    size_t i;
+    size_t avail;
+    struct timespec deadline;
+    struct audio_mixer_slot_t *participant = &mixer->slots[slot];
+
+    clock_gettime ( CLOCK_REALTIME, &deadline );
+    deadline.tv_nsec += 100000000L;
+
+    if ( deadline.tv_nsec >= 1000000000L )
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock ( &mixer->mutex );
+
+    participant->encode_ns += encode_ns;
+
+    while ( participant->out_head == participant->out_tail )
+    {
+        if ( pthread_cond_timedwait ( &mixer->cond, &mixer->mutex, &deadline ) == ETIMEDOUT )
+        {
+            pthread_mutex_unlock ( &mixer->mutex );
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+
+    if ( ( avail = participant->out_head - participant->out_tail ) > nframes )
+    {
+        avail = nframes;
+    }
+
+    for ( i = 0; i < avail; i++ )
+    {
+        frames[i] = participant->outring[participant->out_tail++ % AUDIO_MIXER_OUTRING];
+    }
+
+    pthread_mutex_unlock ( &mixer->mutex );
+
+    return avail;
+}
+
+/**
+ * Queue mix of all other participants for each listener
+ */
+static void audio_mixer_minus ( struct audio_mixer_t *mixer, const float *total )
+{
+    int slot;
+    size_t i;
+    unsigned long long ns;
+    struct audio_mixer_slot_t *participant;
+    float output[AUDIO_MIXER_PERIOD];
+
+    for ( slot = 0; slot < NETTALK_CONTACTS_MAX; slot++ )
+    {
+        participant = &mixer->slots[slot];
+
+        if ( !participant->active )
+        {
+            continue;
+        }
+
+        ns = audio_thread_nanos (  );
+
+        /* Remove own voice from total instead of summing others again */
+        if ( participant->mixed )
+        {
+            audio_mix_minus_float_array ( total, participant->period, output,
+                AUDIO_MIXER_PERIOD );
+
+        } else
+        {
+            memcpy ( output, total, sizeof ( output ) );
+        }
+
+        audio_clip_float_array ( output, AUDIO_MIXER_PERIOD );
+
+        for ( i = 0; i < AUDIO_MIXER_PERIOD; i++ )
+        {
+            /* Drop oldest frames if encoder falls behind */
+            if ( participant->out_head - participant->out_tail >= AUDIO_MIXER_OUTRING )
+            {
+                participant->out_tail++;
+            }
+
+            participant->outring[participant->out_head++ % AUDIO_MIXER_OUTRING] = output[i];
+        }
+
+        participant->out_frames += AUDIO_MIXER_PERIOD;
+        participant->mix_ns += audio_thread_nanos (  ) - ns;
+    }
+
+    pthread_cond_broadcast ( &mixer->cond );
+}
+
+/**
+ * Mix single period of all participants
+ */
+static void audio_mixer_period ( struct audio_mixer_t *mixer, float *output )
+{
+    int slot;
+    size_t len;
+    size_t avail;
+    size_t offset;
+    unsigned long long ns;
+    struct audio_mixer_slot_t *participant;
+
+    memset ( output, '\0', AUDIO_MIXER_PERIOD * sizeof ( float ) );
+
+    pthread_mutex_lock ( &mixer->mutex );
+
+    for ( slot = 0; slot < NETTALK_CONTACTS_MAX; slot++ )
+    {
+        participant = &mixer->slots[slot];
+        participant->mixed = FALSE;
+
+        if ( !participant->active )
+        {
+            continue;
+        }
+
+        avail = participant->head - participant->tail;
+
+        /* Wait for participant jitter buffer to fill up */
+        if ( !participant->primed )
+        {
+            if ( avail < AUDIO_MIXER_PREBUFFER )
+            {
+                continue;
+            }
+            participant->primed = TRUE;
+        }
+
+        if ( avail < AUDIO_MIXER_PERIOD )
+        {
+            participant->primed = FALSE;
+
+        } else
+        {
+            avail = AUDIO_MIXER_PERIOD;
+        }
+
+        ns = audio_thread_nanos (  );
+
+        /* Copy ring buffer in at most two contiguous parts */
+        for ( offset = 0; offset < avail; offset += len )
+        {
+            len = AUDIO_MIXER_RING - participant->tail % AUDIO_MIXER_RING;
+
+            if ( len > avail - offset )
+            {
+                len = avail - offset;
+            }
+
+            memcpy ( participant->period + offset,
+                participant->ring + participant->tail % AUDIO_MIXER_RING,
+                len * sizeof ( float ) );
+            participant->tail += len;
+        }
+
+        memset ( participant->period + avail, '\0',
+            ( AUDIO_MIXER_PERIOD - avail ) * sizeof ( float ) );
+        audio_mix_float_array ( participant->period, output, AUDIO_MIXER_PERIOD );
+        participant->mixed = TRUE;
+
+        participant->frames += avail;
+        participant->mix_ns += audio_thread_nanos (  ) - ns;
+    }
+
+    if ( mixer->mcu )
+    {
+        audio_mixer_minus ( mixer, output );
+    }
+
+    pthread_mutex_unlock ( &mixer->mutex );
+
+    audio_clip_float_array ( output, AUDIO_MIXER_PERIOD );
+}
+
+/**
+ * Conference mixing loop paced by monotonic clock
+ */
+static void audio_mixer_conference ( struct audio_mixer_t *mixer )
+{
+    struct timespec next;
+    float output[AUDIO_MIXER_PERIOD];
+
+    nettalk_info ( mixer->context, "conference mixer enabled" );
+
+    clock_gettime ( CLOCK_MONOTONIC, &next );
+
+    while ( mixer->running )
+    {
+        audio_mixer_period ( mixer, output );
+
+        next.tv_nsec += AUDIO_MIXER_PERIOD * ( 1000000000L / AUDIO_MIXER_RATE );
+
+        if ( next.tv_nsec >= 1000000000L )
+        {
+            next.tv_sec++;
+            next.tv_nsec -= 1000000000L;
+        }
+
+        clock_nanosleep ( CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL );
+    }
+
+    nettalk_info ( mixer->context, "conference mixer disabled" );
+}
+
+/**
+ * Group call mixer entry point
+ */
+static void *audio_mixer_entry ( void *arg )
+{
+    int err;
+    size_t done;
+    size_t idone;
+    size_t odone;
+    soxr_t soxr;
+    struct audio_fir_t fir;
+    snd_pcm_t *playback_handle;
+    float input[AUDIO_MIXER_PERIOD];
+    float output[AUDIO_MIXER_PERIOD * AUDIO_RATE_DEFAULT / AUDIO_MIXER_RATE + 64];
+    struct audio_mixer_t *mixer = ( struct audio_mixer_t * ) arg;
+
+    /* Conference host has no local speaker */
+    if ( mixer->mcu )
+    {
+        audio_mixer_conference ( mixer );
+        return NULL;
+    }
+
+    /* Open ALSA device once for all participants */
+    if ( ( err = snd_pcm_open ( &playback_handle, mixer->dev, SND_PCM_STREAM_PLAYBACK, 0 ) ) < 0 )
+    {
+        nettalk_error ( mixer->context, "mixer device '%s' open failed", mixer->dev );
+        nettalk_error ( mixer->context, "%s", snd_strerror ( err ) );
+        return NULL;
+    }
+
+    if ( ( err =
+            snd_pcm_set_params ( playback_handle, SND_PCM_FORMAT_FLOAT_LE,
+                SND_PCM_ACCESS_RW_INTERLEAVED, AUDIO_LAYOUT_MONO, mixer->rate, 1,
+                AUDIO_MIXER_LATENCY ) ) < 0 )
+    {
+        nettalk_error ( mixer->context, "mixer set params failed" );
+        nettalk_error ( mixer->context, "%s", snd_strerror ( err ) );
+        snd_pcm_close ( playback_handle );
+        return NULL;
+    }
+
+    /* Resample mixed sound once instead of per participant */
+    if ( audio_resampler_init ( mixer->context, "mixer", AUDIO_MIXER_RATE, mixer->rate, FALSE,
+            &soxr, &fir ) < 0 )
+    {
+        snd_pcm_close ( playback_handle );
+        return NULL;
+    }
+
+    nettalk_info ( mixer->context, "group call mixer enabled" );
+
+    /* Blocking device writes pace the mixing loop */
+    while ( mixer->running )
+    {
+        audio_mixer_period ( mixer, input );
+
+        if ( fir.taps )
+        {
+            odone = audio_fir_process ( &fir, input, AUDIO_MIXER_PERIOD, output );
+
+        } else if ( soxr_process ( soxr, input, AUDIO_MIXER_PERIOD, &idone, output,
+                sizeof ( output ) / sizeof ( float ), &odone ) )
+        {
+            break;
+        }
+
+        for ( done = 0; done < odone; )
+        {
+            if ( ( err = snd_pcm_writei ( playback_handle, output + done, odone - done ) ) < 0 )
+            {
+                if ( ( err = snd_pcm_recover ( playback_handle, err, 0 ) ) < 0 )
+                {
+                    nettalk_error ( mixer->context, "mixer pcm write failed" );
+                    nettalk_error ( mixer->context, "%s", snd_strerror ( err ) );
+                    mixer->running = FALSE;
+                    break;
+                }
+
+            } else
+            {
+                done += err;
+            }
+        }
+    }
+
+    nettalk_info ( mixer->context, "group call mixer disabled" );
+
+    if ( soxr )
+    {
+        soxr_delete ( soxr );
+    }
+    audio_fir_free ( &fir );
+    snd_pcm_drop ( playback_handle );
+    snd_pcm_close ( playback_handle );
+
+    return NULL;
+}
+
+/**
+ * Launch group call mixer task
+ */
+int audio_mixer_launch ( struct nettalk_context_t *context, struct audio_mixer_t *mixer )
+{
+    strncpy ( mixer->dev, ALSA_DEFAULT_DEV, sizeof ( mixer->dev ) - 1 );
+    mixer->rate = AUDIO_RATE_DEFAULT;
+    mixer->context = context;
+    mixer->running = TRUE;
+
+    if ( pthread_mutex_init ( &mixer->mutex, NULL ) != 0 )
+    {
+        return -1;
+    }
+
+    if ( pthread_cond_init ( &mixer->cond, NULL ) != 0 )
+    {
+        pthread_mutex_destroy ( &mixer->mutex );
+        return -1;
+    }
+
+    if ( pthread_create ( &mixer->thread, NULL, audio_mixer_entry, mixer ) != 0 )
+    {
+        pthread_cond_destroy ( &mixer->cond );
+        pthread_mutex_destroy ( &mixer->mutex );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Stop group call mixer task
+ */
+void audio_mixer_stop ( struct audio_mixer_t *mixer )
+{
+    mixer->running = FALSE;
+    pthread_join ( mixer->thread, NULL );
+    pthread_cond_destroy ( &mixer->cond );
+    pthread_mutex_destroy ( &mixer->mutex );
+}
@@ -7,7 +7,7 @@
 /**
  * Networking Task process function
  */
-static void nettask_process ( struct nettalk_context_t *context )
+static int nettask_process ( struct nettalk_context_t *context )
 {
     int err = FALSE;
     pthread_t playback_thread;
@@ -18,21 +18,21 @@ static void nettask_process ( struct nettalk_context_t *context )
         pipe_close ( &context->msgin );
         pipe_close ( &context->msgout );
         pipe_close ( &context->msgloop );
-        return;
+        return FALSE;
     }
 
     if ( socket_set_nonblocking ( context->bridge.u.s.remote ) < 0 )
     {
         close ( context->bridge.u.s.local );
         close ( context->bridge.u.s.remote );
-        return;
+        return FALSE;
     }
 
     if ( nettalk_connect ( context ) < 0 )
     {
         shutdown_then_close ( context->bridge.u.s.local );
         shutdown_then_close ( context->bridge.u.s.remote );
-        return;
+        return FALSE;
     }
 
     if ( nettalk_handshake ( context ) < 0 )
@@ -40,25 +40,36 @@ static void nettask_process ( struct nettalk_context_t *context )
         shutdown_then_close ( context->bridge.u.s.local );
         shutdown_then_close ( context->bridge.u.s.remote );
         shutdown_then_close ( context->session.sock );
-        return;
+        return FALSE;
+    }
+
+    /* Relay is used alone if direct path cannot be set up */
+    if ( nettalk_direct_setup ( context ) < 0 )
+    {
+        nettalk_info ( context, "direct path not available" );
     }
 
+    /* Peer announces its codecs in band, it may be older version */
+    context->peer_codecs = 0;
+
     if ( voice_playback_launch ( context, &playback_thread ) < 0 )
     {
+        nettalk_direct_free ( context );
         shutdown_then_close ( context->bridge.u.s.local );
         shutdown_then_close ( context->bridge.u.s.remote );
         shutdown_then_close ( context->session.sock );
-        return;
+        return FALSE;
     }
 
     if ( voice_capture_launch ( context, &capture_thread ) < 0 )
     {
         reconnect_session ( context );
         pthread_join ( playback_thread, NULL );
+        nettalk_direct_free ( context );
         shutdown_then_close ( context->bridge.u.s.local );
         shutdown_then_close ( context->bridge.u.s.remote );
         shutdown_then_close ( context->session.sock );
-        return;
+        return FALSE;
     }
 
     context->online = TRUE;
@@ -72,6 +83,7 @@ static void nettask_process ( struct nettalk_context_t *context )
     reconnect_session ( context );
     pthread_join ( playback_thread, NULL );
     pthread_join ( capture_thread, NULL );
+    nettalk_direct_free ( context );
     shutdown_then_close ( context->bridge.u.s.local );
     shutdown_then_close ( context->bridge.u.s.remote );
     shutdown_then_close ( context->session.sock );
@@ -84,25 +96,45 @@ static void nettask_process ( struct nettalk_context_t *context )
     {
         nettalk_errcode ( context, "lost connection with peer", errno ? errno : EPIPE );
     }
+
+    return TRUE;
+}
+
+/**
+ * Get random delay in range
+ */
+static int nettask_jitter ( struct nettalk_context_t *context, int min, int max )
+{
+    unsigned int value;
+
+    if ( max <= min || nettalk_random_bytes ( &context->random, &value, sizeof ( value ) ) < 0 )
+    {
+        return min;
+    }
+
+    return min + value % ( max - min );
 }
 
 /**
  * Make some delay between retries
  */
-static void nettask_delay ( struct nettalk_context_t *context )
+static void nettask_delay ( struct nettalk_context_t *context, int delay )
 {
     struct pollfd fds[1];
 
-    nettalk_info ( context, "retrying in 5 secs..." );
+    if ( delay >= 1000 )
+    {
+        nettalk_info ( context, "retrying in %i secs...", delay / 1000 );
+    }
 
     /* Prepare poll events */
     fds[0].fd = context->reset_pipe.u.s.readfd;
     fds[0].events = POLLERR | POLLHUP | POLLIN;
 
     /* Wait delay or for reset event */
-    if ( poll ( fds, 1, 5000 ) < 0 )
+    if ( poll ( fds, 1, delay ) < 0 )
     {
-        sleep ( 5 );
+        usleep ( delay * 1000 );
     }
 }
 
@@ -126,17 +158,52 @@ static int nettask_discard_reset ( struct nettalk_context_t *context )
 static void *nettask_entry_point ( void *arg )
 {
     time_t ts;
+    int established;
+    int discarded;
+    int requested;
+    int backoff = NETTALK_RETRY_DELAY_MIN;
     struct nettalk_context_t *context = ( struct nettalk_context_t * ) arg;
 
-    for ( ;; )
+    while ( !context->stopping )
     {
         ts = time ( NULL );
-        nettask_process ( context );
-        if ( !nettask_discard_reset ( context ) )
+        established = nettask_process ( context );
+
+        /* Ended session always leaves its own reset event behind */
+        discarded = nettask_discard_reset ( context );
+        requested = context->user_reconnect;
+        context->user_reconnect = FALSE;
+
+        /* Spread reconnects of peers dropped at once, e.g. on relay restart, user waits not */
+        if ( established && !context->stopping && !requested )
+        {
+            backoff = NETTALK_RETRY_DELAY_MIN;
+            nettask_delay ( context, nettask_jitter ( context, 0, NETTALK_RECONNECT_JITTER ) );
+            continue;
+        }
+
+        if ( !discarded )
         {
+            /* Try other relay servers without delay */
+            if ( context->relay_refusals && context->relay_refusals < context->config.nrelays )
+            {
+                continue;
+            }
+
+            context->relay_refusals = 0;
+
+            /* Back off exponentially on repeated quick failures */
             if ( ts + 2 >= time ( NULL ) )
             {
-                nettask_delay ( context );
+                nettask_delay ( context, nettask_jitter ( context, backoff / 2, backoff ) );
+                if ( ( backoff *= 2 ) > NETTALK_RETRY_DELAY_MAX )
+                {
+                    backoff = NETTALK_RETRY_DELAY_MAX;
+                }
+
+            } else
+            {
+                backoff = NETTALK_RETRY_DELAY_MIN;
             }
         }
     }
@@ -149,10 +216,8 @@ static void *nettask_entry_point ( void *arg )
  */
 int nettask_launch ( struct nettalk_context_t *context )
 {
-    long pref;
-
     /* Start scanner task asynchronously */
-    if ( pthread_create ( ( pthread_t * ) & pref, NULL, nettask_entry_point, context ) != 0 )
+    if ( pthread_create ( &context->nettask_thread, NULL, nettask_entry_point, context ) != 0 )
     {
         return -1;
     }
@@ -160,6 +225,22 @@ int nettask_launch ( struct nettalk_context_t *context )
     return 0;
 }
 
+/**
+ * Stop Networking Task
+ */
+void nettask_stop ( struct nettalk_context_t *context )
+{
+    if ( !context->running )
+    {
+        return;
+    }
+
+    context->stopping = TRUE;
+    reconnect_session ( context );
+    pthread_join ( context->nettask_thread, NULL );
+    context->running = FALSE;
+}
+
 /**
  * Reconnect the session
  */
@@ -172,6 +253,15 @@ void reconnect_session ( struct nettalk_context_t *context )
     }
 }
 
+/**
+ * Reconnect the session on user request, without reconnect jitter
+ */
+void user_reconnect_session ( struct nettalk_context_t *context )
+{
+    context->user_reconnect = TRUE;
+    reconnect_session ( context );
+}
+
 /**
  * Check if session reconnect is in progress
  */
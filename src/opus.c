@@ -0,0 +1,240 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Opus Voice Codec
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+#include <opus.h>
+
+/**
+ * Opus bitrates by AMR-NB mode, so that path adaptation steers both codecs
+ */
+static const int opus_bitrate[] = { 6000, 6000, 6000, 7000, 8000, 8000, 10000, 12000 };
+
+/**
+ * Initialize Opus encoder backend
+ */
+int audio_opus_encoder_init ( struct nettalk_context_t *context,
+    struct audio_encoder_t *encoder )
+{
+    int err;
+
+    /* Narrowband voice keeps AMR-NB rate and frame size for the rest of pipeline */
+    if ( !( encoder->opus = opus_encoder_create ( 8000, 1, OPUS_APPLICATION_VOIP, &err ) )
+        || err != OPUS_OK )
+    {
+        nettalk_error ( context, "mic opus init failed" );
+        audio_opus_encoder_free ( encoder );
+        return -1;
+    }
+
+    if ( opus_encoder_ctl ( encoder->opus, OPUS_SET_SIGNAL ( OPUS_SIGNAL_VOICE ) ) != OPUS_OK
+        || opus_encoder_ctl ( encoder->opus, OPUS_SET_DTX ( encoder->dtx_on ) ) != OPUS_OK )
+    {
+        nettalk_error ( context, "mic opus setup failed" );
+        audio_opus_encoder_free ( encoder );
+        return -1;
+    }
+
+    /* Bitrate and in-band FEC are set with first frame */
+    encoder->opus_mode = -1;
+    encoder->opus_fec = -1;
+
+    return 0;
+}
+
+/**
+ * Reset Opus encoder backend state
+ */
+int audio_opus_encoder_reset ( struct audio_encoder_t *encoder )
+{
+    return opus_encoder_ctl ( encoder->opus, OPUS_RESET_STATE ) != OPUS_OK ? -1 : 0;
+}
+
+/**
+ * Encode Opus frame, returns output length, zero if nothing is sent
+ */
+ssize_t audio_opus_encode ( struct audio_encoder_t *encoder, short *samples,
+    unsigned char *output, int *silent )
+{
+    int len;
+    opus_int32 in_dtx = 0;
+
+    /* Follow path congestion with bitrate */
+    if ( encoder->opus_mode != encoder->amrnb_mode )
+    {
+        if ( opus_encoder_ctl ( encoder->opus,
+                OPUS_SET_BITRATE ( opus_bitrate[encoder->amrnb_mode] ) ) != OPUS_OK )
+        {
+            return -1;
+        }
+        encoder->opus_mode = encoder->amrnb_mode;
+    }
+
+    /* Relay never loses frames, direct path datagrams do, so FEC is carried there only */
+    if ( encoder->opus_fec != encoder->chunked )
+    {
+        if ( opus_encoder_ctl ( encoder->opus,
+                OPUS_SET_INBAND_FEC ( encoder->chunked ) ) != OPUS_OK
+            || opus_encoder_ctl ( encoder->opus,
+                OPUS_SET_PACKET_LOSS_PERC ( encoder->chunked ? AUDIO_OPUS_LOSS_PERC :
+                    0 ) ) != OPUS_OK )
+        {
+            return -1;
+        }
+        encoder->opus_fec = encoder->chunked;
+    }
+
+    /* Frame header and length byte are followed by the packet, one chunk on direct path */
+    if ( ( len =
+            opus_encode ( encoder->opus, samples, AMRNB_SAMPLES_MAX, output + 2,
+                encoder->chunked ? AMRNB_CHUNK_MAX - 2 : AUDIO_OPUS_PAYLOAD_MAX ) ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( opus_encoder_ctl ( encoder->opus, OPUS_GET_IN_DTX ( &in_dtx ) ) != OPUS_OK )
+    {
+        in_dtx = FALSE;
+    }
+
+    /* Packet of up to two bytes carries no audio, only first one is sent to start concealment */
+    if ( len <= 2 )
+    {
+        *silent = TRUE;
+
+        if ( encoder->silent )
+        {
+            return 0;
+        }
+
+    } else
+    {
+        *silent = in_dtx;
+    }
+
+    /* Peer conceals missing frames only after frame flagged as silence */
+    output[0] = ( AUDIO_OPUS_FRAME << 3 ) | 0x04 | ( *silent ? AUDIO_OPUS_DTX_FLAG : 0 );
+    output[1] = len;
+
+    return len + 2;
+}
+
+/**
+ * Uninitialize Opus encoder backend
+ */
+void audio_opus_encoder_free ( struct audio_encoder_t *encoder )
+{
+    if ( encoder->opus )
+    {
+        opus_encoder_destroy ( ( OpusEncoder * ) encoder->opus );
+        encoder->opus = NULL;
+    }
+}
+
+/**
+ * Initialize Opus decoder backend
+ */
+int audio_opus_decoder_init ( struct nettalk_context_t *context,
+    struct audio_decoder_t *decoder )
+{
+    int err;
+
+    if ( !( decoder->opus = opus_decoder_create ( 8000, 1, &err ) ) || err != OPUS_OK )
+    {
+        nettalk_error ( context, "speaker opus init failed" );
+        audio_opus_decoder_free ( decoder );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Reset Opus decoder backend state
+ */
+int audio_opus_decoder_reset ( struct audio_decoder_t *decoder )
+{
+    return opus_decoder_ctl ( decoder->opus, OPUS_RESET_STATE ) != OPUS_OK ? -1 : 0;
+}
+
+/**
+ * Decode Opus frame, returns consumed length, zero if frame is incomplete,
+ * missing frame is concealed when input is NULL
+ */
+ssize_t audio_opus_decode ( struct audio_decoder_t *decoder, const unsigned char *input,
+    size_t len, short *samples, size_t *nsamples )
+{
+    int count;
+    int fec = 0;
+    size_t payload;
+
+    /* Packet loss concealment makes comfort noise after peer went quiet */
+    if ( !input )
+    {
+        if ( ( count =
+                opus_decode ( decoder->opus, NULL, 0, samples, AMRNB_SAMPLES_MAX, 0 ) ) < 0 )
+        {
+            return -1;
+        }
+
+        *nsamples = count;
+        return 0;
+    }
+
+    if ( len < 2 )
+    {
+        return 0;
+    }
+
+    if ( !( payload = input[1] ) || payload > AUDIO_OPUS_PAYLOAD_MAX )
+    {
+        return -1;
+    }
+
+    if ( len < payload + 2 )
+    {
+        return 0;
+    }
+
+    /* Frame lost on direct path is rebuilt from redundancy carried by this one */
+    if ( decoder->lost )
+    {
+        if ( ( fec =
+                opus_decode ( decoder->opus, input + 2, payload, samples, AMRNB_SAMPLES_MAX,
+                    1 ) ) < 0 )
+        {
+            return -1;
+        }
+
+        samples += fec;
+        decoder->lost = FALSE;
+    }
+
+    /* Packet longer than one AMR-NB frame is rejected */
+    if ( ( count =
+            opus_decode ( decoder->opus, input + 2, payload, samples, AMRNB_SAMPLES_MAX,
+                0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Gap is concealed only while peer is in DTX, jitter in speech is left to the device */
+    decoder->dtx = ( input[0] & AUDIO_OPUS_DTX_FLAG ) != 0;
+    *nsamples = fec + count;
+
+    return payload + 2;
+}
+
+/**
+ * Uninitialize Opus decoder backend
+ */
+void audio_opus_decoder_free ( struct audio_decoder_t *decoder )
+{
+    if ( decoder->opus )
+    {
+        opus_decoder_destroy ( ( OpusDecoder * ) decoder->opus );
+        decoder->opus = NULL;
+    }
+}
@@ -5,6 +5,262 @@
 #include "nettalk.h"
 #include "sound.h"
 
+/**
+ * Account CPU time per second of audio played
+ */
+static void audioplay_account ( struct nettalk_context_t *context, unsigned int rate,
+    size_t nframes, unsigned long long *cpu )
+{
+    unsigned long long now;
+
+    now = audio_thread_nanos (  );
+    nettalk_stats_add ( &context->stats.playback_cpu_ns, now - *cpu );
+    nettalk_stats_add ( &context->stats.playback_audio_ns, nframes * 1000000000ULL / rate );
+    *cpu = now;
+}
+
+/**
+ * Check if comfort noise should refill device queue while peer is silent
+ */
+static int audioplay_starving ( struct audio_speaker_t *speaker, snd_pcm_t * playback_handle )
+{
+    snd_pcm_sframes_t delay;
+
+    if ( !speaker->decoder->dtx )
+    {
+        return FALSE;
+    }
+
+    /* Device stopped by underrun has nothing queued */
+    if ( snd_pcm_delay ( playback_handle, &delay ) < 0 )
+    {
+        return TRUE;
+    }
+
+    return delay < ( snd_pcm_sframes_t ) ( AUDIO_COMFORT_QUEUE * speaker->decoder->outrate /
+        1000 );
+}
+
+/**
+ * Decode and write audio through intermediate buffer
+ */
+static int audioplay_rw ( struct nettalk_context_t *context, struct audio_speaker_t *speaker,
+    snd_pcm_t * playback_handle, void *buffer, unsigned long long *cpu )
+{
+    int err = 0;
+    int ready;
+    size_t done = 0;
+    size_t nframes = 0;
+    size_t frame_size;
+    struct pollfd fds[1];
+
+    /* Calculate PCM frame size */
+    frame_size = snd_pcm_format_width ( speaker->format ) / 8 * speaker->decoder->channels;
+
+    /* Prepare poll events */
+    fds[0].fd = context->bridge.u.s.local;
+    fds[0].events = POLLERR | POLLHUP | POLLIN;
+
+    /* Forward PCM data loop */
+    while ( context->playback_status && !session_would_reconnect ( context ) )
+    {
+        if ( done == nframes )
+        {
+            /* Peer silent after descriptor is polled often, so that comfort noise is seamless */
+            if ( ( ready = poll ( fds, 1, speaker->decoder->dtx ? AUDIO_COMFORT_POLL : 100 ) ) > 0
+                && ( fds[0].revents & ( POLLERR | POLLHUP ) ) )
+            {
+                err = -EPIPE;
+                break;
+            }
+
+            if ( ready > 0 || ( !ready && audioplay_starving ( speaker, playback_handle ) ) )
+            {
+                /* Update buffer space */
+                nframes = speaker->decoder->frames_max;
+                done = 0;
+                /* Gather PCM data */
+                if ( ( err =
+                        ( ready ? speaker->decoder->process_callback : speaker->
+                            decoder->comfort_callback ) ( context, speaker->decoder, buffer,
+                            &nframes ) ) < 0 )
+                {
+                    break;
+                }
+
+                /* Pass decoded frames to library user, it takes only float samples */
+                if ( nframes && speaker->format == SND_PCM_FORMAT_FLOAT_LE && context->callbacks
+                    && context->callbacks->on_audio )
+                {
+                    context->callbacks->on_audio ( context->user, ( const float * ) buffer,
+                        nframes * speaker->decoder->channels, speaker->decoder->outrate );
+                }
+
+                audioplay_account ( context, speaker->decoder->outrate, nframes, cpu );
+            }
+        }
+
+        /* Forward PCM data */
+        if ( nframes )
+        {
+            if ( ( err =
+                    snd_pcm_writei ( playback_handle,
+                        ( unsigned char * ) buffer + done * frame_size,
+                        nframes - done ) ) < 0 )
+            {
+                if ( ( err = snd_pcm_recover ( playback_handle, err, 0 ) ) < 0 )
+                {
+                    nettalk_error ( context, "speaker pcm write failed" );
+                    nettalk_error ( context, "%s", snd_strerror ( err ) );
+                    break;
+                }
+
+                usleep ( 100000 );
+
+            } else
+            {
+                done += err;
+            }
+        }
+    }
+
+    return err;
+}
+
+/**
+ * Decode audio directly into device ring
+ */
+static int audioplay_mmap ( struct nettalk_context_t *context, struct audio_speaker_t *speaker,
+    snd_pcm_t * playback_handle, void *buffer, unsigned long long *cpu )
+{
+    int err = 0;
+    int ready;
+    void *frames;
+    size_t nframes;
+    size_t min_space;
+    snd_pcm_sframes_t avail;
+    snd_pcm_sframes_t written;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t contig;
+    const snd_pcm_channel_area_t *areas;
+    struct pollfd fds[1];
+
+    /* Ring space for one chunk plus resampler backlog */
+    min_space = 2 * AMRNB_SAMPLES_MAX * speaker->decoder->outrate / speaker->decoder->inrate;
+
+    /* Prepare poll events */
+    fds[0].fd = context->bridge.u.s.local;
+    fds[0].events = POLLERR | POLLHUP | POLLIN;
+
+    /* Forward PCM data loop */
+    while ( context->playback_status && !session_would_reconnect ( context ) )
+    {
+        /* Check ring space, underrun is reported here */
+        if ( ( avail = snd_pcm_avail_update ( playback_handle ) ) < 0 )
+        {
+            if ( ( err = snd_pcm_recover ( playback_handle, avail, 0 ) ) < 0 )
+            {
+                nettalk_error ( context, "speaker pcm update failed" );
+                nettalk_error ( context, "%s", snd_strerror ( err ) );
+                break;
+            }
+            continue;
+        }
+
+        /* Leave data queued in socket while ring is full */
+        if ( ( size_t ) avail < min_space )
+        {
+            if ( ( err = snd_pcm_wait ( playback_handle, 100 ) ) < 0
+                && ( err = snd_pcm_recover ( playback_handle, err, 0 ) ) < 0 )
+            {
+                break;
+            }
+            continue;
+        }
+
+        /* Peer silent after descriptor is polled often, so that comfort noise is seamless */
+        if ( ( ready = poll ( fds, 1, speaker->decoder->dtx ? AUDIO_COMFORT_POLL : 100 ) ) < 0
+            || ( !ready && !audioplay_starving ( speaker, playback_handle ) ) )
+        {
+            continue;
+        }
+
+        if ( ready && ( fds[0].revents & ( POLLERR | POLLHUP ) ) )
+        {
+            err = -EPIPE;
+            break;
+        }
+
+        /* Map free part of ring */
+        contig = avail;
+
+        if ( ( err = snd_pcm_mmap_begin ( playback_handle, &areas, &offset, &contig ) ) < 0 )
+        {
+            if ( ( err = snd_pcm_recover ( playback_handle, err, 0 ) ) < 0 )
+            {
+                nettalk_error ( context, "speaker pcm map failed" );
+                nettalk_error ( context, "%s", snd_strerror ( err ) );
+                break;
+            }
+            continue;
+        }
+
+        /* Decode in place, unless ring wraps too soon */
+        if ( contig >= min_space )
+        {
+            frames =
+                ( unsigned char * ) areas[0].addr + ( areas[0].first +
+                offset * areas[0].step ) / 8;
+            nframes = contig;
+
+        } else
+        {
+            frames = buffer;
+            nframes = avail < ( snd_pcm_sframes_t ) speaker->decoder->frames_max ? ( size_t ) avail
+                : speaker->decoder->frames_max;
+        }
+
+        if ( ( err =
+                ( ready ? speaker->decoder->process_callback : speaker->
+                    decoder->comfort_callback ) ( context, speaker->decoder, frames,
+                    &nframes ) ) < 0 )
+        {
+            snd_pcm_mmap_commit ( playback_handle, offset, 0 );
+            break;
+        }
+
+        /* Pass decoded frames to library user, it takes only float samples */
+        if ( nframes && speaker->format == SND_PCM_FORMAT_FLOAT_LE && context->callbacks
+            && context->callbacks->on_audio )
+        {
+            context->callbacks->on_audio ( context->user, ( const float * ) frames,
+                nframes * speaker->decoder->channels, speaker->decoder->outrate );
+        }
+
+        /* Hand decoded frames to device, copying across ring end if needed */
+        if ( frames == buffer )
+        {
+            snd_pcm_mmap_commit ( playback_handle, offset, 0 );
+            written = nframes ? snd_pcm_mmap_writei ( playback_handle, buffer, nframes ) : 0;
+
+        } else
+        {
+            written = snd_pcm_mmap_commit ( playback_handle, offset, nframes );
+        }
+
+        if ( written < 0 && ( err = snd_pcm_recover ( playback_handle, written, 0 ) ) < 0 )
+        {
+            nettalk_error ( context, "speaker pcm commit failed" );
+            nettalk_error ( context, "%s", snd_strerror ( err ) );
+            break;
+        }
+
+        audioplay_account ( context, speaker->decoder->outrate, nframes, cpu );
+    }
+
+    return err;
+}
+
 /**
  * Begin audio playback
  */
@@ -13,16 +269,16 @@ static int audioplay_start ( struct nettalk_context_t *context, struct audio_spe
     int err = 0;
     int err1;
     unsigned int rate;
-    size_t done = 0;
-    size_t nframes;
     size_t buffer_size;
+    unsigned long long cpu;
+    unsigned long long cpu_base;
+    unsigned long long audio_base;
     snd_pcm_uframes_t size;
 
     void *buffer = NULL;
     void *zeros = NULL;
     snd_pcm_t *playback_handle;
     snd_pcm_hw_params_t *hw_params = NULL;
-    struct pollfd fds[1];
 
     /* Get request audio rate */
     rate = speaker->rate;
@@ -51,8 +307,17 @@ static int audioplay_start ( struct nettalk_context_t *context, struct audio_spe
         goto exit;
     }
 
+    /* Prefer decoding straight into device ring, some plugins support only read/write */
+    if ( speaker->mmap
+        && snd_pcm_hw_params_set_access ( playback_handle, hw_params,
+            SND_PCM_ACCESS_MMAP_INTERLEAVED ) < 0 )
+    {
+        speaker->mmap = FALSE;
+    }
+
     /* Set ALSA HW params access to read/write PCM interleaved */
-    if ( ( err =
+    if ( !speaker->mmap
+        && ( err =
             snd_pcm_hw_params_set_access ( playback_handle, hw_params,
                 SND_PCM_ACCESS_RW_INTERLEAVED ) ) < 0 )
     {
@@ -61,17 +326,16 @@ static int audioplay_start ( struct nettalk_context_t *context, struct audio_spe
         goto exit;
     }
 
-    /* Set ALSA HW params playback format to acquired PCM format */
-    if ( ( err =
-            snd_pcm_hw_params_set_format ( playback_handle, hw_params, speaker->format ) ) < 0 )
+    /* Set ALSA HW params playback format to acquired PCM format, or one the device has */
+    if ( ( err = audio_pcm_set_format ( playback_handle, hw_params, &speaker->format ) ) < 0 )
     {
         nettalk_error ( context, "speaker get playback format failed" );
         nettalk_error ( context, "%s", snd_strerror ( err ) );
         goto exit;
     }
 
-    /* Set ALSA HW params playback exact or nearest rate */
-    if ( ( err = snd_pcm_hw_params_set_rate_near ( playback_handle, hw_params, &rate, 0 ) ) < 0 )
+    /* Set ALSA HW params playback rate, AMR-NB rate multiples avoid costly resampling */
+    if ( ( err = audio_pcm_set_rate ( playback_handle, hw_params, &rate ) ) < 0 )
     {
         nettalk_error ( context, "speaker set playback rate failed" );
         nettalk_error ( context, "%s", snd_strerror ( err ) );
@@ -155,62 +419,29 @@ static int audioplay_start ( struct nettalk_context_t *context, struct audio_spe
         goto exit;
     }
 
-    nettalk_info ( context, "speaker enabled" );
-
-    /* Set initial frames count to zero */
-    nframes = 0;
+    nettalk_info ( context, "speaker enabled (%u Hz, %s access, %s, %s path)", rate,
+        speaker->mmap ? "mmap" : "write",
+        speaker->decoder->soxr ? "soxr" : speaker->decoder->fir.taps ? "polyphase fir" :
+        "no resampling", speaker->decoder->s16 ? "s16" : "float" );
 
-    /* Prepare poll events */
-    fds[0].fd = context->bridge.u.s.local;
-    fds[0].events = POLLERR | POLLHUP | POLLIN;
+    cpu_base = context->stats.playback_cpu_ns;
+    audio_base = context->stats.playback_audio_ns;
+    cpu = audio_thread_nanos (  );
 
     /* Forward PCM data loop */
-    while ( context->playback_status && !session_would_reconnect ( context ) )
+    if ( speaker->mmap )
     {
-        if ( done == nframes )
-        {
-            if ( poll ( fds, 1, 100 ) > 0 )
-            {
-                if ( fds[0].revents & ( POLLERR | POLLHUP ) )
-                {
-                    err = -EPIPE;
-                    break;
-                }
-
-                /* Update buffer space */
-                nframes = speaker->decoder->frames_max;
-                done = 0;
-                /* Gather PCM data */
-                if ( ( err =
-                        speaker->decoder->process_callback ( context, speaker->decoder, buffer,
-                            &nframes ) ) < 0 )
-                {
-                    break;
-                }
-            }
-        }
-
-        /* Forward PCM data */
-        if ( nframes )
-        {
-            if ( ( err = snd_pcm_writei ( playback_handle, buffer + done, nframes - done ) ) < 0 )
-            {
-                if ( ( err = snd_pcm_recover ( playback_handle, err, 0 ) ) < 0 )
-                {
-                    nettalk_error ( context, "speaker pcm write failed" );
-                    nettalk_error ( context, "%s", snd_strerror ( err ) );
-                    break;
-                }
-
-                usleep ( 100000 );
+        err = audioplay_mmap ( context, speaker, playback_handle, buffer, &cpu );
 
-            } else
-            {
-                done += err;
-            }
-        }
+    } else
+    {
+        err = audioplay_rw ( context, speaker, playback_handle, buffer, &cpu );
     }
 
+    audio_report_cpu ( context, speaker->decoder->s16 ? "speaker s16 path" : "speaker float path",
+        context->stats.playback_cpu_ns - cpu_base,
+        context->stats.playback_audio_ns - audio_base );
+
     /* Drain sound output */
     if ( ( err1 = snd_pcm_drain ( playback_handle ) ) < 0 )
     {
@@ -245,6 +476,100 @@ static int audioplay_start ( struct nettalk_context_t *context, struct audio_spe
     return err;
 }
 
+/**
+ * Begin decoding into group call mixer
+ */
+static int audiomix_start ( struct nettalk_context_t *context, struct audio_speaker_t *speaker )
+{
+    int err = 0;
+    int slot;
+    size_t nframes;
+    unsigned long long ns;
+    float *buffer = NULL;
+    struct pollfd fds[1];
+
+    /* Decode at mixer rate, so that resampling is done once after mixing */
+    speaker->decoder->frames_max = NETTALK_DECODE_NCHUNKS * AMRNB_SAMPLES_MAX;
+    speaker->decoder->channels = AUDIO_LAYOUT_MONO;
+    speaker->decoder->outrate = AUDIO_MIXER_RATE;
+    speaker->decoder->format = SND_PCM_FORMAT_FLOAT_LE;
+
+    if ( ( slot = audio_mixer_join ( context->mixer ) ) < 0 )
+    {
+        nettalk_errcode ( context, "group call is full", errno );
+        return -1;
+    }
+
+    /* Initialize decoder */
+    if ( ( err = speaker->decoder->init_callback ( context, speaker->decoder ) ) < 0 )
+    {
+        audio_mixer_leave ( context->mixer, slot );
+        return err;
+    }
+
+    /* Allocate PCM buffer */
+    if ( !( buffer = ( float * ) malloc ( speaker->decoder->frames_max * sizeof ( float ) ) ) )
+    {
+        nettalk_errcode ( context, "speaker buffer alloc failed", errno );
+        err = -ENOMEM;
+        goto exit;
+    }
+
+    context->mixer_slot = slot;
+    nettalk_info ( context, "joined group call" );
+
+    /* Prepare poll events */
+    fds[0].fd = context->bridge.u.s.local;
+    fds[0].events = POLLERR | POLLHUP | POLLIN;
+
+    /* Forward PCM data loop */
+    while ( context->playback_status && !session_would_reconnect ( context ) )
+    {
+        if ( poll ( fds, 1, 100 ) > 0 )
+        {
+            if ( fds[0].revents & ( POLLERR | POLLHUP ) )
+            {
+                err = -EPIPE;
+                break;
+            }
+
+            nframes = speaker->decoder->frames_max;
+            ns = audio_thread_nanos (  );
+
+            if ( ( err =
+                    speaker->decoder->process_callback ( context, speaker->decoder, buffer,
+                        &nframes ) ) < 0 )
+            {
+                break;
+            }
+
+            if ( nframes )
+            {
+                audio_mixer_push ( context->mixer, slot, buffer, nframes,
+                    audio_thread_nanos (  ) - ns );
+
+                /* Pass decoded frames to library user */
+                if ( context->callbacks && context->callbacks->on_audio )
+                {
+                    context->callbacks->on_audio ( context->user, buffer, nframes,
+                        AUDIO_MIXER_RATE );
+                }
+            }
+        }
+    }
+
+    nettalk_info ( context, "left group call" );
+
+  exit:
+
+    context->mixer_slot = -1;
+    audio_mixer_leave ( context->mixer, slot );
+    speaker->decoder->free_callback ( speaker->decoder );
+    free ( buffer );
+
+    return err;
+}
+
 /**
  * Forward text messages only
  */
@@ -310,6 +635,11 @@ static void playback_fallback ( struct nettalk_context_t *context )
                     {
                     }
 
+                } else if ( !memcmp ( input + input_pos, caps_chunk, 24 ) )
+                {
+                    audio_codec_peer_caps ( context, input + input_pos );
+                    len = AMRNB_CHUNK_MAX;
+
                 } else
                 {
                     len = 1;
@@ -352,16 +682,20 @@ static void voiceplay_cycle ( struct nettalk_context_t *context )
     memset ( &decoder, '\0', sizeof ( decoder ) );
     decoder.init_callback = nettalk_audio_decoder_init;
     decoder.process_callback = nettalk_decode_audio;
+    decoder.comfort_callback = nettalk_decode_comfort_noise;
     decoder.free_callback = nettalk_audio_decoder_free;
 
     memset ( &speaker, '\0', sizeof ( speaker ) );
     strncpy ( speaker.dev, ALSA_DEFAULT_DEV, sizeof ( speaker.dev ) );
     speaker.channels = AUDIO_LAYOUT_MONO;
-    speaker.rate = AUDIO_RATE_DEFAULT;
-    speaker.format = SND_PCM_FORMAT_FLOAT_LE;
+    speaker.rate = context->audio_rate;
+    speaker.format = context->audio_float || ( context->callbacks
+        && context->callbacks->on_audio ) ? SND_PCM_FORMAT_FLOAT_LE : SND_PCM_FORMAT_S16_LE;
+    speaker.mmap = !context->alsa_rw;
     speaker.decoder = &decoder;
 
-    if ( audioplay_start ( context, &speaker ) < 0 )
+    if ( ( context->mixer ? audiomix_start ( context, &speaker ) : audioplay_start ( context,
+                &speaker ) ) < 0 )
     {
         if ( !session_would_reconnect ( context ) )
         {
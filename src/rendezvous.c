@@ -0,0 +1,35 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Relay Rendezvous Hash
+ * ------------------------------------------------------------------ */
+
+#include "rendezvous.h"
+
+/**
+ * Calculate rendezvous hash score of relay for channel
+ */
+uint64_t nettalk_relay_score ( const char *channel, const char *hostname, unsigned short port )
+{
+    const char *ptr;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    /* FNV-1a over channel id, hostname and port */
+    for ( ptr = channel; *ptr; ptr++ )
+    {
+        hash = ( hash ^ ( uint8_t ) * ptr ) * 0x100000001b3ULL;
+    }
+
+    for ( ptr = hostname; *ptr; ptr++ )
+    {
+        hash = ( hash ^ ( uint8_t ) * ptr ) * 0x100000001b3ULL;
+    }
+
+    hash = ( hash ^ ( port >> 8 ) ) * 0x100000001b3ULL;
+    hash = ( hash ^ ( port & 0xff ) ) * 0x100000001b3ULL;
+
+    /* Final avalanche mix */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
@@ -0,0 +1,279 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Polyphase Resampler
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Calculate greatest common divisor
+ */
+static unsigned int audio_fir_gcd ( unsigned int a, unsigned int b )
+{
+    unsigned int c;
+
+    while ( b )
+    {
+        c = a % b;
+        a = b;
+        b = c;
+    }
+
+    return a;
+}
+
+/**
+ * Calculate dot product of taps and delay line
+ */
+static float audio_fir_dot ( const float *taps, const float *line, size_t count )
+{
+    size_t i;
+    float sum = 0;
+
+    for ( i = 0; i < count; i++ )
+    {
+        sum += taps[i] * line[i];
+    }
+
+    return sum;
+}
+
+/**
+ * Calculate Q14 dot product of taps and delay line with rounding and saturation
+ */
+static short audio_fir_dot_s16 ( const short *taps, const short *line, size_t count )
+{
+    size_t i = 0;
+    int sum = 1 << 13;
+
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128 (  );
+
+    for ( ; i + 8 <= count; i += 8 )
+    {
+        acc = _mm_add_epi32 ( acc, _mm_madd_epi16 ( _mm_loadu_si128 ( ( const __m128i * ) ( taps +
+                        i ) ), _mm_loadu_si128 ( ( const __m128i * ) ( line + i ) ) ) );
+    }
+
+    acc = _mm_add_epi32 ( acc, _mm_shuffle_epi32 ( acc, _MM_SHUFFLE ( 1, 0, 3, 2 ) ) );
+    acc = _mm_add_epi32 ( acc, _mm_shuffle_epi32 ( acc, _MM_SHUFFLE ( 2, 3, 0, 1 ) ) );
+    sum += _mm_cvtsi128_si32 ( acc );
+#elif defined(__ARM_NEON)
+    int32x4_t acc = vdupq_n_s32 ( 0 );
+
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        acc = vmlal_s16 ( acc, vld1_s16 ( taps + i ), vld1_s16 ( line + i ) );
+    }
+
+    sum += vgetq_lane_s32 ( acc, 0 ) + vgetq_lane_s32 ( acc, 1 ) + vgetq_lane_s32 ( acc, 2 )
+        + vgetq_lane_s32 ( acc, 3 );
+#endif
+
+    /* Absolute phase taps add up to about two, so full scale input fits 32 bits */
+    for ( ; i < count; i++ )
+    {
+        sum += taps[i] * line[i];
+    }
+
+    sum >>= 14;
+
+    return sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum;
+}
+
+/**
+ * Initialize polyphase resampler
+ */
+int audio_fir_init ( struct audio_fir_t *fir, unsigned int inrate, unsigned int outrate )
+{
+    size_t i;
+    size_t p;
+    size_t ntaps;
+    unsigned int gcd;
+    unsigned int factor;
+    double x;
+    double sum;
+    double cutoff;
+    double center;
+    double *taps;
+
+    memset ( fir, '\0', sizeof ( struct audio_fir_t ) );
+
+    if ( !inrate || !outrate || inrate == outrate )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Upsample by L, filter, downsample by M */
+    gcd = audio_fir_gcd ( inrate, outrate );
+    fir->up = outrate / gcd;
+    fir->down = inrate / gcd;
+    factor = fir->up > fir->down ? fir->up : fir->down;
+
+    if ( factor > AUDIO_FIR_FACTOR_MAX )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Each output sample takes same number of taps from every phase */
+    fir->len = AUDIO_FIR_ORDER * factor / fir->up + 1;
+    ntaps = fir->len * fir->up;
+
+    if ( !( taps = ( double * ) malloc ( ntaps * sizeof ( double ) ) ) )
+    {
+        return -1;
+    }
+
+    if ( !( fir->taps = ( float * ) malloc ( ntaps * sizeof ( float ) ) )
+        || !( fir->line = ( float * ) calloc ( 2 * fir->len, sizeof ( float ) ) ) )
+    {
+        free ( taps );
+        audio_fir_free ( fir );
+        return -1;
+    }
+
+    /* Blackman windowed sinc at 95% of lower Nyquist rate */
+    cutoff = 0.475 / factor;
+    center = ( ntaps - 1 ) / 2.0;
+
+    for ( i = 0, sum = 0; i < ntaps; i++ )
+    {
+        x = i - center;
+        taps[i] = x ? sin ( 2 * M_PI * cutoff * x ) / ( M_PI * x ) : 2 * cutoff;
+        taps[i] *= 0.42 - 0.5 * cos ( 2 * M_PI * i / ( ntaps - 1 ) )
+            + 0.08 * cos ( 4 * M_PI * i / ( ntaps - 1 ) );
+        sum += taps[i];
+    }
+
+    /* Split taps into phases, each one sees every L-th upsampled sample */
+    for ( p = 0; p < fir->up; p++ )
+    {
+        for ( i = 0; i < fir->len; i++ )
+        {
+            fir->taps[p * fir->len + i] = taps[i * fir->up + p] * fir->up / sum;
+        }
+    }
+
+    fir->ntaps = ntaps;
+    free ( taps );
+
+    return 0;
+}
+
+/**
+ * Initialize polyphase resampler with additional Q14 taps for short samples
+ */
+int audio_fir_init_s16 ( struct audio_fir_t *fir, unsigned int inrate, unsigned int outrate )
+{
+    size_t i;
+    long tap;
+
+    if ( audio_fir_init ( fir, inrate, outrate ) < 0 )
+    {
+        return -1;
+    }
+
+    if ( !( fir->taps16 = ( short * ) malloc ( fir->ntaps * sizeof ( short ) ) )
+        || !( fir->line16 = ( short * ) calloc ( 2 * fir->len, sizeof ( short ) ) ) )
+    {
+        audio_fir_free ( fir );
+        return -1;
+    }
+
+    for ( i = 0; i < fir->ntaps; i++ )
+    {
+        tap = lrint ( fir->taps[i] * 16384.0 );
+        fir->taps16[i] = tap > 32767 ? 32767 : tap < -32768 ? -32768 : tap;
+    }
+
+    return 0;
+}
+
+/**
+ * Resample with polyphase filter, returns output frames count
+ */
+size_t audio_fir_process ( struct audio_fir_t *fir, const float *input, size_t count,
+    float *output )
+{
+    size_t i;
+    size_t n = 0;
+
+    for ( i = 0; i < count; i++ )
+    {
+        /* Newest sample goes first, mirrored copy keeps window contiguous */
+        fir->pos = fir->pos ? fir->pos - 1 : fir->len - 1;
+        fir->line[fir->pos] = input[i];
+        fir->line[fir->pos + fir->len] = input[i];
+
+        /* Emit outputs falling between this and next input sample */
+        for ( ; fir->phase < fir->up; fir->phase += fir->down )
+        {
+            output[n++] =
+                audio_fir_dot ( fir->taps + fir->phase * fir->len, fir->line + fir->pos,
+                fir->len );
+        }
+
+        fir->phase -= fir->up;
+    }
+
+    return n;
+}
+
+/**
+ * Resample short samples with Q14 polyphase filter, returns output frames count
+ */
+size_t audio_fir_process_s16 ( struct audio_fir_t *fir, const short *input, size_t count,
+    short *output )
+{
+    size_t i;
+    size_t n = 0;
+
+    for ( i = 0; i < count; i++ )
+    {
+        fir->pos = fir->pos ? fir->pos - 1 : fir->len - 1;
+        fir->line16[fir->pos] = input[i];
+        fir->line16[fir->pos + fir->len] = input[i];
+
+        for ( ; fir->phase < fir->up; fir->phase += fir->down )
+        {
+            output[n++] =
+                audio_fir_dot_s16 ( fir->taps16 + fir->phase * fir->len, fir->line16 + fir->pos,
+                fir->len );
+        }
+
+        fir->phase -= fir->up;
+    }
+
+    return n;
+}
+
+/**
+ * Get polyphase resampler delay in input frames
+ */
+double audio_fir_delay ( const struct audio_fir_t *fir )
+{
+    return ( fir->ntaps - 1 ) / 2.0 / fir->up;
+}
+
+/**
+ * Uninitialize polyphase resampler
+ */
+void audio_fir_free ( struct audio_fir_t *fir )
+{
+    free ( fir->taps );
+    fir->taps = NULL;
+    free ( fir->line );
+    fir->line = NULL;
+    free ( fir->taps16 );
+    fir->taps16 = NULL;
+    free ( fir->line16 );
+    fir->line16 = NULL;
+}
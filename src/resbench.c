@@ -0,0 +1,448 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Resampler Benchmark
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+#include "sound.h"
+
+#define RESBENCH_BLOCK_MS 20
+#define RESBENCH_FRAME 256
+#define RESBENCH_NBINS ( RESBENCH_FRAME / 2 )
+
+/**
+ * Benchmarked resampler profile
+ */
+struct resbench_profile_t
+{
+    const char *name;
+    unsigned long recipe;
+    unsigned long flags;
+    int s16;
+};
+
+/**
+ * Benchmarked profiles, first soxr one is the quality reference
+ */
+static const struct resbench_profile_t profiles[] = {
+    {"very-high-dp", SOXR_VHQ, SOXR_DOUBLE_PRECISION, FALSE},
+    {"very-high", SOXR_VHQ, 0, FALSE},
+    {"high-dp", SOXR_HQ, SOXR_DOUBLE_PRECISION, FALSE},
+    {"high", SOXR_HQ, 0, FALSE},
+    {"medium", SOXR_MQ, 0, FALSE},
+    {"low", SOXR_LQ, 0, FALSE},
+    {"high-s16", SOXR_HQ, 0, TRUE},
+    {"fir", 0, 0, FALSE},
+    {"fir-s16", 0, 0, TRUE}
+};
+
+/**
+ * Sound signal buffer
+ */
+struct resbench_signal_t
+{
+    float *samples;
+    size_t len;
+    unsigned int rate;
+};
+
+/**
+ * Get thread CPU time in nanoseconds
+ */
+static unsigned long long resbench_nanos ( void )
+{
+    struct timespec ts;
+
+    if ( clock_gettime ( CLOCK_THREAD_CPUTIME_ID, &ts ) < 0 )
+    {
+        return 0;
+    }
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Load raw S16_LE mono corpus file
+ */
+static int resbench_load ( const char *path, struct resbench_signal_t *signal )
+{
+    FILE *file;
+    size_t i;
+    size_t len;
+    long size;
+    short *raw;
+
+    if ( !( file = fopen ( path, "rb" ) ) )
+    {
+        return -1;
+    }
+
+    if ( fseek ( file, 0, SEEK_END ) < 0 || ( size = ftell ( file ) ) < 0
+        || fseek ( file, 0, SEEK_SET ) < 0 )
+    {
+        fclose ( file );
+        return -1;
+    }
+
+    len = size / sizeof ( short );
+
+    if ( !( raw = ( short * ) malloc ( len * sizeof ( short ) ) ) )
+    {
+        fclose ( file );
+        return -1;
+    }
+
+    if ( fread ( raw, sizeof ( short ), len, file ) != len
+        || !( signal->samples = ( float * ) malloc ( len * sizeof ( float ) ) ) )
+    {
+        free ( raw );
+        fclose ( file );
+        return -1;
+    }
+
+    for ( i = 0; i < len; i++ )
+    {
+        signal->samples[i] = raw[i] / 32768.0f;
+    }
+
+    signal->len = len;
+    free ( raw );
+    fclose ( file );
+
+    return 0;
+}
+
+/**
+ * Resample whole signal in capture-sized blocks, returns CPU nanoseconds
+ */
+static long long resbench_run ( const struct resbench_profile_t *profile,
+    const struct resbench_signal_t *input, unsigned int outrate,
+    struct resbench_signal_t *output )
+{
+    size_t pos;
+    size_t block;
+    size_t odone;
+    size_t idone;
+    size_t capacity;
+    unsigned long long ns;
+    short *input16 = NULL;
+    short *output16 = NULL;
+    soxr_t soxr = NULL;
+    soxr_error_t soxr_error;
+    soxr_io_spec_t io_spec;
+    soxr_quality_spec_t q_spec;
+    struct audio_fir_t fir;
+
+    block = input->rate * RESBENCH_BLOCK_MS / 1000;
+    capacity = ( size_t ) ( ( double ) input->len * outrate / input->rate ) + block * 8 + 64;
+
+    if ( !( output->samples = ( float * ) malloc ( capacity * sizeof ( float ) ) ) )
+    {
+        return -1;
+    }
+
+    output->len = 0;
+    output->rate = outrate;
+
+    /* Short sample profiles get device format, conversion is not timed */
+    if ( profile->s16 )
+    {
+        if ( !( input16 = ( short * ) malloc ( input->len * sizeof ( short ) ) )
+            || !( output16 = ( short * ) malloc ( capacity * sizeof ( short ) ) ) )
+        {
+            free ( input16 );
+            free ( output->samples );
+            return -1;
+        }
+
+        audio_float_to_short_array ( input->samples, input16, input->len );
+    }
+
+    if ( profile->recipe )
+    {
+        q_spec = soxr_quality_spec ( profile->recipe, profile->flags );
+        io_spec =
+            soxr_io_spec ( profile->s16 ? SOXR_INT16_I : SOXR_FLOAT32_I,
+            profile->s16 ? SOXR_INT16_I : SOXR_FLOAT32_I );
+        soxr =
+            soxr_create ( input->rate, outrate, AUDIO_LAYOUT_MONO, &soxr_error, &io_spec,
+            &q_spec, NULL );
+
+    } else if ( profile->s16 )
+    {
+        audio_fir_init_s16 ( &fir, input->rate, outrate );
+
+    } else
+    {
+        audio_fir_init ( &fir, input->rate, outrate );
+    }
+
+    /* Failed filter init leaves no taps */
+    if ( profile->recipe ? !soxr || soxr_error : !fir.taps )
+    {
+        free ( input16 );
+        free ( output16 );
+        free ( output->samples );
+        return -1;
+    }
+
+    ns = resbench_nanos (  );
+
+    for ( pos = 0; pos < input->len; pos += block )
+    {
+        if ( block > input->len - pos )
+        {
+            block = input->len - pos;
+        }
+
+        if ( soxr && profile->s16 )
+        {
+            if ( soxr_process ( soxr, input16 + pos, block, &idone, output16 + output->len,
+                    capacity - output->len, &odone ) )
+            {
+                break;
+            }
+
+        } else if ( soxr )
+        {
+            if ( soxr_process ( soxr, input->samples + pos, block, &idone,
+                    output->samples + output->len, capacity - output->len, &odone ) )
+            {
+                break;
+            }
+
+        } else if ( profile->s16 )
+        {
+            odone = audio_fir_process_s16 ( &fir, input16 + pos, block, output16 + output->len );
+
+        } else
+        {
+            odone = audio_fir_process ( &fir, input->samples + pos, block,
+                output->samples + output->len );
+        }
+
+        output->len += odone;
+    }
+
+    ns = resbench_nanos (  ) - ns;
+
+    if ( profile->s16 )
+    {
+        audio_short_to_float_array ( output16, output->samples, output->len );
+        free ( input16 );
+        free ( output16 );
+    }
+
+    /* Filter delay is compensated by soxr, drop it here for fair comparison */
+    if ( soxr )
+    {
+        soxr_delete ( soxr );
+
+    } else
+    {
+        odone = ( size_t ) ( audio_fir_delay ( &fir ) * outrate / input->rate + 0.5 );
+        odone = odone < output->len ? odone : output->len;
+        memmove ( output->samples, output->samples + odone,
+            ( output->len - odone ) * sizeof ( float ) );
+        output->len -= odone;
+        audio_fir_free ( &fir );
+    }
+
+    return ns;
+}
+
+/**
+ * Calculate log power spectrum of one Hann windowed frame
+ */
+static void resbench_spectrum ( const float *samples, double *power )
+{
+    size_t k;
+    size_t n;
+    double w;
+    double re;
+    double im;
+
+    for ( k = 0; k < RESBENCH_NBINS; k++ )
+    {
+        for ( n = 0, re = 0, im = 0; n < RESBENCH_FRAME; n++ )
+        {
+            w = samples[n] * ( 0.5 - 0.5 * cos ( 2 * M_PI * n / RESBENCH_FRAME ) );
+            re += w * cos ( 2 * M_PI * k * n / RESBENCH_FRAME );
+            im -= w * sin ( 2 * M_PI * k * n / RESBENCH_FRAME );
+        }
+
+        power[k] = 10 * log10 ( re * re + im * im + 1e-10 );
+    }
+}
+
+/**
+ * Calculate log-spectral distance in dB between signal and reference
+ */
+static double resbench_distance ( const struct resbench_signal_t *signal,
+    const struct resbench_signal_t *reference )
+{
+    size_t k;
+    size_t pos;
+    size_t len;
+    size_t nframes = 0;
+    double sum = 0;
+    double frame;
+    double a[RESBENCH_NBINS];
+    double b[RESBENCH_NBINS];
+
+    len = signal->len < reference->len ? signal->len : reference->len;
+
+    for ( pos = 0; pos + RESBENCH_FRAME <= len; pos += RESBENCH_FRAME )
+    {
+        resbench_spectrum ( signal->samples + pos, a );
+        resbench_spectrum ( reference->samples + pos, b );
+
+        for ( k = 0, frame = 0; k < RESBENCH_NBINS; k++ )
+        {
+            frame += ( a[k] - b[k] ) * ( a[k] - b[k] );
+        }
+
+        sum += sqrt ( frame / RESBENCH_NBINS );
+        nframes++;
+    }
+
+    return nframes ? sum / nframes : 0;
+}
+
+/**
+ * Benchmark one direction for all profiles
+ */
+static int resbench_direction ( const char *title, const struct resbench_signal_t *input,
+    unsigned int outrate )
+{
+    size_t i;
+    long long ns;
+    short *quantized;
+    struct resbench_signal_t reference;
+    struct resbench_signal_t reference16;
+    struct resbench_signal_t output;
+
+    printf ( "%s (%u Hz -> %u Hz)\n", title, input->rate, outrate );
+    printf ( "  %-14s %12s %14s\n", "profile", "ns/sample", "lsd vs ref dB" );
+
+    if ( resbench_run ( &profiles[0], input, outrate, &reference ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Short sample profiles are compared with reference as S16 device would get it */
+    reference16 = reference;
+
+    if ( !( reference16.samples = ( float * ) malloc ( reference.len * sizeof ( float ) ) )
+        || !( quantized = ( short * ) malloc ( reference.len * sizeof ( short ) ) ) )
+    {
+        free ( reference16.samples );
+        free ( reference.samples );
+        return -1;
+    }
+
+    audio_float_to_short_array ( reference.samples, quantized, reference.len );
+    audio_short_to_float_array ( quantized, reference16.samples, reference.len );
+    free ( quantized );
+
+    for ( i = 0; i < sizeof ( profiles ) / sizeof ( struct resbench_profile_t ); i++ )
+    {
+        if ( ( ns = resbench_run ( &profiles[i], input, outrate, &output ) ) < 0 )
+        {
+            printf ( "  %-14s %12s\n", profiles[i].name, "n/a" );
+            continue;
+        }
+
+        printf ( "  %-14s %12.2f %14.3f\n", profiles[i].name, ( double ) ns / input->len,
+            resbench_distance ( &output, profiles[i].s16 ? &reference16 : &reference ) );
+        free ( output.samples );
+    }
+
+    free ( reference16.samples );
+    free ( reference.samples );
+    return 0;
+}
+
+/**
+ * Show program usage message
+ */
+static void show_usage ( void )
+{
+    fprintf ( stderr, "\n" "usage: nettalk-resbench [-r rate] corpus.raw...\n\n"
+        "corpus files are raw S16_LE mono speech at 8000 Hz\n\n" );
+}
+
+/**
+ * Program entry point
+ */
+int main ( int argc, char *argv[] )
+{
+    int i;
+    int arg_off = 1;
+    size_t len;
+    unsigned int rate = AUDIO_RATE_DEFAULT;
+    struct resbench_signal_t corpus = { NULL, 0, 8000 };
+    struct resbench_signal_t file;
+    struct resbench_signal_t device;
+
+    if ( argc > 2 && !strcmp ( argv[1], "-r" ) )
+    {
+        if ( sscanf ( argv[2], "%u", &rate ) <= 0 || rate < 8000 || rate > 192000 )
+        {
+            show_usage (  );
+            return 1;
+        }
+        arg_off = 3;
+    }
+
+    if ( arg_off >= argc )
+    {
+        show_usage (  );
+        return 1;
+    }
+
+    /* Join all corpus files into one signal */
+    for ( i = arg_off; i < argc; i++ )
+    {
+        if ( resbench_load ( argv[i], &file ) < 0 )
+        {
+            fprintf ( stderr, "Error: cannot load '%s'.\n", argv[i] );
+            return 1;
+        }
+
+        len = corpus.len + file.len;
+
+        if ( !( corpus.samples =
+                ( float * ) realloc ( corpus.samples, len * sizeof ( float ) ) ) )
+        {
+            return 1;
+        }
+
+        memcpy ( corpus.samples + corpus.len, file.samples, file.len * sizeof ( float ) );
+        corpus.len = len;
+        free ( file.samples );
+    }
+
+    printf ( "corpus: %.1f s of speech\n", corpus.len / 8000.0 );
+
+    /* Playback path: decoded AMR-NB to device rate */
+    if ( resbench_direction ( "playback", &corpus, rate ) < 0 )
+    {
+        return 1;
+    }
+
+    /* Capture path: device rate speech made by reference resampler */
+    if ( resbench_run ( &profiles[0], &corpus, rate, &device ) < 0 )
+    {
+        return 1;
+    }
+
+    if ( resbench_direction ( "capture", &device, 8000 ) < 0 )
+    {
+        return 1;
+    }
+
+    free ( device.samples );
+    free ( corpus.samples );
+
+    return 0;
+}
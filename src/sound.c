@@ -5,81 +5,258 @@
 #include "nettalk.h"
 #include "sound.h"
 
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 /**
- * Convert float array to short integer array
+ * Add float array to float array
  */
-void audio_float_to_short_array ( const float *input, short *output, int count )
+void audio_mix_float_array ( const float *input, float *output, int count )
 {
-    double scaled_value;
+    int i = 0;
 
-    while ( count )
+#if defined(__SSE__)
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        _mm_storeu_ps ( output + i, _mm_add_ps ( _mm_loadu_ps ( output + i ),
+                _mm_loadu_ps ( input + i ) ) );
+    }
+#elif defined(__ARM_NEON)
+    for ( ; i + 4 <= count; i += 4 )
     {
-        count--;
-        scaled_value = input[count] * ( 8.0 * 0x10000000 );
+        vst1q_f32 ( output + i, vaddq_f32 ( vld1q_f32 ( output + i ), vld1q_f32 ( input + i ) ) );
+    }
+#endif
 
-        if ( scaled_value >= ( 1.0 * 0x7FFFFFFF ) )
-        {
-            output[count] = 32767;
+    for ( ; i < count; i++ )
+    {
+        output[i] += input[i];
+    }
+}
+
+/**
+ * Subtract float array from float array
+ */
+void audio_mix_minus_float_array ( const float *total, const float *own, float *output,
+    int count )
+{
+    int i = 0;
+
+#if defined(__SSE__)
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        _mm_storeu_ps ( output + i, _mm_sub_ps ( _mm_loadu_ps ( total + i ),
+                _mm_loadu_ps ( own + i ) ) );
+    }
+#elif defined(__ARM_NEON)
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        vst1q_f32 ( output + i, vsubq_f32 ( vld1q_f32 ( total + i ), vld1q_f32 ( own + i ) ) );
+    }
+#endif
+
+    for ( ; i < count; i++ )
+    {
+        output[i] = total[i] - own[i];
+    }
+}
+
+/**
+ * Saturate float array to [-1.0, 1.0] range
+ */
+void audio_clip_float_array ( float *samples, int count )
+{
+    int i = 0;
+
+#if defined(__SSE__)
+    const __m128 hi = _mm_set1_ps ( 1.0f );
+    const __m128 lo = _mm_set1_ps ( -1.0f );
+
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        _mm_storeu_ps ( samples + i, _mm_max_ps ( lo, _mm_min_ps ( hi,
+                    _mm_loadu_ps ( samples + i ) ) ) );
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t hi = vdupq_n_f32 ( 1.0f );
+    const float32x4_t lo = vdupq_n_f32 ( -1.0f );
 
-        } else if ( scaled_value <= ( -8.0 * 0x10000000 ) )
+    for ( ; i + 4 <= count; i += 4 )
+    {
+        vst1q_f32 ( samples + i, vmaxq_f32 ( lo, vminq_f32 ( hi, vld1q_f32 ( samples + i ) ) ) );
+    }
+#endif
+
+    for ( ; i < count; i++ )
+    {
+        if ( samples[i] > 1.0f )
         {
-            output[count] = -32768;
+            samples[i] = 1.0f;
 
-        } else
+        } else if ( samples[i] < -1.0f )
         {
-            output[count] = ( short ) ( lrint ( scaled_value ) >> 16 );
+            samples[i] = -1.0f;
         }
     }
 }
 
 /**
- * Convert float array to integer array
+ * Get thread CPU time in nanoseconds
  */
-void audio_float_to_int_array ( const float *input, int *output, int count )
+unsigned long long audio_thread_nanos ( void )
 {
-    double scaled_value;
+    struct timespec ts;
 
-    while ( count )
+    if ( clock_gettime ( CLOCK_THREAD_CPUTIME_ID, &ts ) < 0 )
     {
-        count--;
-        scaled_value = input[count] * ( 8.0 * 0x10000000 );
+        return 0;
+    }
 
-        if ( scaled_value >= ( 1.0 * 0x7FFFFFFF ) )
-        {
-            output[count] = 2147483647;
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Negotiate device rate, preferring AMR-NB rate or its integer multiple
+ */
+int audio_pcm_set_rate ( snd_pcm_t * handle, snd_pcm_hw_params_t * hw_params,
+    unsigned int *rate )
+{
+    size_t i;
+    static const unsigned int rates[] = { 8000, 16000, 24000, 32000, 48000 };
+
+    /* Explicitly requested rate is taken as before */
+    if ( *rate )
+    {
+        return snd_pcm_hw_params_set_rate_near ( handle, hw_params, rate, 0 );
+    }
 
-        } else if ( scaled_value <= ( -8.0 * 0x10000000 ) )
+    /* Look for rate which device runs without plugin resampling */
+    if ( snd_pcm_hw_params_set_rate_resample ( handle, hw_params, 0 ) >= 0 )
+    {
+        for ( i = 0; i < sizeof ( rates ) / sizeof ( unsigned int ); i++ )
         {
-            output[count] = -2147483648;
+            if ( !snd_pcm_hw_params_test_rate ( handle, hw_params, rates[i], 0 )
+                && snd_pcm_hw_params_set_rate ( handle, hw_params, rates[i], 0 ) >= 0 )
+            {
+                *rate = rates[i];
+                return 0;
+            }
+        }
 
-        } else
+        snd_pcm_hw_params_set_rate_resample ( handle, hw_params, 1 );
+    }
+
+    /* Fall back to common rate resampled with soxr */
+    *rate = AUDIO_RATE_DEFAULT;
+    return snd_pcm_hw_params_set_rate_near ( handle, hw_params, rate, 0 );
+}
+
+/**
+ * Set device sample format, falling back to other formats converters handle
+ */
+int audio_pcm_set_format ( snd_pcm_t * handle, snd_pcm_hw_params_t * hw_params,
+    snd_pcm_format_t * format )
+{
+    size_t i;
+    static const snd_pcm_format_t formats[] = {
+        SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_FLOAT_LE, SND_PCM_FORMAT_S32_LE
+    };
+
+    if ( !snd_pcm_hw_params_test_format ( handle, hw_params, *format ) )
+    {
+        return snd_pcm_hw_params_set_format ( handle, hw_params, *format );
+    }
+
+    for ( i = 0; i < sizeof ( formats ) / sizeof ( snd_pcm_format_t ); i++ )
+    {
+        if ( !snd_pcm_hw_params_test_format ( handle, hw_params, formats[i] ) )
         {
-            output[count] = lrint ( scaled_value );
+            *format = formats[i];
+            return snd_pcm_hw_params_set_format ( handle, hw_params, *format );
         }
     }
+
+    return snd_pcm_hw_params_set_format ( handle, hw_params, *format );
 }
 
 /**
- * Convert short integer array to float array
+ * Log thread CPU time used per second of audio
  */
-void audio_short_to_float_array ( const short *input, float *output, int count )
+void audio_report_cpu ( struct nettalk_context_t *context, const char *name,
+    unsigned long long cpu_ns, unsigned long long audio_ns )
 {
-    /* Rescale and save samples values */
-    while ( count )
+    if ( audio_ns >= 1000000000ULL )
     {
-        count--;
-        output[count] = ( ( float ) input[count] ) / ( 1.0 * 0x8000 );
+        nettalk_info ( context, "%s used %llu us of CPU per second of audio", name,
+            cpu_ns * 1000000ULL / audio_ns );
     }
 }
 
 /**
- * Convert integer array to float array
+ * Create resampler selected by profile
  */
-void audio_int_to_float_array ( const int *input, float *output, int count )
+int audio_resampler_init ( struct nettalk_context_t *context, const char *name,
+    unsigned int inrate, unsigned int outrate, int s16, soxr_t * soxr, struct audio_fir_t *fir )
 {
-    while ( count )
+    int status;
+    soxr_error_t soxr_error;
+    soxr_io_spec_t io_spec;
+    soxr_quality_spec_t q_spec;
+    static const unsigned long recipes[] = { SOXR_HQ, SOXR_LQ, SOXR_MQ, SOXR_HQ, SOXR_VHQ };
+
+    *soxr = NULL;
+    fir->taps = NULL;
+    fir->line = NULL;
+    fir->taps16 = NULL;
+    fir->line16 = NULL;
+
+    if ( inrate == outrate )
     {
-        count--;
-        output[count] = ( ( float ) input[count] ) / ( 8.0 * 0x10000000 );
+        return 0;
     }
+
+    /* Fixed ratio polyphase filter, soxr high quality if ratio is too odd */
+    if ( context->resampler == NETTALK_RESAMPLER_FIR )
+    {
+        status =
+            s16 ? audio_fir_init_s16 ( fir, inrate, outrate ) : audio_fir_init ( fir, inrate,
+            outrate );
+
+        if ( status >= 0 )
+        {
+            return 0;
+        }
+
+        if ( errno != EINVAL )
+        {
+            nettalk_errcode ( context, "resampler alloc failed", errno );
+            return -1;
+        }
+    }
+
+    /* Select resample filter quality */
+    q_spec =
+        soxr_quality_spec ( recipes[context->resampler],
+        context->resampler_double ? SOXR_DOUBLE_PRECISION : 0 );
+
+    /* Short samples go in and out as is, soxr converts them internally */
+    io_spec = soxr_io_spec ( s16 ? SOXR_INT16_I : SOXR_FLOAT32_I, s16 ? SOXR_INT16_I :
+        SOXR_FLOAT32_I );
+
+    /* Initialize SOXR resampler */
+    *soxr =
+        soxr_create ( inrate, outrate, AUDIO_LAYOUT_MONO, &soxr_error, &io_spec, &q_spec, NULL );
+
+    /* Check for error */
+    if ( !*soxr || soxr_error )
+    {
+        nettalk_error ( context, "%s soxr init failed (%s)", name, soxr_error );
+        *soxr = NULL;
+        return -1;
+    }
+
+    return 0;
 }
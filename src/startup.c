@@ -3,104 +3,7 @@
  * ------------------------------------------------------------------ */
 
 #include "nettalk.h"
-
-/**
- * Initialize application context
- */
-static int nettalk_init ( struct nettalk_context_t *context )
-{
-    context->nmessages = 0;
-    context->online = FALSE;
-    context->playback_status = FALSE;
-    context->playback_status_timestamp.tv_sec = 0;
-    context->playback_status_timestamp.tv_usec = 0;
-    context->capture_status = FALSE;
-    context->capture_status_timestamp.tv_sec = 0;
-    context->capture_status_timestamp.tv_usec = 0;
-    context->playback_preset = FALSE;
-    context->playback_preset_timestamp.tv_sec = 0;
-    context->playback_preset_timestamp.tv_usec = 0;
-    context->capture_preset = FALSE;
-    context->capture_preset_timestamp.tv_sec = 0;
-    context->capture_preset_timestamp.tv_usec = 0;
-
-    context->bridge.u.s.local = -1;
-    context->bridge.u.s.remote = -1;
-    context->reset_pipe.u.s.readfd = -1;
-    context->reset_pipe.u.s.writefd = -1;
-    context->notpid = -1;
-    context->notexp = 0;
-    context->notif = NULL;
-
-    if ( pipe_new_nonblocking ( &context->reset_pipe ) < 0 )
-    {
-        return -1;
-    }
-
-    if ( socket_set_nonblocking ( context->reset_pipe.u.s.readfd ) < 0 )
-    {
-        pipe_close ( &context->reset_pipe );
-        return -1;
-    }
-
-    if ( pipe_new_nonblocking ( &context->msgin ) < 0 )
-    {
-        pipe_close ( &context->reset_pipe );
-        return -1;
-    }
-
-    if ( pipe_new_nonblocking ( &context->msgout ) < 0 )
-    {
-        pipe_close ( &context->reset_pipe );
-        pipe_close ( &context->msgin );
-        return -1;
-    }
-
-    if ( pipe_new_nonblocking ( &context->msgloop ) < 0 )
-    {
-        pipe_close ( &context->reset_pipe );
-        pipe_close ( &context->msgin );
-        pipe_close ( &context->msgout );
-        return -1;
-    }
-
-    if ( pipe_new_nonblocking ( &context->applog ) < 0 )
-    {
-        pipe_close ( &context->reset_pipe );
-        pipe_close ( &context->msgin );
-        pipe_close ( &context->msgout );
-        pipe_close ( &context->msgloop );
-        return -1;
-    }
-
-    if ( nettalk_random_init ( &context->random ) < 0 )
-    {
-        pipe_close ( &context->reset_pipe );
-        pipe_close ( &context->msgin );
-        pipe_close ( &context->msgout );
-        pipe_close ( &context->msgloop );
-        pipe_close ( &context->applog );
-        return -1;
-    }
-
-    return 0;
-}
-
-/**
- * Uninitialize application context
- */
-static void nettalk_free ( struct nettalk_context_t *context )
-{
-    pipe_close ( &context->reset_pipe );
-    pipe_close ( &context->msgin );
-    pipe_close ( &context->msgout );
-    pipe_close ( &context->msgloop );
-    pipe_close ( &context->applog );
-    nettalk_random_free ( &context->random );
-    mbedtls_pk_free ( &context->config.self_rsa_priv_key );
-    mbedtls_pk_free ( &context->config.self_rsa_pub_key );
-    mbedtls_pk_free ( &context->config.peer_rsa_pub_key );
-}
+#include "sound.h"
 
 /**
  * Decode ip address and port number
@@ -146,12 +49,49 @@ static int ip_port_decode ( const char *input, unsigned int *addr, unsigned shor
     return 0;
 }
 
+/**
+ * Decode resampler profile name
+ */
+static int resampler_decode ( const char *input, int *profile, int *double_precision )
+{
+    size_t i;
+    size_t len;
+    static const char *names[] = { "fir", "low", "medium", "high", "very-high" };
+
+    len = strlen ( input );
+
+    /* Optional suffix selects double precision soxr */
+    if ( ( *double_precision = len > 3 && !strcmp ( input + len - 3, "-dp" ) ) )
+    {
+        len -= 3;
+    }
+
+    for ( i = 0; i < sizeof ( names ) / sizeof ( const char * ); i++ )
+    {
+        if ( strlen ( names[i] ) == len && !strncmp ( input, names[i], len ) )
+        {
+            *profile = i;
+            return i == NETTALK_RESAMPLER_FIR && *double_precision ? -1 : 0;
+        }
+    }
+
+    return -1;
+}
+
 /**
  * Show program usage message
  */
 static void show_usage ( void )
 {
-    fprintf ( stderr, "\n" "usage: nettalk [--socks5h addr:port] config\n\n" );
+    fprintf ( stderr, "\n" "usage: nettalk [--alsa-rw] [--float-audio] [--no-dtx] [--codec name]"
+        " [--rate hz] [--resampler profile] [--lan] [--socks5h addr:port] [--direct stun:port]"
+        " [--stats path] config\n"
+        "       nettalk --headless [--group|--mcu] [--alsa-rw] [--float-audio] [--no-dtx]"
+        " [--codec name] [--rate hz] [--resampler profile] [--lan] [--socks5h addr:port]"
+        " [--direct stun:port] [--stats path] config...\n\n"
+        "codecs: opus (default, if peer decodes it), amr\n"
+        "resampler profiles: fir (default), low, medium, high, very-high,\n"
+        "soxr profiles take -dp suffix for double precision, e.g. very-high-dp\n\n" );
 }
 
 /**
@@ -169,20 +109,124 @@ int main ( int argc, char *argv[] )
         return 1;
     }
 
-    /* Check for SOCKS-5 proxy */
-    if ( !strcmp ( argv[1], "--socks5h" ) )
+    /* Parse options */
+    while ( arg_off + 2 < argc )
     {
-        if ( ip_port_decode ( argv[2], &context.socks5_addr, &context.socks5_port ) < 0 )
+        if ( !strcmp ( argv[arg_off + 1], "--headless" ) )
         {
-            show_usage (  );
-            return 1;
+            /* Check for headless mode */
+            context.headless = TRUE;
+            arg_off++;
+            continue;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--group" ) )
+        {
+            /* Check for group call mode */
+            context.group = TRUE;
+            arg_off++;
+            continue;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--mcu" ) )
+        {
+            /* Check for conference host mode */
+            context.group = TRUE;
+            context.mcu = TRUE;
+            arg_off++;
+            continue;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--alsa-rw" ) )
+        {
+            /* Check for copying sound access instead of mmap */
+            context.alsa_rw = TRUE;
+            arg_off++;
+            continue;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--float-audio" ) )
+        {
+            /* Check for float sound path instead of short samples */
+            context.audio_float = TRUE;
+            arg_off++;
+            continue;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--no-dtx" ) )
+        {
+            /* Check for continuous transmission, older peers do not take filler frames */
+            context.no_dtx = TRUE;
+            arg_off++;
+            continue;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--lan" ) )
+        {
+            /* Check for local network discovery */
+            context.lan_enabled = TRUE;
+            arg_off++;
+            continue;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--socks5h" ) )
+        {
+            /* Check for SOCKS-5 proxy */
+            if ( ip_port_decode ( argv[arg_off + 2], &context.socks5_addr,
+                    &context.socks5_port ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            context.socks5_enabled = TRUE;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--direct" ) )
+        {
+            /* Check for direct path with STUN server */
+            if ( ip_port_decode ( argv[arg_off + 2], &context.stun_addr,
+                    &context.stun_port ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+            context.direct_enabled = TRUE;
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--rate" ) )
+        {
+            /* Check for fixed sound device rate */
+            if ( sscanf ( argv[arg_off + 2], "%u", &context.audio_rate ) <= 0
+                || context.audio_rate < 8000 || context.audio_rate > 192000 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--resampler" ) )
+        {
+            /* Check for resampler profile */
+            if ( resampler_decode ( argv[arg_off + 2], &context.resampler,
+                    &context.resampler_double ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--codec" ) )
+        {
+            /* Check for preferred voice codec */
+            if ( ( context.codec = audio_codec_find ( argv[arg_off + 2] ) ) < 0 )
+            {
+                show_usage (  );
+                return 1;
+            }
+
+        } else if ( !strcmp ( argv[arg_off + 1], "--stats" ) )
+        {
+            /* Check for statistics endpoint */
+            context.stats_path = argv[arg_off + 2];
+
+        } else
+        {
+            break;
         }
-        context.socks5_enabled = TRUE;
-        arg_off = 2;
+        arg_off += 2;
     }
 
-    /* Validate arguments count again */
-    if ( argc < arg_off + 2 )
+    /* Validate arguments count again, only headless mode handles many contacts */
+    if ( argc < arg_off + 2 || ( !context.headless && ( argc > arg_off + 2 || context.group ) ) )
     {
         show_usage (  );
         return 1;
@@ -192,7 +236,7 @@ int main ( int argc, char *argv[] )
     context.confpath = argv[arg_off + 1];
 
     /* Initialize context */
-    if ( nettalk_init ( &context ) < 0 )
+    if ( nettalk_context_init ( &context ) < 0 )
     {
         fprintf ( stderr, "Error: Initialization failed.\n" );
         return 1;
@@ -202,11 +246,31 @@ int main ( int argc, char *argv[] )
     nettalk_info ( &context, "Net Talk - ver. " NET_TALK_VERSION );
     nettalk_info ( &context, "setup was successful" );
 
+    /* Launch statistics endpoint */
+    if ( context.stats_path )
+    {
+        if ( nettalk_stats_launch ( &context ) < 0 )
+        {
+            nettalk_errcode ( &context, "cannot launch statistics endpoint", errno );
+        }
+    }
+
     /* Launch program task */
-    window_init ( &context );
+    if ( context.headless )
+    {
+        if ( headless_init ( &context, argv + arg_off + 1, argc - arg_off - 1 ) < 0 )
+        {
+            nettalk_context_free ( &context );
+            return 1;
+        }
+
+    } else
+    {
+        window_init ( &context );
+    }
 
     /* Uninitialize context */
-    nettalk_free ( &context );
+    nettalk_context_free ( &context );
 
     return 0;
 }
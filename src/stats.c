@@ -0,0 +1,328 @@
+/* ------------------------------------------------------------------
+ * Net Talk - Statistics Endpoint
+ * ------------------------------------------------------------------ */
+
+#include "nettalk.h"
+
+/**
+ * Histogram buckets upper bounds in microseconds
+ */
+static const unsigned long long hist_bounds[NETTALK_HIST_NBUCKETS - 1] = {
+    100, 500, 1000, 5000, 10000, 20000, 40000, 50000, 100000, 500000, 1000000, 5000000, 30000000
+};
+
+/**
+ * Statistics text buffer
+ */
+struct stats_text_t
+{
+    size_t len;
+    char array[16384];
+};
+
+/**
+ * Get monotonic time in microseconds
+ */
+long long nettalk_stats_micros ( void )
+{
+    struct timespec ts;
+
+    if ( clock_gettime ( CLOCK_MONOTONIC, &ts ) < 0 )
+    {
+        return 0;
+    }
+
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/**
+ * Add value to statistics counter
+ */
+void nettalk_stats_add ( unsigned long long *counter, unsigned long long value )
+{
+    __atomic_fetch_add ( counter, value, __ATOMIC_RELAXED );
+}
+
+/**
+ * Set statistics gauge
+ */
+void nettalk_stats_set ( unsigned long long *gauge, unsigned long long value )
+{
+    __atomic_store_n ( gauge, value, __ATOMIC_RELAXED );
+}
+
+/**
+ * Record microseconds value in latency histogram
+ */
+void nettalk_stats_observe ( struct nettalk_hist_t *hist, unsigned long long micros )
+{
+    size_t i;
+
+    for ( i = 0; i < NETTALK_HIST_NBUCKETS - 1 && micros > hist_bounds[i]; i++ )
+    {
+    }
+
+    __atomic_fetch_add ( &hist->buckets[i], 1, __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &hist->sum, micros, __ATOMIC_RELAXED );
+    __atomic_fetch_add ( &hist->count, 1, __ATOMIC_RELAXED );
+}
+
+/**
+ * Load statistics counter
+ */
+static unsigned long long stats_load ( const unsigned long long *counter )
+{
+    return __atomic_load_n ( counter, __ATOMIC_RELAXED );
+}
+
+/**
+ * Append formatted text to statistics buffer
+ */
+static void stats_printf ( struct stats_text_t *text, const char *format, ... )
+{
+    int len;
+    va_list argp;
+
+    va_start ( argp, format );
+    if ( ( len =
+            vsnprintf ( text->array + text->len, sizeof ( text->array ) - text->len, format,
+                argp ) ) > 0 )
+    {
+        text->len += len;
+        if ( text->len >= sizeof ( text->array ) )
+        {
+            text->len = sizeof ( text->array ) - 1;
+        }
+    }
+    va_end ( argp );
+}
+
+/**
+ * Append counter in Prometheus text format
+ */
+static void stats_counter ( struct stats_text_t *text, const char *name, const char *help,
+    const unsigned long long *counter )
+{
+    stats_printf ( text, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+        stats_load ( counter ) );
+}
+
+/**
+ * Append gauge in Prometheus text format
+ */
+static void stats_gauge ( struct stats_text_t *text, const char *name, const char *help,
+    unsigned long long value )
+{
+    stats_printf ( text, "# HELP %s %s\n# TYPE %s gauge\n%s %llu\n", name, help, name, name,
+        value );
+}
+
+/**
+ * Append histogram in Prometheus text format
+ */
+static void stats_histogram ( struct stats_text_t *text, const char *name, const char *help,
+    const struct nettalk_hist_t *hist )
+{
+    size_t i;
+    unsigned long long sum = 0;
+
+    stats_printf ( text, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name );
+
+    for ( i = 0; i < NETTALK_HIST_NBUCKETS - 1; i++ )
+    {
+        sum += stats_load ( &hist->buckets[i] );
+        stats_printf ( text, "%s_bucket{le=\"%g\"} %llu\n", name, hist_bounds[i] / 1000000.0,
+            sum );
+    }
+
+    sum += stats_load ( &hist->buckets[i] );
+    stats_printf ( text, "%s_bucket{le=\"+Inf\"} %llu\n", name, sum );
+    stats_printf ( text, "%s_sum %g\n", name, stats_load ( &hist->sum ) / 1000000.0 );
+    stats_printf ( text, "%s_count %llu\n", name, stats_load ( &hist->count ) );
+}
+
+/**
+ * Format statistics in Prometheus text format
+ */
+static void stats_format ( struct nettalk_context_t *context, struct stats_text_t *text )
+{
+    struct nettalk_stats_t *stats = &context->stats;
+
+    text->len = 0;
+    text->array[0] = '\0';
+
+    stats_printf ( text, "# HELP nettalk_online Peer session is established\n"
+        "# TYPE nettalk_online gauge\nnettalk_online %i\n", !!context->online );
+    stats_counter ( text, "nettalk_connects_total", "Relay connection attempts",
+        &stats->connects );
+    stats_counter ( text, "nettalk_pairings_total", "Peer pairings on relay", &stats->pairings );
+    stats_counter ( text, "nettalk_relay_refusals_total", "Busy refusals from relay",
+        &stats->refusals );
+    stats_counter ( text, "nettalk_tx_bytes_total", "Bytes sent to relay", &stats->tx_bytes );
+    stats_counter ( text, "nettalk_tx_packets_total", "Packets sent to relay",
+        &stats->tx_packets );
+    stats_counter ( text, "nettalk_rx_bytes_total", "Bytes received from relay",
+        &stats->rx_bytes );
+    stats_counter ( text, "nettalk_rx_packets_total", "Packets received from relay",
+        &stats->rx_packets );
+    stats_counter ( text, "nettalk_throttled_total", "Times traffic shaper held back data",
+        &stats->throttled );
+    stats_counter ( text, "nettalk_forward_wakeups_total", "Forward loop poll wakeups",
+        &stats->wakeups );
+    stats_histogram ( text, "nettalk_pairing_latency_seconds",
+        "Time from channel broadcast to peer pairing", &stats->pairing_latency );
+    stats_histogram ( text, "nettalk_loop_busy_seconds",
+        "Time spent handling forward loop events after wakeup", &stats->loop_busy );
+    stats_histogram ( text, "nettalk_capture_latency_seconds",
+        "Time from microphone capture to encoded frame send", &stats->capture_latency );
+    stats_histogram ( text, "nettalk_encode_queue_seconds",
+        "Time captured period waited for encoder thread", &stats->encode_queue_latency );
+    stats_counter ( text, "nettalk_capture_overruns_total",
+        "Microphone device ring overruns", &stats->capture_overruns );
+    stats_counter ( text, "nettalk_capture_dropped_periods_total",
+        "Captured periods dropped while encoder queue was full", &stats->capture_dropped );
+    stats_gauge ( text, "nettalk_capture_queue_periods",
+        "Captured periods waiting for encoder thread", stats_load ( &stats->capture_queued ) );
+    stats_gauge ( text, "nettalk_send_backlog_bytes",
+        "Encoded bytes waiting in bridge and relay send queue",
+        context->session.backlog > 0 ? context->session.backlog : 0 );
+    stats_counter ( text, "nettalk_capture_cpu_nanoseconds_total",
+        "Thread CPU time spent capturing and encoding", &stats->capture_cpu_ns );
+    stats_counter ( text, "nettalk_capture_audio_nanoseconds_total",
+        "Duration of captured audio", &stats->capture_audio_ns );
+    stats_counter ( text, "nettalk_playback_cpu_nanoseconds_total",
+        "Thread CPU time spent decoding and playing", &stats->playback_cpu_ns );
+    stats_counter ( text, "nettalk_playback_audio_nanoseconds_total",
+        "Duration of played audio", &stats->playback_audio_ns );
+    stats_counter ( text, "nettalk_voice_frames_total", "Voice frames passed to encoder",
+        &stats->voice_frames );
+    stats_counter ( text, "nettalk_voice_sent_frames_total",
+        "Speech and silence descriptor frames sent", &stats->voice_sent_frames );
+    stats_counter ( text, "nettalk_voice_gated_frames_total",
+        "Silent frames skipped without encoding", &stats->voice_gated_frames );
+    stats_counter ( text, "nettalk_voice_bytes_total", "Encoded voice bytes sent",
+        &stats->voice_bytes );
+    stats_counter ( text, "nettalk_voice_encode_nanoseconds_total",
+        "Thread CPU time spent encoding voice frames", &stats->voice_encode_ns );
+    stats_counter ( text, "nettalk_voice_mode_changes_total",
+        "AMR-NB mode changes made by bitrate adaptation", &stats->voice_mode_changes );
+    stats_counter ( text, "nettalk_comfort_noise_frames_total",
+        "Comfort noise frames generated while peer was silent", &stats->comfort_frames );
+}
+
+/**
+ * Serve single statistics request
+ */
+static void stats_serve ( struct nettalk_context_t *context, int sock,
+    struct stats_text_t *text )
+{
+    int len;
+    char header[128];
+    char request[1024];
+    struct pollfd fds[1];
+
+    /* Drain request if any, plain readers may send nothing */
+    fds[0].fd = sock;
+    fds[0].events = POLLIN;
+
+    if ( poll ( fds, 1, 100 ) > 0 && ( fds[0].revents & POLLIN ) )
+    {
+        if ( recv ( sock, request, sizeof ( request ), MSG_DONTWAIT ) < 0 )
+        {
+        }
+    }
+
+    stats_format ( context, text );
+
+    len =
+        snprintf ( header, sizeof ( header ),
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %lu\r\n\r\n", ( unsigned long ) text->len );
+
+    if ( send ( sock, header, len, MSG_NOSIGNAL ) >= 0 )
+    {
+        if ( send ( sock, text->array, text->len, MSG_NOSIGNAL ) >= 0 )
+        {
+        }
+    }
+}
+
+/**
+ * Statistics endpoint entry point
+ */
+static void *stats_entry_point ( void *arg )
+{
+    int csock;
+    struct stats_text_t text;
+    struct nettalk_context_t *context = ( struct nettalk_context_t * ) arg;
+
+    for ( ;; )
+    {
+        if ( ( csock = accept ( context->stats_sock, NULL, NULL ) ) < 0 )
+        {
+            /* Back off on descriptor exhaustion instead of spinning */
+            if ( errno != EINTR && errno != ECONNABORTED )
+            {
+                usleep ( 100000 );
+            }
+            continue;
+        }
+
+        stats_serve ( context, csock, &text );
+        shutdown_then_close ( csock );
+    }
+
+    return NULL;
+}
+
+/**
+ * Launch statistics endpoint task
+ */
+int nettalk_stats_launch ( struct nettalk_context_t *context )
+{
+    int sock;
+    pthread_t thread;
+    struct sockaddr_un saddr;
+
+    if ( strlen ( context->stats_path ) >= sizeof ( saddr.sun_path ) )
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    /* Bind local endpoint socket */
+    if ( ( sock = socket ( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+    {
+        return -1;
+    }
+
+    memset ( &saddr, '\0', sizeof ( saddr ) );
+    saddr.sun_family = AF_UNIX;
+    strcpy ( saddr.sun_path, context->stats_path );
+    unlink ( saddr.sun_path );
+
+    if ( bind ( sock, ( struct sockaddr * ) &saddr, sizeof ( saddr ) ) < 0 )
+    {
+        close ( sock );
+        return -1;
+    }
+
+    if ( listen ( sock, 4 ) < 0 )
+    {
+        close ( sock );
+        return -1;
+    }
+
+    context->stats_sock = sock;
+
+    /* Start endpoint task asynchronously */
+    if ( pthread_create ( &thread, NULL, stats_entry_point, context ) != 0 )
+    {
+        close ( sock );
+        return -1;
+    }
+
+    pthread_detach ( thread );
+
+    return 0;
+}
@@ -13,11 +13,9 @@
 int nettalk_audio_decoder_init ( struct nettalk_context_t *context,
     struct audio_decoder_t *decoder )
 {
-    int status;
+    int i;
     size_t ratio;
-    soxr_error_t soxr_error;
-    soxr_quality_spec_t q_spec;
-    signed char decoder_name[] = { "Decoder" };
+    size_t input_alloc;
 
     /* Begin Initialization */
     decoder->input = NULL;
@@ -25,16 +23,29 @@ int nettalk_audio_decoder_init ( struct nettalk_context_t *context,
     decoder->resample_in = NULL;
     decoder->resample_out = NULL;
     decoder->amrnb = NULL;
+    decoder->opus = NULL;
     decoder->soxr = NULL;
+    decoder->fir.taps = NULL;
+    decoder->fir.line = NULL;
+    decoder->fir.taps16 = NULL;
+    decoder->fir.line16 = NULL;
     decoder->input_len = 0;
     decoder->reset_needed = 1;
+    decoder->reset_asked = nettalk_stats_micros (  );
+    decoder->dtx = FALSE;
+    decoder->lost = FALSE;
+    decoder->codec = AUDIO_CODEC_AMRNB;
     context->reset_encoder_peer = 1;
 
-    /* AMR-NB rate is 8kHz */
+    /* AMR-NB rate is 8kHz, Opus is run at the same rate and frame size */
     decoder->inrate = 8000;
 
-    /* Calculate resample size ratio */
-    ratio = decoder->outrate / decoder->inrate;
+    /* Mono short device takes AMR-NB output without float round trip */
+    decoder->s16 = decoder->format == SND_PCM_FORMAT_S16_LE
+        && decoder->channels == AUDIO_LAYOUT_MONO;
+
+    /* Calculate resample size ratio, rounded up for fractional ratios */
+    ratio = ( decoder->outrate + decoder->inrate - 1 ) / decoder->inrate;
 
     /* Prepare buffers allocation */
     if ( !( decoder->input_size =
@@ -43,10 +54,20 @@ int nettalk_audio_decoder_init ( struct nettalk_context_t *context,
         return -1;
     }
 
+    /* Largest Opus frame must fit behind unaligned chunk */
+    if ( decoder->input_size < AUDIO_FRAME_MAX + AMRNB_CHUNK_MAX )
+    {
+        decoder->input_size = AUDIO_FRAME_MAX + AMRNB_CHUNK_MAX;
+    }
+
+    if ( ( input_alloc = decoder->frames_max * AMRNB_CHUNK_MIN / AMRNB_SAMPLES_MAX ) <
+        decoder->input_size )
+    {
+        input_alloc = decoder->input_size;
+    }
+
     /* Allocate buffers */
-    if ( !( decoder->input =
-            ( unsigned char * ) malloc ( decoder->frames_max * AMRNB_CHUNK_MIN /
-                AMRNB_SAMPLES_MAX ) ) )
+    if ( !( decoder->input = ( unsigned char * ) malloc ( input_alloc ) ) )
     {
         nettalk_errcode ( context, "speaker input alloc failed", errno );
         nettalk_audio_decoder_free ( decoder );
@@ -60,14 +81,17 @@ int nettalk_audio_decoder_init ( struct nettalk_context_t *context,
         return -1;
     }
 
-    if ( !( decoder->resample_in = ( float * ) malloc ( decoder->frames_max * sizeof ( float ) ) ) )
+    if ( !decoder->s16
+        && !( decoder->resample_in =
+            ( float * ) malloc ( decoder->frames_max * sizeof ( float ) ) ) )
     {
         nettalk_errcode ( context, "speaker resample-out inalloc failed", errno );
         nettalk_audio_decoder_free ( decoder );
         return -1;
     }
 
-    if ( !( decoder->resample_out =
+    if ( !decoder->s16
+        && !( decoder->resample_out =
             ( float * ) malloc ( decoder->frames_max * decoder->channels * sizeof ( float ) ) ) )
     {
         nettalk_errcode ( context, "speaker resample-out alloc failed", errno );
@@ -75,62 +99,252 @@ int nettalk_audio_decoder_init ( struct nettalk_context_t *context,
         return -1;
     }
 
-    /* Initialize AMR-NB decoder */
+    /* Initialize decoders of all codecs, peer may switch between them after reset */
+    for ( i = 0; i < AUDIO_CODEC_COUNT; i++ )
+    {
+        if ( audio_codec_get ( i )->decoder_init ( context, decoder ) < 0 )
+        {
+            nettalk_audio_decoder_free ( decoder );
+            return -1;
+        }
+    }
+
+    /* Group call mixer takes native rate, so no resampling needed */
+    if ( decoder->outrate == decoder->inrate )
+    {
+        return 0;
+    }
+
+    /* Create resampler selected by profile */
+    if ( audio_resampler_init ( context, "speaker", decoder->inrate, decoder->outrate,
+            decoder->s16, &decoder->soxr, &decoder->fir ) < 0 )
+    {
+        nettalk_audio_decoder_free ( decoder );
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Initialize AMR-NB decoder backend
+ */
+int audio_amrnb_decoder_init ( struct nettalk_context_t *context,
+    struct audio_decoder_t *decoder )
+{
+    int status;
+    signed char decoder_name[] = { "Decoder" };
+
     status = GSMInitDecode ( &decoder->amrnb, decoder_name );
 
     /* Check for error */
     if ( !decoder->amrnb || status < 0 )
     {
-        nettalk_error ( context, "speaker amr-nb init failed (%s)", soxr_error );
-        nettalk_audio_decoder_free ( decoder );
+        nettalk_error ( context, "speaker amr-nb init failed" );
+        audio_amrnb_decoder_free ( decoder );
         return -1;
     }
 
-    /* Select resample filter quality */
-    q_spec = soxr_quality_spec ( SOXR_VHQ, SOXR_VR | SOXR_DOUBLE_PRECISION );
+    return 0;
+}
+
+/**
+ * Reset AMR-NB decoder backend state
+ */
+int audio_amrnb_decoder_reset ( struct audio_decoder_t *decoder )
+{
+    return Speech_Decode_Frame_reset ( decoder->amrnb ) < 0 ? -1 : 0;
+}
 
-    /* Initialize SOXR resampler */
-    decoder->soxr =
-        soxr_create ( decoder->inrate, decoder->outrate, AUDIO_LAYOUT_MONO,
-        &soxr_error, SOXR_FLOAT32_I, &q_spec, NULL );
+/**
+ * Decode AMR-NB frame, returns consumed length, zero if frame is incomplete
+ */
+ssize_t audio_amrnb_decode ( struct audio_decoder_t *decoder, const unsigned char *input,
+    size_t len, short *samples, size_t *nsamples )
+{
+    unsigned char type;
+    ssize_t frame_len;
+    unsigned char payload[AMRNB_CHUNK_MAX] = { 0 };
 
-    /* Check for error */
-    if ( !decoder->soxr || soxr_error )
+    /* Missing frame is filled from last descriptor parameters */
+    if ( !input )
+    {
+        if ( AMRDecode ( decoder->amrnb, ( enum Frame_Type_3GPP ) AMRNB_FRAME_NO_DATA, payload,
+                samples, MIME_IETF ) < 0 )
+        {
+            return -1;
+        }
+
+        *nsamples = AMRNB_SAMPLES_MAX;
+        return 0;
+    }
+
+    /* Largest frame fits into one chunk */
+    if ( len < AMRNB_CHUNK_MAX )
+    {
+        return 0;
+    }
+
+    type = ( input[0] >> 3 ) & 0x0f;
+
+    if ( ( frame_len =
+            AMRDecode ( decoder->amrnb, ( enum Frame_Type_3GPP ) type,
+                ( unsigned char * ) input + 1, samples, MIME_IETF ) ) < 0
+        || ( !frame_len && type != AMRNB_FRAME_NO_DATA ) )
     {
-        nettalk_error ( context, "speaker soxr init failed (%s)", soxr_error );
-        nettalk_audio_decoder_free ( decoder );
         return -1;
     }
 
+    /* Comfort noise is made locally after silence descriptor */
+    if ( type != AMRNB_FRAME_NO_DATA )
+    {
+        decoder->dtx = type == AMRNB_FRAME_SID;
+    }
+
+    *nsamples = AMRNB_SAMPLES_MAX;
+    return frame_len + 1;
+}
+
+/**
+ * Uninitialize AMR-NB decoder backend
+ */
+void audio_amrnb_decoder_free ( struct audio_decoder_t *decoder )
+{
+    if ( decoder->amrnb )
+    {
+        GSMDecodeFrameExit ( &decoder->amrnb );
+        decoder->amrnb = NULL;
+    }
+}
+
+/**
+ * Resample AMR-NB decoded samples to short device format
+ */
+static int resample_short_samples ( struct audio_decoder_t *decoder, void *frames,
+    size_t *nframes, size_t frames_cnt )
+{
+    size_t resample_idone;
+    size_t resample_odone;
+
+    if ( decoder->soxr )
+    {
+        if ( soxr_process ( decoder->soxr, decoder->samples, frames_cnt, &resample_idone, frames,
+                *nframes, &resample_odone ) )
+        {
+            return -1;
+        }
+
+        frames_cnt = resample_odone;
+
+    } else if ( decoder->fir.taps16 )
+    {
+        /* Filter writes up to ceil of ratio outputs per input */
+        if ( ( frames_cnt * decoder->fir.up + decoder->fir.down - 1 ) / decoder->fir.down >
+            *nframes )
+        {
+            return -1;
+        }
+
+        frames_cnt = audio_fir_process_s16 ( &decoder->fir, decoder->samples, frames_cnt, frames );
+
+    } else
+    {
+        if ( frames_cnt > *nframes )
+        {
+            return -1;
+        }
+
+        memcpy ( frames, decoder->samples, frames_cnt * sizeof ( short ) );
+    }
+
+    *nframes = frames_cnt;
     return 0;
 }
 
 /**
- * Expand sound from mono to multi-channel
+ * Resample decoded samples and convert them to device format
  */
-static void expand_from_mono_samples ( size_t channels, float *samples, size_t frames_cnt )
+static int output_samples ( struct audio_decoder_t *decoder, void *frames, size_t *nframes,
+    size_t frames_cnt )
 {
-    size_t i;
-    size_t c;
-    size_t j;
+    size_t samples_cnt;
+    size_t resample_idone;
+    size_t resample_odone;
+    soxr_error_t soxr_error;
 
-    if ( channels > AUDIO_LAYOUT_MONO && frames_cnt )
+    /* Resample AMR-NB decoded samples straight into device buffer */
+    if ( decoder->s16 )
+    {
+        return resample_short_samples ( decoder, frames, nframes, frames_cnt );
+    }
+
+    /* Convert samples from AMR-NB format to soxr format */
+    audio_short_to_float_array ( decoder->samples, decoder->resample_in, frames_cnt );
+
+    /* Resample AMR-NB decoded sound */
+    if ( decoder->soxr )
     {
-        i = frames_cnt;
-        c = i * channels;
+        soxr_error =
+            soxr_process ( decoder->soxr, decoder->resample_in, frames_cnt, &resample_idone,
+            decoder->resample_out, decoder->frames_max, &resample_odone );
 
-        do
+        /* Check for resampling error */
+        if ( soxr_error || resample_odone > decoder->frames_max )
         {
-            i--;
-            c -= channels;
+            return -1;
+        }
 
-            for ( j = 0; j < channels; j++ )
-            {
-                samples[c + j] = samples[i];
-            }
+        /* Update sound sample count */
+        frames_cnt = resample_odone;
+
+    } else if ( decoder->fir.taps )
+    {
+        frames_cnt =
+            audio_fir_process ( &decoder->fir, decoder->resample_in, frames_cnt,
+            decoder->resample_out );
 
-        } while ( i > 0 );
+    } else
+    {
+        memcpy ( decoder->resample_out, decoder->resample_in, frames_cnt * sizeof ( float ) );
     }
+
+    /* Expand sound from mono to multi-channel */
+    if ( decoder->channels != AUDIO_LAYOUT_MONO )
+    {
+        audio_upmix_float_array ( decoder->resample_out, decoder->channels, frames_cnt );
+    }
+
+    /* Check output buffer size */
+    if ( *nframes < frames_cnt )
+    {
+        return -1;
+    }
+
+    /* Calculate samples count */
+    samples_cnt = frames_cnt * decoder->channels;
+
+    /* Convert samples to output format */
+    switch ( decoder->format )
+    {
+    case SND_PCM_FORMAT_S16_LE:
+    case SND_PCM_FORMAT_S16_BE:
+        audio_float_to_short_array ( decoder->resample_out, frames, samples_cnt );
+        break;
+    case SND_PCM_FORMAT_FLOAT_LE:
+    case SND_PCM_FORMAT_FLOAT_BE:
+        memcpy ( frames, decoder->resample_out, samples_cnt * sizeof ( float ) );
+        break;
+    case SND_PCM_FORMAT_S32_LE:
+    case SND_PCM_FORMAT_S32_BE:
+        audio_float_to_int_array ( decoder->resample_out, frames, samples_cnt );
+        break;
+    default:
+        return -1;
+    }
+
+    /* Update frame count */
+    *nframes = frames_cnt;
+    return 0;
 }
 
 /**
@@ -139,15 +353,14 @@ static void expand_from_mono_samples ( size_t channels, float *samples, size_t f
 int nettalk_decode_audio ( struct nettalk_context_t *context, struct audio_decoder_t *decoder,
     void *frames, size_t *nframes )
 {
-    unsigned char type;
+    int i;
+    int codec;
     ssize_t len;
+    size_t limit;
     size_t input_pos;
     size_t frames_cnt;
-    size_t samples_cnt;
-    size_t resample_idone;
-    size_t resample_odone;
-    soxr_error_t soxr_error;
-    unsigned char left[AMRNB_CHUNK_MAX];
+    size_t frames_limit;
+    size_t nsamples;
 
     /* Optionally discard buffer data */
     if ( decoder->reset_needed && decoder->input_len > decoder->input_size / 2 )
@@ -155,16 +368,56 @@ int nettalk_decode_audio ( struct nettalk_context_t *context, struct audio_decod
         decoder->input_len = 0;
     }
 
-    /* Receive input data */
-    if ( ( len =
-            recv_with_reset ( context, context->bridge.u.s.local,
-                decoder->input + decoder->input_len,
-                decoder->input_size - decoder->input_len, -1 ) ) <= 0 )
+    /* Peer is asked again, if reset request or its init chunk got lost */
+    if ( decoder->reset_needed
+        && decoder->reset_asked + NETTALK_RESET_RETRY * 1000LL < nettalk_stats_micros (  ) )
     {
-        return -1;
+        decoder->reset_asked = nettalk_stats_micros (  );
+        context->reset_encoder_peer = 1;
+    }
+
+    /* Take only as many chunks as output space holds, one is kept for resampler backlog */
+    if ( ( limit =
+            *nframes * decoder->inrate / decoder->outrate / AMRNB_SAMPLES_MAX ) > 1 )
+    {
+        frames_limit = ( limit - 1 ) * AMRNB_SAMPLES_MAX;
+        limit = ( limit - 1 ) * AMRNB_CHUNK_MAX;
+
+    } else
+    {
+        frames_limit = 0;
+        limit = 0;
+    }
+
+    if ( frames_limit > decoder->frames_max )
+    {
+        frames_limit = decoder->frames_max;
+    }
+
+    /* Opus frame may be longer than all the chunks, decoded frames are limited anyway */
+    if ( limit && limit < AUDIO_FRAME_MAX + AMRNB_CHUNK_MAX )
+    {
+        limit = AUDIO_FRAME_MAX + AMRNB_CHUNK_MAX;
     }
 
-    decoder->input_len += len;
+    if ( limit > decoder->input_size )
+    {
+        limit = decoder->input_size;
+    }
+
+    /* Receive input data, unless output space is short */
+    if ( decoder->input_len < limit )
+    {
+        if ( ( len =
+                recv_with_reset ( context, context->bridge.u.s.local,
+                    decoder->input + decoder->input_len, limit - decoder->input_len,
+                    -1 ) ) <= 0 )
+        {
+            return -1;
+        }
+
+        decoder->input_len += len;
+    }
 
     /* At least max size of AMR-NB chunk required */
     if ( decoder->input_len < AMRNB_CHUNK_MAX )
@@ -186,13 +439,23 @@ int nettalk_decode_audio ( struct nettalk_context_t *context, struct audio_decod
         {
             len = sizeof ( noop_chunk );
 
+        } else if ( !memcmp ( decoder->input + input_pos, loss_chunk, sizeof ( loss_chunk ) ) )
+        {
+            decoder->lost = !decoder->reset_needed;
+            len = sizeof ( loss_chunk );
+
         } else if ( !memcmp ( decoder->input + input_pos, init_chunk, sizeof ( init_chunk ) ) )
         {
-            if ( Speech_Decode_Frame_reset ( decoder->amrnb ) < 0 )
+            for ( i = 0; i < AUDIO_CODEC_COUNT; i++ )
             {
-                return -1;
+                if ( audio_codec_get ( i )->decoder_reset ( decoder ) < 0 )
+                {
+                    return -1;
+                }
             }
             decoder->reset_needed = 0;
+            decoder->dtx = FALSE;
+            decoder->lost = FALSE;
             len = sizeof ( reset_chunk );
 
         } else if ( !memcmp ( decoder->input + input_pos, text_chunk, 24 ) )
@@ -203,37 +466,68 @@ int nettalk_decode_audio ( struct nettalk_context_t *context, struct audio_decod
             }
             len = AMRNB_CHUNK_MAX;
 
+        } else if ( !memcmp ( decoder->input + input_pos, caps_chunk, 24 ) )
+        {
+            audio_codec_peer_caps ( context, decoder->input + input_pos );
+            len = AMRNB_CHUNK_MAX;
+
         } else if ( decoder->reset_needed )
         {
             len = 1;
 
+        } else if ( ( ( decoder->input[input_pos] >> 3 ) & 0x0f ) == AMRNB_FRAME_FILLER )
+        {
+            len = 1;
+
         } else
         {
-            type = ( decoder->input[input_pos] >> 3 ) & 0x0f;
+            /* Lost frame is recovered only when output space holds it too */
+            if ( decoder->lost && frames_cnt + 2 * AMRNB_SAMPLES_MAX > frames_limit )
+            {
+                if ( frames_cnt )
+                {
+                    break;
+                }
+                decoder->lost = FALSE;
+            }
+
+            /* Rest is decoded when output space is available */
+            if ( frames_cnt + AMRNB_SAMPLES_MAX > frames_limit )
+            {
+                break;
+            }
+
+            codec = audio_codec_of_frame ( decoder->input[input_pos] );
+            nsamples = 0;
+
             if ( ( len =
-                    AMRDecode ( decoder->amrnb, ( enum Frame_Type_3GPP ) type,
-                        decoder->input + input_pos + 1, decoder->samples + frames_cnt,
-                        MIME_IETF ) ) <= 0 )
+                    audio_codec_get ( codec )->decode ( decoder, decoder->input + input_pos,
+                        decoder->input_len - input_pos, decoder->samples + frames_cnt,
+                        &nsamples ) ) < 0 )
             {
                 decoder->reset_needed = 1;
+                decoder->reset_asked = nettalk_stats_micros (  );
                 context->reset_encoder_peer = 1;
                 *nframes = 0;
                 return 0;
             }
-            frames_cnt += AMRNB_SAMPLES_MAX;
-            len++;
+
+            /* Frame continues in data not received yet */
+            if ( !len )
+            {
+                break;
+            }
+
+            decoder->codec = codec;
+            decoder->lost = FALSE;
+            frames_cnt += nsamples;
         }
     }
 
-    /* Save unaligned data for future use */
+    /* Save unaligned data and incomplete frame for future use */
     if ( ( len = decoder->input_len - input_pos ) )
     {
-        if ( len > AMRNB_CHUNK_MAX )
-        {
-            len = AMRNB_CHUNK_MAX;
-        }
-        memcpy ( left, decoder->input + input_pos, len );
-        memcpy ( decoder->input, left, len );
+        memmove ( decoder->input, decoder->input + input_pos, len );
     }
     decoder->input_len = len;
 
@@ -244,60 +538,36 @@ int nettalk_decode_audio ( struct nettalk_context_t *context, struct audio_decod
         return 0;
     }
 
-    /* Convert samples from AMR-NB format to soxr format */
-    audio_short_to_float_array ( decoder->samples, decoder->resample_in, frames_cnt );
-
-    /* Resample AMR-NB decoded sound */
-    soxr_error =
-        soxr_process ( decoder->soxr, decoder->resample_in, frames_cnt, &resample_idone,
-        decoder->resample_out, decoder->frames_max, &resample_odone );
-
-    /* Check for resampling error */
-    if ( soxr_error || resample_odone > decoder->frames_max )
-    {
-        return -1;
-    }
+    return output_samples ( decoder, frames, nframes, frames_cnt );
+}
 
-    /* Update sound sample count */
-    frames_cnt = resample_odone;
+/**
+ * Generate comfort noise while peer sends no frames
+ */
+int nettalk_decode_comfort_noise ( struct nettalk_context_t *context,
+    struct audio_decoder_t *decoder, void *frames, size_t *nframes )
+{
+    size_t nsamples = 0;
 
-    /* Expand sound from mono to multi-channel */
-    if ( decoder->channels != AUDIO_LAYOUT_MONO )
+    /* Noise is made only after silence descriptor */
+    if ( !decoder->dtx || decoder->reset_needed )
     {
-        expand_from_mono_samples ( decoder->channels, decoder->resample_out, frames_cnt );
+        *nframes = 0;
+        return 0;
     }
 
-    /* Check output buffer size */
-    if ( *nframes < frames_cnt )
+    /* Codec of last frame fills missing one */
+    if ( audio_codec_get ( decoder->codec )->decode ( decoder, NULL, 0, decoder->samples,
+            &nsamples ) < 0 || !nsamples )
     {
-        return -1;
+        decoder->dtx = FALSE;
+        *nframes = 0;
+        return 0;
     }
 
-    /* Calculate samples count */
-    samples_cnt = frames_cnt * decoder->channels;
+    nettalk_stats_add ( &context->stats.comfort_frames, 1 );
 
-    /* Convert samples to output format */
-    switch ( decoder->format )
-    {
-    case SND_PCM_FORMAT_S16_LE:
-    case SND_PCM_FORMAT_S16_BE:
-        audio_float_to_short_array ( decoder->resample_out, frames, samples_cnt );
-        break;
-    case SND_PCM_FORMAT_FLOAT_LE:
-    case SND_PCM_FORMAT_FLOAT_BE:
-        memcpy ( frames, decoder->resample_out, samples_cnt * sizeof ( float ) );
-        break;
-    case SND_PCM_FORMAT_S32_LE:
-    case SND_PCM_FORMAT_S32_BE:
-        audio_float_to_int_array ( decoder->resample_out, frames, samples_cnt );
-        break;
-    default:
-        return -1;
-    }
-
-    /* Update frame count */
-    *nframes = frames_cnt;
-    return 0;
+    return output_samples ( decoder, frames, nframes, nsamples );
 }
 
 /**
@@ -305,10 +575,11 @@ int nettalk_decode_audio ( struct nettalk_context_t *context, struct audio_decod
  */
 void nettalk_audio_decoder_free ( struct audio_decoder_t *decoder )
 {
-    if ( decoder->amrnb )
+    int i;
+
+    for ( i = 0; i < AUDIO_CODEC_COUNT; i++ )
     {
-        GSMDecodeFrameExit ( &decoder->amrnb );
-        decoder->amrnb = NULL;
+        audio_codec_get ( i )->decoder_free ( decoder );
     }
 
     if ( decoder->soxr )
@@ -317,6 +588,8 @@ void nettalk_audio_decoder_free ( struct audio_decoder_t *decoder )
         decoder->soxr = NULL;
     }
 
+    audio_fir_free ( &decoder->fir );
+
     free_ref ( ( void ** ) &decoder->input );
     free_ref ( ( void ** ) &decoder->samples );
     free_ref ( ( void ** ) &decoder->resample_in );
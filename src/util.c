@@ -48,6 +48,34 @@ int socket_set_nonblocking ( int sock )
     return 0;
 }
 
+/**
+ * Set socket options for low latency voice traffic
+ */
+int socket_set_low_latency ( int sock )
+{
+    int nodelay = 1;
+    int lowat = NETTALK_NOTSENT_LOWAT;
+    int tos = IPTOS_DSCP_EF;
+
+    /* Send small voice chunks without waiting for ACK */
+    if ( setsockopt ( sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof ( nodelay ) ) < 0 )
+    {
+        return -1;
+    }
+
+    /* Keep backlog in application rather than in kernel send queue */
+    if ( setsockopt ( sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof ( lowat ) ) < 0 )
+    {
+    }
+
+    /* Mark packets as expedited forwarding, best effort only */
+    if ( setsockopt ( sock, IPPROTO_IP, IP_TOS, &tos, sizeof ( tos ) ) < 0 )
+    {
+    }
+
+    return 0;
+}
+
 /**
  * Connect socket with timeout
  */
@@ -500,6 +528,74 @@ int gettimeofdayv ( volatile struct timeval *tv )
     return 0;
 }
 
+/**
+ * Send message to peer or queue it until peer is online
+ */
+int outbox_send_message ( struct nettalk_context_t *context, const char *message )
+{
+    size_t len;
+    const char delim = '\a';
+
+    len = strlen ( message );
+
+    if ( context->online && !context->outbox.len )
+    {
+        if ( write ( context->msgout.u.s.writefd, message, len ) > 0 )
+        {
+            if ( write ( context->msgout.u.s.writefd, &delim, sizeof ( delim ) ) > 0 )
+            {
+                return 0;
+            }
+        }
+
+        return -1;
+    }
+
+    if ( context->outbox.len + len + 1 > sizeof ( context->outbox.array ) )
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    memcpy ( context->outbox.array + context->outbox.len, message, len );
+    context->outbox.len += len;
+    context->outbox.array[context->outbox.len++] = delim;
+
+    return 1;
+}
+
+/**
+ * Flush messages queued while peer was offline
+ */
+void outbox_flush ( struct nettalk_context_t *context )
+{
+    size_t len;
+    ssize_t ret;
+
+    if ( !context->outbox.len )
+    {
+        return;
+    }
+
+    /* Limit single write, so that caller never blocks on full pipe */
+    if ( ( len = context->outbox.len ) > OUTBOX_FLUSH_MAX )
+    {
+        len = OUTBOX_FLUSH_MAX;
+    }
+
+    if ( ( ret = write ( context->msgout.u.s.writefd, context->outbox.array, len ) ) > 0 )
+    {
+        memmove ( context->outbox.array, context->outbox.array + ret,
+            context->outbox.len - ret );
+        context->outbox.len -= ret;
+    }
+
+    if ( !context->outbox.len )
+    {
+        memset ( context->outbox.array, '\0', sizeof ( context->outbox.array ) );
+    }
+}
+
 /**
  * AMR-NB compression state reset chunk
  */
@@ -530,6 +626,16 @@ const uint8_t noop_chunk[AMRNB_CHUNK_MAX] = {
     0xee, 0xee, 0xee, 0xee, 0xee, 0xee, 0xee, 0xee
 };
 
+/**
+ * Direct path datagram loss chunk, never sent to peer
+ */
+const uint8_t loss_chunk[AMRNB_CHUNK_MAX] = {
+    0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99,
+    0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99,
+    0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99,
+    0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99, 0x99
+};
+
 /**
  * Text message chunk
  */
@@ -549,3 +655,34 @@ const uint8_t ack_chunk[AMRNB_CHUNK_MAX] = {
     0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa,
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
+
+/**
+ * Decodable codecs announcement chunk
+ */
+const uint8_t caps_chunk[AMRNB_CHUNK_MAX] = {
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+/**
+ * Parse decodable codecs announcement chunk
+ */
+unsigned int caps_chunk_decode ( const uint8_t * chunk )
+{
+    return ( ( unsigned int ) chunk[24] << 24 ) | ( ( unsigned int ) chunk[25] << 16 ) |
+        ( ( unsigned int ) chunk[26] << 8 ) | chunk[27];
+}
+
+/**
+ * Build decodable codecs announcement chunk
+ */
+void caps_chunk_encode ( unsigned int caps, uint8_t * chunk )
+{
+    memcpy ( chunk, caps_chunk, AMRNB_CHUNK_MAX );
+    chunk[24] = caps >> 24;
+    chunk[25] = caps >> 16;
+    chunk[26] = caps >> 8;
+    chunk[27] = caps;
+}
@@ -8,6 +8,11 @@
 #undef GtkWidget
 #endif
 
+#ifdef NotifyNotification
+#undef NotifyNotification
+#endif
+
+#include <libnotify/notify.h>
 #include <gtk/gtk.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms-compat.h>
@@ -331,20 +336,36 @@ static void put_message ( struct nettalk_context_t *context, int type, const cha
  */
 static int reply_message ( struct nettalk_context_t *context, const char *message )
 {
-    const char delim = '\a';
+    int status;
 
-    if ( context->online )
+    if ( ( status = outbox_send_message ( context, message ) ) < 0 )
     {
-        if ( write ( context->msgout.u.s.writefd, message, strlen ( message ) ) > 0 )
+        if ( errno == ENOBUFS )
         {
-            if ( write ( context->msgout.u.s.writefd, &delim, sizeof ( delim ) ) > 0 )
-            {
-                return 0;
-            }
+            put_message ( context, MESSAGE_TYPE_LOG, "Eoutbox is full, message not queued" );
         }
+        return -1;
+    }
+
+    if ( status > 0 )
+    {
+        put_message ( context, MESSAGE_TYPE_LOG, "Imessage queued until peer is online" );
     }
 
-    return -1;
+    return 0;
+}
+
+/**
+ * Update reply input hint
+ */
+static void set_reply_hint ( struct nettalk_context_t *context, const char *hint )
+{
+#ifdef CONFIG_USE_GTK2
+    UNUSED ( context );
+    UNUSED ( hint );
+#else
+    gtk_entry_set_placeholder_text ( GTK_ENTRY ( context->gui.reply ), hint );
+#endif
 }
 
 /**
@@ -712,19 +733,19 @@ static gboolean update_window ( gpointer user_data )
     {
         if ( !context->gui.editable )
         {
-            gtk_widget_set_sensitive ( context->gui.reply, TRUE );
-            gtk_entry_set_text ( GTK_ENTRY ( context->gui.reply ), "" );
+            set_reply_hint ( context, "" );
             gtk_widget_grab_focus ( context->gui.reply );
             context->gui.editable = TRUE;
             update_window_title ( context );
         }
 
+        outbox_flush ( context );
+
     } else
     {
         if ( context->gui.editable )
         {
-            gtk_widget_set_sensitive ( context->gui.reply, FALSE );
-            gtk_entry_set_text ( GTK_ENTRY ( context->gui.reply ), "Not connected with peer..." );
+            set_reply_hint ( context, "Peer is offline, messages will be queued..." );
             context->gui.editable = FALSE;
             update_window_title ( context );
         }
@@ -841,7 +862,7 @@ static void menu_reconnect ( GtkMenuItem * menu_item, gpointer user_data )
             return;
         }
 
-        reconnect_session ( context );
+        user_reconnect_session ( context );
     }
 }
 
@@ -1136,6 +1157,7 @@ int window_init ( struct nettalk_context_t *context )
     context->bufin.len = 0;
     context->bufloop.len = 0;
     context->buflog.len = 0;
+    context->outbox.len = 0;
     context->gui.editable = FALSE;
 
     context->gui.window = gtk_window_new ( GTK_WINDOW_TOPLEVEL );
@@ -1246,8 +1268,7 @@ int window_init ( struct nettalk_context_t *context )
     gtk_box_pack_start ( GTK_BOX ( optbox ), notctl, TRUE, TRUE, 6 );
 
     context->gui.reply = gtk_entry_new (  );
-    gtk_widget_set_sensitive ( context->gui.reply, FALSE );
-    gtk_entry_set_text ( GTK_ENTRY ( context->gui.reply ), "Not connected with peer..." );
+    set_reply_hint ( context, "Peer is offline, messages will be queued..." );
     g_signal_connect ( context->gui.reply, "key-release-event", G_CALLBACK ( reply_on_key_press ),
         context );
 